@@ -11,9 +11,38 @@ namespace as
 		Tkn op;  // operation
 		Tkn dst; // destination
 		Tkn src; // source
+		Tkn src2; // second source
 		Tkn lbl; // label
 	};
 
+	// a block of the package's read only data
+	struct Data
+	{
+		Tkn type; // data keyword, which is the type of the elements
+		Tkn name;
+		mn::Buf<Tkn> values;
+	};
+
+	inline static Data
+	data_new()
+	{
+		Data self{};
+		self.values = mn::buf_new<Tkn>();
+		return self;
+	}
+
+	inline static void
+	data_free(Data& self)
+	{
+		mn::buf_free(self.values);
+	}
+
+	inline static void
+	destruct(Data& self)
+	{
+		data_free(self);
+	}
+
 	struct Proc
 	{
 		Tkn name;
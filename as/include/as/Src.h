@@ -21,6 +21,7 @@ namespace as
 		mn::Buf<Err> errs;
 		mn::Buf<Tkn> tkns;
 		mn::Buf<Proc> procs;
+		mn::Buf<Data> data;
 	};
 
 	AS_EXPORT Src*
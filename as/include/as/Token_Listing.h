@@ -17,6 +17,14 @@
 	TOKEN(KEYWORD_U16_LOAD, "u16.load"), \
 	TOKEN(KEYWORD_U32_LOAD, "u32.load"), \
 	TOKEN(KEYWORD_U64_LOAD, "u64.load"), \
+	TOKEN(KEYWORD_I8_DATA, "i8.data"), \
+	TOKEN(KEYWORD_I16_DATA, "i16.data"), \
+	TOKEN(KEYWORD_I32_DATA, "i32.data"), \
+	TOKEN(KEYWORD_I64_DATA, "i64.data"), \
+	TOKEN(KEYWORD_U8_DATA, "u8.data"), \
+	TOKEN(KEYWORD_U16_DATA, "u16.data"), \
+	TOKEN(KEYWORD_U32_DATA, "u32.data"), \
+	TOKEN(KEYWORD_U64_DATA, "u64.data"), \
 	TOKEN(KEYWORD_I8_ADD, "i8.add"), \
 	TOKEN(KEYWORD_I16_ADD, "i16.add"), \
 	TOKEN(KEYWORD_I32_ADD, "i32.add"), \
@@ -98,6 +106,52 @@
 	TOKEN(KEYWORD_U16_JGE, "u16.jge"), \
 	TOKEN(KEYWORD_U32_JGE, "u32.jge"), \
 	TOKEN(KEYWORD_U64_JGE, "u64.jge"), \
+	TOKEN(KEYWORD_SPAWN, "spawn"), \
+	TOKEN(KEYWORD_YIELD, "yield"), \
+	TOKEN(KEYWORD_JOIN, "join"), \
+	TOKEN(KEYWORD_SEND, "send"), \
+	TOKEN(KEYWORD_RECV, "recv"), \
+	TOKEN(KEYWORD_TRY_SEND, "try_send"), \
+	TOKEN(KEYWORD_TRY_RECV, "try_recv"), \
+	TOKEN(KEYWORD_I8_CAS, "i8.cas"), \
+	TOKEN(KEYWORD_I16_CAS, "i16.cas"), \
+	TOKEN(KEYWORD_I32_CAS, "i32.cas"), \
+	TOKEN(KEYWORD_I64_CAS, "i64.cas"), \
+	TOKEN(KEYWORD_U8_CAS, "u8.cas"), \
+	TOKEN(KEYWORD_U16_CAS, "u16.cas"), \
+	TOKEN(KEYWORD_U32_CAS, "u32.cas"), \
+	TOKEN(KEYWORD_U64_CAS, "u64.cas"), \
+	TOKEN(KEYWORD_I8_XCHG, "i8.xchg"), \
+	TOKEN(KEYWORD_I16_XCHG, "i16.xchg"), \
+	TOKEN(KEYWORD_I32_XCHG, "i32.xchg"), \
+	TOKEN(KEYWORD_I64_XCHG, "i64.xchg"), \
+	TOKEN(KEYWORD_U8_XCHG, "u8.xchg"), \
+	TOKEN(KEYWORD_U16_XCHG, "u16.xchg"), \
+	TOKEN(KEYWORD_U32_XCHG, "u32.xchg"), \
+	TOKEN(KEYWORD_U64_XCHG, "u64.xchg"), \
+	TOKEN(KEYWORD_I8_FETCH_ADD, "i8.fetch_add"), \
+	TOKEN(KEYWORD_I16_FETCH_ADD, "i16.fetch_add"), \
+	TOKEN(KEYWORD_I32_FETCH_ADD, "i32.fetch_add"), \
+	TOKEN(KEYWORD_I64_FETCH_ADD, "i64.fetch_add"), \
+	TOKEN(KEYWORD_U8_FETCH_ADD, "u8.fetch_add"), \
+	TOKEN(KEYWORD_U16_FETCH_ADD, "u16.fetch_add"), \
+	TOKEN(KEYWORD_U32_FETCH_ADD, "u32.fetch_add"), \
+	TOKEN(KEYWORD_U64_FETCH_ADD, "u64.fetch_add"), \
+	TOKEN(KEYWORD_I8_FETCH_OR, "i8.fetch_or"), \
+	TOKEN(KEYWORD_I16_FETCH_OR, "i16.fetch_or"), \
+	TOKEN(KEYWORD_I32_FETCH_OR, "i32.fetch_or"), \
+	TOKEN(KEYWORD_I64_FETCH_OR, "i64.fetch_or"), \
+	TOKEN(KEYWORD_U8_FETCH_OR, "u8.fetch_or"), \
+	TOKEN(KEYWORD_U16_FETCH_OR, "u16.fetch_or"), \
+	TOKEN(KEYWORD_U32_FETCH_OR, "u32.fetch_or"), \
+	TOKEN(KEYWORD_U64_FETCH_OR, "u64.fetch_or"), \
+	TOKEN(KEYWORD_FENCE, "fence"), \
+	TOKEN(KEYWORD_HCALL, "hcall"), \
+	TOKEN(KEYWORD_NCALL, "ncall"), \
+	TOKEN(KEYWORD_IO_OPEN, "io.open"), \
+	TOKEN(KEYWORD_IO_READ, "io.read"), \
+	TOKEN(KEYWORD_IO_WRITE, "io.write"), \
+	TOKEN(KEYWORD_IO_CLOSE, "io.close"), \
 	TOKEN(KEYWORD_R0, "R0"), \
 	TOKEN(KEYWORD_R1, "R1"), \
 	TOKEN(KEYWORD_R2, "R2"), \
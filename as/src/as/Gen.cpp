@@ -11,41 +11,40 @@
 #include <mn/Defer.h>
 
 #include <assert.h>
+#include <stdint.h>
 
 namespace as
 {
-	inline static void
-	write64(uint8_t* ptr, uint64_t v)
-	{
-		ptr[0] = uint8_t(v);
-		ptr[1] = uint8_t(v >> 8);
-		ptr[2] = uint8_t(v >> 16);
-		ptr[3] = uint8_t(v >> 24);
-		ptr[4] = uint8_t(v >> 32);
-		ptr[5] = uint8_t(v >> 40);
-		ptr[6] = uint8_t(v >> 48);
-		ptr[7] = uint8_t(v >> 56);
-	}
-
 	struct Fixup_Request
 	{
 		Tkn name;
+		// index of the offset in the bytecode as it's first emitted, every offset takes 4 bytes
+		// there and the jumps are shrunk once all the labels are known
 		size_t bytecode_index;
+		// size of the final offset in bytes
+		uint8_t offset_size;
+		// jumps are relaxed, spawn always has a 4 bytes offset
+		bool relaxable;
 	};
 
 	struct Emitter
 	{
 		Src* src;
+		vm::Pkg* pkg;
+		// offsets of the package's data blocks in its read only data
+		const mn::Map<const char*, uint32_t>* data;
 		mn::Buf<uint8_t> out;
 		mn::Buf<Fixup_Request> fixups;
 		mn::Map<const char*, size_t> symbols;
 	};
 
 	inline static Emitter
-	emitter_new(Src* src)
+	emitter_new(Src* src, vm::Pkg* pkg, const mn::Map<const char*, uint32_t>* data)
 	{
 		Emitter self{};
 		self.src = src;
+		self.pkg = pkg;
+		self.data = data;
 		self.fixups = mn::buf_new<Fixup_Request>();
 		self.symbols = mn::map_new<const char*, uint64_t>();
 		return self;
@@ -65,10 +64,17 @@ namespace as
 	}
 
 	inline static void
-	emitter_label_fixup_request(Emitter& self, const Tkn& label)
+	emitter_label_fixup_request(Emitter& self, const Tkn& label, bool relaxable = false)
+	{
+		mn::buf_push(self.fixups, Fixup_Request{ label, self.out.count, uint8_t(relaxable ? 1 : 4), relaxable });
+		vm::push32(self.out, 0);
+	}
+
+	inline static void
+	emitter_jump_gen(Emitter& self, vm::Op op, const Tkn& label)
 	{
-		mn::buf_push(self.fixups, Fixup_Request{ label, self.out.count });
-		vm::push64(self.out, 0);
+		vm::push8(self.out, uint8_t(op));
+		emitter_label_fixup_request(self, label, true);
 	}
 
 	inline static void
@@ -84,41 +90,95 @@ namespace as
 		}
 	}
 
-	inline static void
-	emitter_reg_gen(Emitter& self, const Tkn& r)
+	inline static vm::Reg
+	emitter_reg(const Tkn& r)
 	{
 		switch(r.kind)
 		{
-		case Tkn::KIND_KEYWORD_R0:
-			vm::push8(self.out, uint8_t(vm::Reg_R0));
-			break;
-		case Tkn::KIND_KEYWORD_R1:
-			vm::push8(self.out, uint8_t(vm::Reg_R1));
-			break;
-		case Tkn::KIND_KEYWORD_R2:
-			vm::push8(self.out, uint8_t(vm::Reg_R2));
-			break;
-		case Tkn::KIND_KEYWORD_R3:
-			vm::push8(self.out, uint8_t(vm::Reg_R3));
-			break;
-		case Tkn::KIND_KEYWORD_R4:
-			vm::push8(self.out, uint8_t(vm::Reg_R4));
-			break;
-		case Tkn::KIND_KEYWORD_R5:
-			vm::push8(self.out, uint8_t(vm::Reg_R5));
-			break;
-		case Tkn::KIND_KEYWORD_R6:
-			vm::push8(self.out, uint8_t(vm::Reg_R6));
-			break;
-		case Tkn::KIND_KEYWORD_R7:
-			vm::push8(self.out, uint8_t(vm::Reg_R7));
-			break;
-		case Tkn::KIND_KEYWORD_IP:
-			vm::push8(self.out, uint8_t(vm::Reg_IP));
-			break;
+		case Tkn::KIND_KEYWORD_R0: return vm::Reg_R0;
+		case Tkn::KIND_KEYWORD_R1: return vm::Reg_R1;
+		case Tkn::KIND_KEYWORD_R2: return vm::Reg_R2;
+		case Tkn::KIND_KEYWORD_R3: return vm::Reg_R3;
+		case Tkn::KIND_KEYWORD_R4: return vm::Reg_R4;
+		case Tkn::KIND_KEYWORD_R5: return vm::Reg_R5;
+		case Tkn::KIND_KEYWORD_R6: return vm::Reg_R6;
+		case Tkn::KIND_KEYWORD_R7: return vm::Reg_R7;
+		case Tkn::KIND_KEYWORD_IP: return vm::Reg_IP;
 		default:
 			assert(false && "unreachable");
-			break;
+			return vm::Reg_R0;
+		}
+	}
+
+	inline static void
+	emitter_reg_gen(Emitter& self, const Tkn& r)
+	{
+		vm::push8(self.out, uint8_t(emitter_reg(r)));
+	}
+
+	// registers fit in a nibble so pairs of them are packed in a single byte
+	inline static void
+	emitter_reg_pair_gen(Emitter& self, const Tkn& a, const Tkn& b)
+	{
+		vm::push8(self.out, uint8_t(emitter_reg(a) | (emitter_reg(b) << 4)));
+	}
+
+	inline static void
+	emitter_chan_gen(Emitter& self, const Tkn& c)
+	{
+		// convert the string value to the channel index
+		uint8_t chan = 0;
+		// reads returns the number of the parsed items
+		size_t res = mn::reads(c.str, chan);
+		// assert that we parsed the only item we have
+		assert(res == 1);
+		vm::push8(self.out, chan);
+	}
+
+	// loads from the data block at the label, or from its element at the index register
+	inline static void
+	emitter_kload_gen(Emitter& self, const Ins& ins, vm::Op op)
+	{
+		auto it = mn::map_lookup(*self.data, ins.lbl.str);
+		if (it == nullptr)
+		{
+			src_err(self.src, ins.lbl, mn::strf("'{}' undefined data", ins.lbl.str));
+			return;
+		}
+
+		if (ins.src2)
+		{
+			vm::push8(self.out, uint8_t(op + (vm::Op_KLOADX8 - vm::Op_KLOAD8)));
+			emitter_reg_pair_gen(self, ins.dst, ins.src2);
+		}
+		else
+		{
+			vm::push8(self.out, uint8_t(op));
+			emitter_reg_gen(self, ins.dst);
+		}
+		vm::push32(self.out, it->value);
+	}
+
+	// constants which don't fit in 32 bits are loaded from the read only data, where every use
+	// of the same constant shares the same 8 bytes
+	inline static void
+	emitter_load64_gen(Emitter& self, const Tkn& dst, uint64_t c, bool large)
+	{
+		if (large)
+		{
+			uint8_t bytes[sizeof(c)];
+			for (size_t i = 0; i < sizeof(c); ++i)
+				bytes[i] = uint8_t(c >> (i * 8));
+
+			vm::push8(self.out, uint8_t(vm::Op_KLOAD64));
+			emitter_reg_gen(self, dst);
+			vm::push32(self.out, vm::pkg_data_add(*self.pkg, bytes, sizeof(bytes), sizeof(bytes)));
+		}
+		else
+		{
+			vm::push8(self.out, uint8_t(vm::Op_LOAD64));
+			emitter_reg_gen(self, dst);
+			vm::push64(self.out, c);
 		}
 	}
 
@@ -129,6 +189,12 @@ namespace as
 		{
 		case Tkn::KIND_KEYWORD_I8_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD8);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD8));
 			emitter_reg_gen(self, ins.dst);
 
@@ -144,6 +210,12 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_U8_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD8);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD8));
 			emitter_reg_gen(self, ins.dst);
 
@@ -159,6 +231,12 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_I16_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD16);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD16));
 			emitter_reg_gen(self, ins.dst);
 
@@ -174,6 +252,12 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_U16_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD16);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD16));
 			emitter_reg_gen(self, ins.dst);
 
@@ -189,6 +273,12 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_I32_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD32);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD32));
 			emitter_reg_gen(self, ins.dst);
 
@@ -204,6 +294,12 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_U32_LOAD:
 		{
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD32);
+				break;
+			}
+
 			vm::push8(self.out, uint8_t(vm::Op_LOAD32));
 			emitter_reg_gen(self, ins.dst);
 
@@ -219,8 +315,11 @@ namespace as
 
 		case Tkn::KIND_KEYWORD_I64_LOAD:
 		{
-			vm::push8(self.out, uint8_t(vm::Op_LOAD64));
-			emitter_reg_gen(self, ins.dst);
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD64);
+				break;
+			}
 
 			// convert the string value to int64_t
 			int64_t c = 0;
@@ -228,14 +327,17 @@ namespace as
 			size_t res = mn::reads(ins.src.str, c);
 			// assert that we parsed the only item we have
 			assert(res == 1);
-			vm::push64(self.out, uint64_t(c));
+			emitter_load64_gen(self, ins.dst, uint64_t(c), c < INT32_MIN || c > INT32_MAX);
 			break;
 		}
 
 		case Tkn::KIND_KEYWORD_U64_LOAD:
 		{
-			vm::push8(self.out, uint8_t(vm::Op_LOAD64));
-			emitter_reg_gen(self, ins.dst);
+			if (ins.lbl)
+			{
+				emitter_kload_gen(self, ins, vm::Op_KLOAD64);
+				break;
+			}
 
 			// convert the string value to uint64_t
 			uint64_t c = 0;
@@ -243,7 +345,7 @@ namespace as
 			size_t res = mn::reads(ins.src.str, c);
 			// assert that we parsed the only item we have
 			assert(res == 1);
-			vm::push64(self.out, c);
+			emitter_load64_gen(self, ins.dst, c, c > UINT32_MAX);
 			break;
 		}
 
@@ -251,548 +353,612 @@ namespace as
 		case Tkn::KIND_KEYWORD_I8_ADD:
 		case Tkn::KIND_KEYWORD_U8_ADD:
 			vm::push8(self.out, uint8_t(vm::Op_ADD8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_ADD:
 		case Tkn::KIND_KEYWORD_U16_ADD:
 			vm::push8(self.out, uint8_t(vm::Op_ADD16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_ADD:
 		case Tkn::KIND_KEYWORD_U32_ADD:
 			vm::push8(self.out, uint8_t(vm::Op_ADD32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_ADD:
 		case Tkn::KIND_KEYWORD_U64_ADD:
 			vm::push8(self.out, uint8_t(vm::Op_ADD64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_SUB:
 		case Tkn::KIND_KEYWORD_U8_SUB:
 			vm::push8(self.out, uint8_t(vm::Op_SUB8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_SUB:
 		case Tkn::KIND_KEYWORD_U16_SUB:
 			vm::push8(self.out, uint8_t(vm::Op_SUB16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_SUB:
 		case Tkn::KIND_KEYWORD_U32_SUB:
 			vm::push8(self.out, uint8_t(vm::Op_SUB32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_SUB:
 		case Tkn::KIND_KEYWORD_U64_SUB:
 			vm::push8(self.out, uint8_t(vm::Op_SUB64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_IMUL8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_MUL8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_IMUL16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_MUL16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_IMUL32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_MUL32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_IMUL64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_MUL:
 			vm::push8(self.out, uint8_t(vm::Op_MUL64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_IDIV8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_DIV8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_IDIV16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_DIV16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_IDIV32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_DIV32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_IDIV64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_DIV:
 			vm::push8(self.out, uint8_t(vm::Op_DIV64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JNE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JNE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JNE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JL:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JL:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JL:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JL:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JL:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JL:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JL:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JL:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JL));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JL, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JLE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JLE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JLE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JG:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JG:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JG:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JG:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JG:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JG:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JG:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JG:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JG));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JG, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I8_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I16_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I32_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_I64_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_ICMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U8_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP8));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U16_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP16));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U32_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP32));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_U64_JGE:
 			vm::push8(self.out, uint8_t(vm::Op_CMP64));
-			emitter_reg_gen(self, ins.dst);
-			emitter_reg_gen(self, ins.src);
-			vm::push8(self.out, uint8_t(vm::Op_JGE));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_jump_gen(self, vm::Op_JGE, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_JMP:
-			vm::push8(self.out, uint8_t(vm::Op_JMP));
-			emitter_label_fixup_request(self, ins.lbl);
+			emitter_jump_gen(self, vm::Op_JMP, ins.lbl);
 			break;
 
 		case Tkn::KIND_KEYWORD_HALT:
 			vm::push8(self.out, uint8_t(vm::Op_HALT));
 			break;
 
+		case Tkn::KIND_KEYWORD_SPAWN:
+			vm::push8(self.out, uint8_t(vm::Op_SPAWN));
+			emitter_reg_gen(self, ins.dst);
+			emitter_label_fixup_request(self, ins.lbl);
+			break;
+
+		case Tkn::KIND_KEYWORD_YIELD:
+			vm::push8(self.out, uint8_t(vm::Op_YIELD));
+			break;
+
+		case Tkn::KIND_KEYWORD_JOIN:
+			vm::push8(self.out, uint8_t(vm::Op_JOIN));
+			emitter_reg_gen(self, ins.dst);
+			break;
+
+		case Tkn::KIND_KEYWORD_SEND:
+			vm::push8(self.out, uint8_t(vm::Op_SEND));
+			emitter_chan_gen(self, ins.src);
+			emitter_reg_gen(self, ins.dst);
+			break;
+
+		case Tkn::KIND_KEYWORD_RECV:
+			vm::push8(self.out, uint8_t(vm::Op_RECV));
+			emitter_chan_gen(self, ins.src);
+			emitter_reg_gen(self, ins.dst);
+			break;
+
+		case Tkn::KIND_KEYWORD_TRY_SEND:
+			vm::push8(self.out, uint8_t(vm::Op_TRY_SEND));
+			emitter_chan_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_TRY_RECV:
+			vm::push8(self.out, uint8_t(vm::Op_TRY_RECV));
+			emitter_chan_gen(self, ins.src);
+			emitter_reg_pair_gen(self, ins.dst, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_I8_CAS:
+		case Tkn::KIND_KEYWORD_U8_CAS:
+			vm::push8(self.out, uint8_t(vm::Op_CAS8));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_I16_CAS:
+		case Tkn::KIND_KEYWORD_U16_CAS:
+			vm::push8(self.out, uint8_t(vm::Op_CAS16));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_I32_CAS:
+		case Tkn::KIND_KEYWORD_U32_CAS:
+			vm::push8(self.out, uint8_t(vm::Op_CAS32));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_I64_CAS:
+		case Tkn::KIND_KEYWORD_U64_CAS:
+			vm::push8(self.out, uint8_t(vm::Op_CAS64));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_I8_XCHG:
+		case Tkn::KIND_KEYWORD_U8_XCHG:
+			vm::push8(self.out, uint8_t(vm::Op_XCHG8));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I16_XCHG:
+		case Tkn::KIND_KEYWORD_U16_XCHG:
+			vm::push8(self.out, uint8_t(vm::Op_XCHG16));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I32_XCHG:
+		case Tkn::KIND_KEYWORD_U32_XCHG:
+			vm::push8(self.out, uint8_t(vm::Op_XCHG32));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I64_XCHG:
+		case Tkn::KIND_KEYWORD_U64_XCHG:
+			vm::push8(self.out, uint8_t(vm::Op_XCHG64));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I8_FETCH_ADD:
+		case Tkn::KIND_KEYWORD_U8_FETCH_ADD:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_ADD8));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I16_FETCH_ADD:
+		case Tkn::KIND_KEYWORD_U16_FETCH_ADD:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_ADD16));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I32_FETCH_ADD:
+		case Tkn::KIND_KEYWORD_U32_FETCH_ADD:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_ADD32));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I64_FETCH_ADD:
+		case Tkn::KIND_KEYWORD_U64_FETCH_ADD:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_ADD64));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I8_FETCH_OR:
+		case Tkn::KIND_KEYWORD_U8_FETCH_OR:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_OR8));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I16_FETCH_OR:
+		case Tkn::KIND_KEYWORD_U16_FETCH_OR:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_OR16));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I32_FETCH_OR:
+		case Tkn::KIND_KEYWORD_U32_FETCH_OR:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_OR32));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_I64_FETCH_OR:
+		case Tkn::KIND_KEYWORD_U64_FETCH_OR:
+			vm::push8(self.out, uint8_t(vm::Op_FETCH_OR64));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_FENCE:
+			vm::push8(self.out, uint8_t(vm::Op_FENCE));
+			break;
+
+		case Tkn::KIND_KEYWORD_IO_OPEN:
+			vm::push8(self.out, uint8_t(vm::Op_IO_OPEN));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			break;
+
+		case Tkn::KIND_KEYWORD_IO_READ:
+			vm::push8(self.out, uint8_t(vm::Op_IO_READ));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_IO_WRITE:
+			vm::push8(self.out, uint8_t(vm::Op_IO_WRITE));
+			emitter_reg_pair_gen(self, ins.dst, ins.src);
+			emitter_reg_gen(self, ins.src2);
+			break;
+
+		case Tkn::KIND_KEYWORD_IO_CLOSE:
+			vm::push8(self.out, uint8_t(vm::Op_IO_CLOSE));
+			emitter_reg_gen(self, ins.dst);
+			break;
+
+		case Tkn::KIND_KEYWORD_NCALL:
+			vm::push8(self.out, uint8_t(vm::Op_NCALL));
+			// host functions are resolved by name when the package is bound to the host
+			vm::push32(self.out, vm::pkg_import(*self.pkg, ins.src.str));
+			break;
+
+		case Tkn::KIND_KEYWORD_HCALL:
+		{
+			vm::push8(self.out, uint8_t(vm::Op_HCALL));
+
+			// convert the string value to the call id
+			uint32_t id = 0;
+			// reads returns the number of the parsed items
+			size_t res = mn::reads(ins.src.str, id);
+			// assert that we parsed the only item we have
+			assert(res == 1);
+			vm::push32(self.out, id);
+			break;
+		}
+
 		case Tkn::KIND_ID:
 			emitter_register_symbol(self, ins.op);
 			break;
@@ -804,6 +970,34 @@ namespace as
 		}
 	}
 
+	// returns where the index of the bytecode as it was first emitted ends up once the offsets
+	// are shrunk, removed[i] is the count of bytes removed by the fixups before the i-th one
+	inline static size_t
+	emitter_relaxed_index(const Emitter& self, const mn::Buf<size_t>& removed, size_t index)
+	{
+		// count the fixups whose offset comes before the index
+		size_t lo = 0, hi = self.fixups.count;
+		while (lo < hi)
+		{
+			size_t mid = lo + (hi - lo) / 2;
+			if (self.fixups[mid].bytecode_index < index)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return index - removed[lo];
+	}
+
+	inline static bool
+	offset_fits(int64_t offset, uint8_t size)
+	{
+		if (size == 1)
+			return offset >= INT8_MIN && offset <= INT8_MAX;
+		if (size == 2)
+			return offset >= INT16_MIN && offset <= INT16_MAX;
+		return offset >= INT32_MIN && offset <= INT32_MAX;
+	}
+
 	inline static mn::Buf<uint8_t>
 	emitter_proc_gen(Emitter& self, const Proc& proc)
 	{
@@ -813,35 +1007,153 @@ namespace as
 		for(const auto& ins: proc.ins)
 			emitter_ins_gen(self, ins);
 
-		// do the fixups
-		for(auto fixup: self.fixups)
+		// resolve the labels
+		auto targets = mn::buf_with_count<size_t>(self.fixups.count);
+		mn_defer(mn::buf_free(targets));
+		for(size_t i = 0; i < self.fixups.count; ++i)
 		{
-			auto it = mn::map_lookup(self.symbols, fixup.name.str);
+			auto it = mn::map_lookup(self.symbols, self.fixups[i].name.str);
 			if(it == nullptr)
 			{
-				src_err(self.src, fixup.name, mn::strf("'{}' undefined symbol", fixup.name.str));
+				src_err(self.src, self.fixups[i].name, mn::strf("'{}' undefined symbol", self.fixups[i].name.str));
+				targets[i] = SIZE_MAX;
 				continue;
 			}
+			targets[i] = it->value;
+		}
+
+		// branch relaxation, the jumps start with 1 byte offsets and grow until their targets are
+		// in reach, growing only moves targets further away so this settles in a few rounds
+		auto removed = mn::buf_with_count<size_t>(self.fixups.count + 1);
+		mn_defer(mn::buf_free(removed));
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			removed[0] = 0;
+			for(size_t i = 0; i < self.fixups.count; ++i)
+				removed[i + 1] = removed[i] + (sizeof(int32_t) - self.fixups[i].offset_size);
+
+			for(size_t i = 0; i < self.fixups.count; ++i)
+			{
+				auto& fixup = self.fixups[i];
+				if (fixup.relaxable == false || targets[i] == SIZE_MAX || fixup.offset_size == sizeof(int32_t))
+					continue;
+
+				int64_t target = emitter_relaxed_index(self, removed, targets[i]);
+				int64_t end = emitter_relaxed_index(self, removed, fixup.bytecode_index + sizeof(int32_t));
+				if (offset_fits(target - end, fixup.offset_size) == false)
+				{
+					fixup.offset_size *= 2;
+					changed = true;
+				}
+			}
+		}
+
+		// write the final bytecode with the shrunk jumps
+		auto res = mn::buf_new<uint8_t>();
+		mn::buf_reserve(res, self.out.count - removed[self.fixups.count]);
+		size_t copied = 0;
+		for(size_t i = 0; i < self.fixups.count; ++i)
+		{
+			const auto& fixup = self.fixups[i];
+			for (; copied < fixup.bytecode_index; ++copied)
+				vm::push8(res, self.out[copied]);
+			copied += sizeof(int32_t);
 
-			int64_t offset = it->value - (fixup.bytecode_index + sizeof(int64_t));
-			write64(self.out.ptr + fixup.bytecode_index, uint64_t(offset));
+			if (fixup.relaxable)
+				res[res.count - 1] = uint8_t(vm::op_jump_sized(vm::Op(res[res.count - 1]), fixup.offset_size));
+
+			int64_t offset = 0;
+			if (targets[i] != SIZE_MAX)
+				offset = int64_t(emitter_relaxed_index(self, removed, targets[i])) - int64_t(res.count + fixup.offset_size);
+			assert(offset_fits(offset, fixup.offset_size));
+
+			switch(fixup.offset_size)
+			{
+			case 1: vm::push8(res, uint8_t(offset)); break;
+			case 2: vm::push16(res, uint16_t(offset)); break;
+			default: vm::push32(res, uint32_t(offset)); break;
+			}
 		}
+		for (; copied < self.out.count; ++copied)
+			vm::push8(res, self.out[copied]);
 
-		auto res = self.out;
+		mn::buf_free(self.out);
 		self.out = {};
 		return res;
 	}
 
+	template<typename T>
+	inline static void
+	data_value_gen(mn::Buf<uint8_t>& out, const Tkn& value)
+	{
+		// convert the string value to the element type
+		T c = 0;
+		// reads returns the number of the parsed items
+		size_t res = mn::reads(value.str, c);
+		// assert that we parsed the only item we have
+		assert(res == 1);
+
+		if constexpr (sizeof(T) == 1)
+			vm::push8(out, uint8_t(c));
+		else if constexpr (sizeof(T) == 2)
+			vm::push16(out, uint16_t(c));
+		else if constexpr (sizeof(T) == 4)
+			vm::push32(out, uint32_t(c));
+		else
+			vm::push64(out, uint64_t(c));
+	}
+
+	// adds the data block to the package's read only data aligned to its element size
+	inline static uint32_t
+	data_gen(vm::Pkg& pkg, const Data& data)
+	{
+		auto out = mn::buf_new<uint8_t>();
+		mn_defer(mn::buf_free(out));
+
+		for(const auto& value: data.values)
+		{
+			switch(data.type.kind)
+			{
+			case Tkn::KIND_KEYWORD_I8_DATA: data_value_gen<int8_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_I16_DATA: data_value_gen<int16_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_I32_DATA: data_value_gen<int32_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_I64_DATA: data_value_gen<int64_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_U8_DATA: data_value_gen<uint8_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_U16_DATA: data_value_gen<uint16_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_U32_DATA: data_value_gen<uint32_t>(out, value); break;
+			case Tkn::KIND_KEYWORD_U64_DATA: data_value_gen<uint64_t>(out, value); break;
+			default: assert(false && "unreachable"); break;
+			}
+		}
+
+		return vm::pkg_data_add(pkg, out.ptr, out.count, out.count / data.values.count);
+	}
+
 	// API
 	vm::Pkg
 	src_gen(Src* src)
 	{
 		auto pkg = vm::pkg_new();
+
+		auto data = mn::map_new<const char*, uint32_t>();
+		mn_defer(mn::map_free(data));
+		for(const auto& block: src->data)
+		{
+			if (mn::map_lookup(data, block.name.str) != nullptr)
+			{
+				src_err(src, block.name, mn::strf("'{}' data redefinition", block.name.str));
+				continue;
+			}
+			mn::map_insert(data, block.name.str, data_gen(pkg, block));
+		}
+
 		for(size_t i = 0; i < src->procs.count; ++i)
 		{
 			auto name = src->procs[i].name.str;
 
-			auto emitter = emitter_new(src);
+			auto emitter = emitter_new(src, &pkg, &data);
 			mn_defer(emitter_free(emitter));
 
 			auto code = emitter_proc_gen(emitter, src->procs[i]);
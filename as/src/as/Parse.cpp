@@ -152,6 +152,19 @@ namespace as
 				tkn.kind == Tkn::KIND_KEYWORD_U64_LOAD);
 	}
 
+	inline static bool
+	is_data(const Tkn& tkn)
+	{
+		return (tkn.kind == Tkn::KIND_KEYWORD_I8_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_I16_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_I32_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_I64_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_U8_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_U16_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_U32_DATA ||
+				tkn.kind == Tkn::KIND_KEYWORD_U64_DATA);
+	}
+
 	inline static bool
 	is_arithmetic(const Tkn& tkn)
 	{
@@ -242,6 +255,62 @@ namespace as
 				tkn.kind == Tkn::KIND_KEYWORD_U64_JGE);
 	}
 
+	inline static bool
+	is_chan(const Tkn& tkn)
+	{
+		return (tkn.kind == Tkn::KIND_KEYWORD_SEND ||
+				tkn.kind == Tkn::KIND_KEYWORD_RECV);
+	}
+
+	inline static bool
+	is_chan_try(const Tkn& tkn)
+	{
+		return (tkn.kind == Tkn::KIND_KEYWORD_TRY_SEND ||
+				tkn.kind == Tkn::KIND_KEYWORD_TRY_RECV);
+	}
+
+	inline static bool
+	is_atomic_rmw(const Tkn& tkn)
+	{
+		return (tkn.kind == Tkn::KIND_KEYWORD_I8_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_I16_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_I32_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_I64_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_U8_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_U16_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_U32_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_U64_XCHG ||
+				tkn.kind == Tkn::KIND_KEYWORD_I8_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_I16_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_I32_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_I64_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_U8_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_U16_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_U32_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_U64_FETCH_ADD ||
+				tkn.kind == Tkn::KIND_KEYWORD_I8_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_I16_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_I32_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_I64_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_U8_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_U16_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_U32_FETCH_OR ||
+				tkn.kind == Tkn::KIND_KEYWORD_U64_FETCH_OR);
+	}
+
+	inline static bool
+	is_atomic_cas(const Tkn& tkn)
+	{
+		return (tkn.kind == Tkn::KIND_KEYWORD_I8_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_I16_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_I32_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_I64_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_U8_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_U16_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_U32_CAS ||
+				tkn.kind == Tkn::KIND_KEYWORD_U64_CAS);
+	}
+
 	inline static Ins
 	parser_ins(Parser* self)
 	{
@@ -252,7 +321,17 @@ namespace as
 		{
 			ins.op = parser_eat(self);
 			ins.dst = parser_reg(self);
-			ins.src = parser_const(self);
+			// loads from a data block name it and can index it with a register
+			if (parser_look_kind(self, Tkn::KIND_ID))
+			{
+				ins.lbl = parser_eat(self);
+				if (is_reg(parser_look(self)))
+					ins.src2 = parser_eat(self);
+			}
+			else
+			{
+				ins.src = parser_const(self);
+			}
 		}
 		else if (is_arithmetic(op))
 		{
@@ -272,13 +351,82 @@ namespace as
 			ins.op = parser_eat(self);
 			ins.lbl = parser_eat_must(self, Tkn::KIND_ID);
 		}
+		else if (op.kind == Tkn::KIND_KEYWORD_SPAWN)
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+			ins.lbl = parser_eat_must(self, Tkn::KIND_ID);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_JOIN)
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+		}
+		// channel ops: [chan] [value register] [ok register]
+		else if (is_chan(op))
+		{
+			ins.op = parser_eat(self);
+			ins.src = parser_const(self);
+			ins.dst = parser_reg(self);
+		}
+		else if (is_atomic_rmw(op))
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+			ins.src = parser_reg(self);
+		}
+		else if (is_atomic_cas(op))
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+			ins.src = parser_reg(self);
+			ins.src2 = parser_reg(self);
+		}
+		else if (is_chan_try(op))
+		{
+			ins.op = parser_eat(self);
+			ins.src = parser_const(self);
+			ins.dst = parser_reg(self);
+			ins.src2 = parser_reg(self);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_IO_CLOSE)
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_IO_OPEN)
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+			ins.src = parser_reg(self);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_IO_READ ||
+				op.kind == Tkn::KIND_KEYWORD_IO_WRITE)
+		{
+			ins.op = parser_eat(self);
+			ins.dst = parser_reg(self);
+			ins.src = parser_reg(self);
+			ins.src2 = parser_reg(self);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_HCALL)
+		{
+			ins.op = parser_eat(self);
+			ins.src = parser_const(self);
+		}
+		else if (op.kind == Tkn::KIND_KEYWORD_NCALL)
+		{
+			ins.op = parser_eat(self);
+			ins.src = parser_eat_must(self, Tkn::KIND_ID);
+		}
 		// label
 		else if (op.kind == Tkn::KIND_ID)
 		{
 			ins.op = parser_eat(self);
 			parser_eat_must(self, Tkn::KIND_COLON);
 		}
-		else if(op.kind == Tkn::KIND_KEYWORD_HALT)
+		else if(op.kind == Tkn::KIND_KEYWORD_HALT ||
+				op.kind == Tkn::KIND_KEYWORD_YIELD ||
+				op.kind == Tkn::KIND_KEYWORD_FENCE)
 		{
 			ins.op = parser_eat(self);
 		}
@@ -307,6 +455,22 @@ namespace as
 		return proc;
 	}
 
+	inline static Data
+	parser_data(Parser* self)
+	{
+		auto data = data_new();
+		data.type = parser_eat(self);
+		data.name = parser_eat_must(self, Tkn::KIND_ID);
+
+		while (parser_look_kind(self, Tkn::KIND_INTEGER))
+			mn::buf_push(data.values, parser_eat(self));
+
+		if (data.name && data.values.count == 0)
+			src_err(self->src, data.name, mn::strf("'{}' data has no values", data.name.str));
+
+		return data;
+	}
+
 	// API
 	bool
 	parse(Src* src)
@@ -316,6 +480,18 @@ namespace as
 
 		while(parser.ix < parser.tkns.count)
 		{
+			if (is_data(parser_look(&parser)))
+			{
+				auto data = parser_data(&parser);
+				if (src_has_err(src))
+				{
+					data_free(data);
+					break;
+				}
+				mn::buf_push(src->data, data);
+				continue;
+			}
+
 			auto proc = parser_proc(&parser);
 			if (src_has_err(src)) break;
 			mn::buf_push(src->procs, proc);
@@ -330,13 +506,30 @@ namespace as
 		auto out = mn::memory_stream_new(allocator);
 		mn_defer(mn::memory_stream_free(out));
 
+		for(const auto& data: self->data)
+		{
+			mn::print_to(out, "{} {}", data.type.str, data.name.str);
+			for(const auto& value: data.values)
+				mn::print_to(out, " {}", value.str);
+			mn::print_to(out, "\n");
+		}
+
 		for(const auto& proc: self->procs)
 		{
 			mn::print_to(out, "PROC {}\n", proc.name.str);
 			for(const auto& ins: proc.ins)
 			{
-				if (is_load(ins.op) ||
-					is_arithmetic(ins.op))
+				if (is_load(ins.op) && ins.lbl && ins.src2)
+				{
+					mn::print_to(out, "  {} {} {} {}\n", ins.op.str, ins.dst.str, ins.lbl.str, ins.src2.str);
+				}
+				else if (is_load(ins.op) && ins.lbl)
+				{
+					mn::print_to(out, "  {} {} {}\n", ins.op.str, ins.dst.str, ins.lbl.str);
+				}
+				else if (is_load(ins.op) ||
+					is_arithmetic(ins.op) ||
+					is_atomic_rmw(ins.op))
 				{
 					mn::print_to(out, "  {} {} {}\n", ins.op.str, ins.dst.str, ins.src.str);
 				}
@@ -348,11 +541,51 @@ namespace as
 				{
 					mn::print_to(out, "  {} {}\n", ins.op.str, ins.lbl.str);
 				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_SPAWN)
+				{
+					mn::print_to(out, "  {} {} {}\n", ins.op.str, ins.dst.str, ins.lbl.str);
+				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_JOIN)
+				{
+					mn::print_to(out, "  {} {}\n", ins.op.str, ins.dst.str);
+				}
+				else if(is_chan(ins.op))
+				{
+					mn::print_to(out, "  {} {} {}\n", ins.op.str, ins.src.str, ins.dst.str);
+				}
+				else if(is_atomic_cas(ins.op))
+				{
+					mn::print_to(out, "  {} {} {} {}\n", ins.op.str, ins.dst.str, ins.src.str, ins.src2.str);
+				}
+				else if(is_chan_try(ins.op))
+				{
+					mn::print_to(out, "  {} {} {} {}\n", ins.op.str, ins.src.str, ins.dst.str, ins.src2.str);
+				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_IO_CLOSE)
+				{
+					mn::print_to(out, "  {} {}\n", ins.op.str, ins.dst.str);
+				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_IO_OPEN)
+				{
+					mn::print_to(out, "  {} {} {}\n", ins.op.str, ins.dst.str, ins.src.str);
+				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_IO_READ ||
+						ins.op.kind == Tkn::KIND_KEYWORD_IO_WRITE)
+				{
+					mn::print_to(out, "  {} {} {} {}\n", ins.op.str, ins.dst.str, ins.src.str, ins.src2.str);
+				}
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_HCALL ||
+						ins.op.kind == Tkn::KIND_KEYWORD_NCALL)
+				{
+					mn::print_to(out, "  {} {}\n", ins.op.str, ins.src.str);
+				}
 				else if(ins.op.kind == Tkn::KIND_ID)
 				{
 					mn::print_to(out, "{}:\n", ins.op.str);
 				}
-				else if(ins.op.kind == Tkn::KIND_KEYWORD_HALT)
+				else if(ins.op.kind == Tkn::KIND_KEYWORD_HALT ||
+						ins.op.kind == Tkn::KIND_KEYWORD_YIELD ||
+						ins.op.kind == Tkn::KIND_KEYWORD_FENCE)
 				{
 					mn::print_to(out, "  {}\n", ins.op.str);
 				}
@@ -18,6 +18,7 @@ namespace as
 		self->errs = mn::buf_new<Err>();
 		self->tkns = mn::buf_new<Tkn>();
 		self->procs = mn::buf_new<Proc>();
+		self->data = mn::buf_new<Data>();
 		return self;
 	}
 
@@ -44,6 +45,7 @@ namespace as
 		destruct(self->errs);
 		mn::buf_free(self->tkns);
 		destruct(self->procs);
+		destruct(self->data);
 		mn::free(self);
 	}
 
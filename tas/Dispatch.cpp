@@ -0,0 +1,641 @@
+#include "Dispatch.h"
+#include "Net.h"
+#include "Map.h"
+
+#include <vm/Pkg.h>
+#include <vm/Core.h>
+#include <vm/File_Map.h>
+
+#include <mn/IO.h>
+#include <mn/Buf.h>
+#include <mn/Defer.h>
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t DISPATCH_MAX_PACKAGE = 256 * 1024 * 1024;
+constexpr uint32_t DISPATCH_MAX_BATCH = 1 + sizeof(uint64_t) + MAP_CHUNK_RECORDS * vm::Reg_IP * sizeof(vm::Reg_Val);
+
+#if !defined(_WIN32)
+// worker
+
+struct Worker_Session
+{
+	int fd;
+	// bytes of the package which is loaded from them in place
+	mn::Buf<uint8_t> pkg_bytes;
+	vm::Pkg pkg;
+	vm::Proc_Handle proc;
+	size_t record_size;
+	std::mutex write_mtx;
+	// count of the session's batches in the pool, it's guarded by the pool's mutex
+	size_t pending;
+	std::condition_variable done_cv;
+};
+
+struct Worker_Batch
+{
+	Worker_Session* session;
+	uint64_t index;
+	mn::Buf<uint8_t> records;
+};
+
+// the sessions of a worker process share its threads so many coordinators don't oversubscribe it
+struct Worker_Pool
+{
+	std::mutex mtx;
+	std::condition_variable cv;
+	// batches queue, the batches before head are taken already
+	mn::Buf<Worker_Batch> batches;
+	size_t head;
+	// the sessions being served, they're shut down when the worker stops
+	mn::Buf<Worker_Session*> sessions;
+	// set when the worker stops, the threads leave once the sessions are gone
+	bool stopping;
+
+	std::thread* threads;
+	size_t threads_count;
+};
+
+// the package comes as bytes and it's loaded in place from a copy the session owns
+inline static bool
+worker_pkg_load(Worker_Session& self, const uint8_t* ptr, size_t size)
+{
+	mn::buf_resize(self.pkg_bytes, size);
+	if(size > 0)
+		::memcpy(self.pkg_bytes.ptr, ptr, size);
+	self.pkg = vm::pkg_from_memory(self.pkg_bytes.ptr, self.pkg_bytes.count);
+	// a broken package loads empty
+	return self.pkg.file.ptr != nullptr || self.pkg.procs.count > 0;
+}
+
+// pops the next batch of any session, returns false once the worker stops and the sessions are gone
+inline static bool
+worker_pool_pop(Worker_Pool& self, Worker_Batch& batch)
+{
+	std::unique_lock<std::mutex> lock(self.mtx);
+	self.cv.wait(lock, [&self]{
+		return self.head < self.batches.count || (self.stopping && self.sessions.count == 0);
+	});
+	if(self.head == self.batches.count)
+		return false;
+
+	batch = self.batches[self.head++];
+	if(self.head == self.batches.count)
+	{
+		mn::buf_clear(self.batches);
+		self.head = 0;
+	}
+	return true;
+}
+
+inline static void
+worker_pool_run(Worker_Pool* self)
+{
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	Worker_Batch batch{};
+	while(worker_pool_pop(*self, batch))
+	{
+		auto session = batch.session;
+		size_t records_count = batch.records.count / session->record_size;
+
+		net_frame_begin(frame);
+		net_push(frame, DISPATCH_MSG_RESULT);
+		net_push(frame, batch.index);
+		size_t failed_offset = frame.count;
+		net_push(frame, uint64_t(0));
+		size_t results_offset = frame.count;
+		mn::buf_resize(frame, results_offset + records_count * sizeof(vm::Reg_Val));
+
+		uint64_t failed_count = map_records(session->proc, core, batch.records.ptr, frame.ptr + results_offset, session->record_size, records_count);
+		::memcpy(frame.ptr + failed_offset, &failed_count, sizeof(failed_count));
+		net_frame_end(frame);
+		mn::buf_free(batch.records);
+
+		{
+			std::lock_guard<std::mutex> lock(session->write_mtx);
+			// if the coordinator is gone the reader will notice and end the session
+			net_write_all(session->fd, frame.ptr, frame.count);
+		}
+
+		// the session waits for its last batch before it's gone
+		std::lock_guard<std::mutex> lock(self->mtx);
+		if(--session->pending == 0)
+			session->done_cv.notify_all();
+	}
+}
+
+// returns false if the worker is stopping already
+inline static bool
+worker_pool_enter(Worker_Pool& self, Worker_Session* session)
+{
+	std::lock_guard<std::mutex> lock(self.mtx);
+	if(self.stopping)
+		return false;
+	mn::buf_push(self.sessions, session);
+	return true;
+}
+
+// waits for the session's batches in the pool then forgets it
+inline static void
+worker_pool_leave(Worker_Pool& self, Worker_Session* session)
+{
+	std::unique_lock<std::mutex> lock(self.mtx);
+	session->done_cv.wait(lock, [session]{ return session->pending == 0; });
+	for(size_t i = 0; i < self.sessions.count; ++i)
+	{
+		if(self.sessions[i] == session)
+		{
+			mn::buf_remove(self.sessions, i);
+			break;
+		}
+	}
+	self.cv.notify_all();
+}
+
+// stops reading the sessions, lets the threads finish the batches they have and joins them
+inline static void
+worker_pool_stop(Worker_Pool& self)
+{
+	{
+		std::lock_guard<std::mutex> lock(self.mtx);
+		self.stopping = true;
+		for(auto session: self.sessions)
+			::shutdown(session->fd, SHUT_RD);
+		self.cv.notify_all();
+	}
+
+	for(size_t i = 0; i < self.threads_count; ++i)
+		self.threads[i].join();
+	delete[] self.threads;
+}
+
+inline static DISPATCH_STATUS
+worker_session_setup(Worker_Session& self, const mn::Buf<uint8_t>& frame)
+{
+	size_t offset = 0;
+	uint8_t msg = 0;
+	uint32_t record_size = 0;
+	uint8_t name_len = 0;
+	if(net_pop(frame, offset, msg) == false || msg != DISPATCH_MSG_SETUP ||
+		net_pop(frame, offset, record_size) == false || record_size == 0 ||
+		record_size > vm::Reg_IP * sizeof(vm::Reg_Val) ||
+		net_pop(frame, offset, name_len) == false || offset + name_len > frame.count)
+	{
+		return DISPATCH_STATUS_BAD_REQUEST;
+	}
+	self.record_size = record_size;
+
+	char name[256];
+	::memcpy(name, frame.ptr + offset, name_len);
+	name[name_len] = '\0';
+	offset += name_len;
+
+	if(worker_pkg_load(self, frame.ptr + offset, frame.count - offset) == false)
+		return DISPATCH_STATUS_BAD_PACKAGE;
+
+	self.proc = vm::proc_handle_get(self.pkg, name);
+	if(vm::proc_handle_valid(self.proc) == false)
+		return DISPATCH_STATUS_UNKNOWN_PROC;
+	return DISPATCH_STATUS_OK;
+}
+
+inline static void
+worker_session(Worker_Pool* pool, int fd)
+{
+	Worker_Session self{};
+	self.fd = fd;
+	self.pkg_bytes = mn::buf_new<uint8_t>();
+	self.pkg = vm::pkg_new();
+	self.pending = 0;
+	mn_defer(::close(self.fd));
+	mn_defer(mn::buf_free(self.pkg_bytes));
+	mn_defer(vm::pkg_free(self.pkg));
+
+	if(worker_pool_enter(*pool, &self) == false)
+		return;
+	mn_defer(worker_pool_leave(*pool, &self));
+
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	if(net_read_frame(fd, frame, DISPATCH_MAX_PACKAGE) == false)
+		return;
+
+	auto status = worker_session_setup(self, frame);
+
+	// the window keeps every thread busy while the next batches are on their way
+	net_frame_begin(frame);
+	net_push(frame, DISPATCH_MSG_READY);
+	net_push(frame, status);
+	net_push(frame, uint32_t(pool->threads_count * 2));
+	net_frame_end(frame);
+	if(net_write_all(fd, frame.ptr, frame.count) == false || status != DISPATCH_STATUS_OK)
+		return;
+
+	while(true)
+	{
+		auto records = mn::buf_new<uint8_t>();
+		size_t offset = 0;
+		uint8_t msg = 0;
+		uint64_t index = 0;
+		if(net_read_frame(fd, records, DISPATCH_MAX_BATCH) == false ||
+			net_pop(records, offset, msg) == false || msg != DISPATCH_MSG_BATCH ||
+			net_pop(records, offset, index) == false ||
+			(records.count - offset) % self.record_size != 0)
+		{
+			mn::buf_free(records);
+			break;
+		}
+
+		// drop the header and keep the records
+		::memmove(records.ptr, records.ptr + offset, records.count - offset);
+		mn::buf_resize(records, records.count - offset);
+
+		std::lock_guard<std::mutex> lock(pool->mtx);
+		mn::buf_push(pool->batches, Worker_Batch{&self, index, records});
+		++self.pending;
+		pool->cv.notify_one();
+	}
+}
+
+// coordinator
+
+struct Dispatch_Job
+{
+	const uint8_t* input;
+	uint8_t* output;
+	size_t record_size;
+	size_t records_count;
+	size_t batches_count;
+	std::atomic<uint64_t> failed_count;
+
+	// guards the batches and the links' state
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t next_batch;
+	size_t done_batches;
+	// batches of the workers which hung up, the other links send them again
+	mn::Buf<uint64_t> lost;
+};
+
+struct Dispatch_Link
+{
+	Dispatch_Job* job;
+	mn::Str address;
+	int fd;
+	uint32_t window;
+
+	// the batches sent and not answered yet
+	mn::Buf<uint64_t> inflight;
+	bool broken;
+};
+
+// the link's batches in flight go back to the job for the other links
+inline static void
+dispatch_link_break(Dispatch_Link& self)
+{
+	auto job = self.job;
+	std::lock_guard<std::mutex> lock(job->mtx);
+	if(self.broken == false && self.inflight.count > 0)
+		mn::printerr("worker '{}' hung up with {} batches in flight, they're sent again\n", self.address, self.inflight.count);
+	self.broken = true;
+	for(auto index: self.inflight)
+		mn::buf_push(job->lost, index);
+	mn::buf_clear(self.inflight);
+	job->cv.notify_all();
+}
+
+// takes the next batch to send once the window has room, the lost batches go first, returns
+// false once the link is broken or every batch is done
+inline static bool
+dispatch_link_take(Dispatch_Link& self, uint64_t& index)
+{
+	auto job = self.job;
+	std::unique_lock<std::mutex> lock(job->mtx);
+	job->cv.wait(lock, [&self, job]{
+		if(self.broken || job->done_batches == job->batches_count)
+			return true;
+		return self.inflight.count < self.window && (job->lost.count > 0 || job->next_batch < job->batches_count);
+	});
+	if(self.broken || job->done_batches == job->batches_count)
+		return false;
+
+	if(job->lost.count > 0)
+	{
+		index = mn::buf_top(job->lost);
+		mn::buf_pop(job->lost);
+	}
+	else
+	{
+		index = job->next_batch++;
+	}
+	mn::buf_push(self.inflight, index);
+	return true;
+}
+
+inline static bool
+dispatch_link_setup(Dispatch_Link& self, const vm::File_Map& package, const mn::Str& proc_name)
+{
+	self.fd = net_tcp_connect(self.address.ptr);
+	if(self.fd < 0)
+	{
+		mn::printerr("can't connect to worker '{}'\n", self.address);
+		return false;
+	}
+
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	net_frame_begin(frame);
+	net_push(frame, DISPATCH_MSG_SETUP);
+	net_push(frame, uint32_t(self.job->record_size));
+	net_push(frame, uint8_t(proc_name.count));
+	mn::buf_resize(frame, frame.count + proc_name.count + package.size);
+	::memcpy(frame.ptr + frame.count - package.size - proc_name.count, proc_name.ptr, proc_name.count);
+	::memcpy(frame.ptr + frame.count - package.size, package.ptr, package.size);
+	net_frame_end(frame);
+
+	size_t offset = 0;
+	uint8_t msg = 0;
+	uint8_t status = DISPATCH_STATUS_BAD_REQUEST;
+	if(net_write_all(self.fd, frame.ptr, frame.count) == false ||
+		net_read_frame(self.fd, frame, 64) == false ||
+		net_pop(frame, offset, msg) == false || msg != DISPATCH_MSG_READY ||
+		net_pop(frame, offset, status) == false ||
+		net_pop(frame, offset, self.window) == false)
+	{
+		mn::printerr("worker '{}' failed the setup\n", self.address);
+		return false;
+	}
+
+	if(status != DISPATCH_STATUS_OK)
+	{
+		mn::printerr("worker '{}' refused the setup with status {}\n", self.address, status);
+		return false;
+	}
+
+	if(self.window == 0)
+		self.window = 1;
+	return true;
+}
+
+inline static void
+dispatch_link_send(Dispatch_Link* self)
+{
+	auto job = self->job;
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	// the link keeps sending until every batch is done since it may get the batches of a worker
+	// which hangs up
+	uint64_t index = 0;
+	while(dispatch_link_take(*self, index))
+	{
+		size_t begin = index * MAP_CHUNK_RECORDS;
+		size_t count = MAP_CHUNK_RECORDS;
+		if(count > job->records_count - begin)
+			count = job->records_count - begin;
+
+		net_frame_begin(frame);
+		net_push(frame, DISPATCH_MSG_BATCH);
+		net_push(frame, uint64_t(index));
+		size_t records_offset = frame.count;
+		mn::buf_resize(frame, records_offset + count * job->record_size);
+		::memcpy(frame.ptr + records_offset, job->input + begin * job->record_size, count * job->record_size);
+		net_frame_end(frame);
+
+		if(net_write_all(self->fd, frame.ptr, frame.count) == false)
+		{
+			// the receiver gives the batches in flight back when it sees the connection go
+			::shutdown(self->fd, SHUT_RDWR);
+			break;
+		}
+	}
+
+	// tells the worker there are no more batches, it closes the connection after the last result
+	::shutdown(self->fd, SHUT_WR);
+}
+
+inline static void
+dispatch_link_recv(Dispatch_Link* self)
+{
+	auto job = self->job;
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	while(net_read_frame(self->fd, frame, DISPATCH_MAX_BATCH))
+	{
+		size_t offset = 0;
+		uint8_t msg = 0;
+		uint64_t index = 0;
+		uint64_t failed_count = 0;
+		if(net_pop(frame, offset, msg) == false || msg != DISPATCH_MSG_RESULT ||
+			net_pop(frame, offset, index) == false || index >= job->batches_count ||
+			net_pop(frame, offset, failed_count) == false)
+		{
+			break;
+		}
+
+		size_t begin = index * MAP_CHUNK_RECORDS;
+		size_t count = MAP_CHUNK_RECORDS;
+		if(count > job->records_count - begin)
+			count = job->records_count - begin;
+		if(frame.count - offset != count * sizeof(vm::Reg_Val))
+			break;
+
+		// results of batches which aren't in flight on this link are a broken worker
+		{
+			std::lock_guard<std::mutex> lock(job->mtx);
+			size_t i = 0;
+			while(i < self->inflight.count && self->inflight[i] != index)
+				++i;
+			if(i == self->inflight.count)
+				break;
+			mn::buf_remove(self->inflight, i);
+		}
+
+		::memcpy(job->output + begin * sizeof(vm::Reg_Val), frame.ptr + offset, count * sizeof(vm::Reg_Val));
+		job->failed_count.fetch_add(failed_count, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(job->mtx);
+		++job->done_batches;
+		job->cv.notify_all();
+	}
+
+	// the worker closed the connection, and the sender may be stuck writing to it
+	::shutdown(self->fd, SHUT_RDWR);
+	dispatch_link_break(*self);
+}
+#endif
+
+// API
+int64_t
+dispatch(const mn::Str& package, const mn::Str& proc_name, const mn::Str& workers, const uint8_t* input, uint8_t* output, size_t record_size, size_t records_count)
+{
+#if defined(_WIN32)
+	(void)package; (void)proc_name; (void)workers; (void)input; (void)output; (void)record_size; (void)records_count;
+	mn::printerr("dispatch is not supported on windows yet\n");
+	return -1;
+#else
+	// the setup frame has a byte for the length of the name
+	if(proc_name.count > UINT8_MAX)
+	{
+		mn::printerr("'{}' proc name is too long\n", proc_name);
+		return -1;
+	}
+
+	auto pkg_file = vm::file_map_read(package.ptr);
+	if(vm::file_map_valid(pkg_file) == false || pkg_file.size > DISPATCH_MAX_PACKAGE / 2)
+	{
+		mn::printerr("can't ship '{}'\n", package);
+		return -1;
+	}
+	mn_defer(vm::file_map_close(pkg_file));
+
+	Dispatch_Job job{};
+	job.input = input;
+	job.output = output;
+	job.record_size = record_size;
+	job.records_count = records_count;
+	job.batches_count = (records_count + MAP_CHUNK_RECORDS - 1) / MAP_CHUNK_RECORDS;
+	job.failed_count.store(0, std::memory_order_relaxed);
+	job.next_batch = 0;
+	job.done_batches = 0;
+	job.lost = mn::buf_new<uint64_t>();
+	mn_defer(mn::buf_free(job.lost));
+
+	::signal(SIGPIPE, SIG_IGN);
+
+	auto links = mn::buf_new<Dispatch_Link*>();
+	mn_defer({
+		for(auto link: links)
+		{
+			if(link->fd >= 0)
+				::close(link->fd);
+			mn::str_free(link->address);
+			mn::buf_free(link->inflight);
+			delete link;
+		}
+		mn::buf_free(links);
+	});
+
+	for(size_t begin = 0; begin < workers.count;)
+	{
+		size_t end = begin;
+		while(end < workers.count && workers[end] != ',')
+			++end;
+
+		if(end > begin)
+		{
+			auto link = new Dispatch_Link;
+			link->job = &job;
+			link->address = mn::str_from_substr(workers.ptr + begin, workers.ptr + end);
+			link->fd = -1;
+			link->window = 1;
+			link->inflight = mn::buf_new<uint64_t>();
+			link->broken = false;
+			mn::buf_push(links, link);
+
+			if(dispatch_link_setup(*link, pkg_file, proc_name) == false)
+				return -1;
+		}
+		begin = end + 1;
+	}
+
+	if(links.count == 0)
+	{
+		mn::printerr("you need to specify the workers with -a\n");
+		return -1;
+	}
+
+	auto threads = mn::buf_new<std::thread*>();
+	mn_defer(mn::buf_free(threads));
+	for(auto link: links)
+	{
+		mn::buf_push(threads, new std::thread(dispatch_link_send, link));
+		mn::buf_push(threads, new std::thread(dispatch_link_recv, link));
+	}
+	for(auto thread: threads)
+	{
+		thread->join();
+		delete thread;
+	}
+
+	// every worker hung up before the job was done
+	if(job.done_batches != job.batches_count)
+	{
+		mn::printerr("{} of {} batches were lost\n", job.batches_count - job.done_batches, job.batches_count);
+		return -1;
+	}
+	return int64_t(job.failed_count.load());
+#endif
+}
+
+int
+worker(const mn::Str& address, size_t jobs)
+{
+#if defined(_WIN32)
+	(void)address; (void)jobs;
+	mn::printerr("worker is not supported on windows yet\n");
+	return -1;
+#else
+	int listener = net_tcp_listen(address.ptr);
+	if(listener < 0)
+	{
+		mn::printerr("can't listen on '{}'\n", address);
+		return -1;
+	}
+	mn_defer(::close(listener));
+
+	::signal(SIGPIPE, SIG_IGN);
+
+	if(jobs == 0)
+		jobs = std::thread::hardware_concurrency();
+	if(jobs == 0)
+		jobs = 1;
+
+	Worker_Pool pool{};
+	pool.batches = mn::buf_new<Worker_Batch>();
+	pool.head = 0;
+	pool.sessions = mn::buf_new<Worker_Session*>();
+	pool.stopping = false;
+	mn_defer(mn::buf_free(pool.batches));
+	mn_defer(mn::buf_free(pool.sessions));
+
+	pool.threads = new std::thread[jobs];
+	pool.threads_count = jobs;
+	for(size_t i = 0; i < jobs; ++i)
+		pool.threads[i] = std::thread(worker_pool_run, &pool);
+
+	mn::print("worker listening on '{}' with {} threads\n", address, jobs);
+	while(true)
+	{
+		int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			mn::printerr("accept failed\n");
+			worker_pool_stop(pool);
+			return -1;
+		}
+
+		net_tcp_nodelay(fd);
+		std::thread(worker_session, &pool, fd).detach();
+	}
+#endif
+}
\ No newline at end of file
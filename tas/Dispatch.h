@@ -0,0 +1,43 @@
+#pragma once
+
+#include <mn/Str.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+// dispatch shards the records of a map over worker processes connected through tcp, the package
+// is shipped once per worker connection then the records are streamed in batches of
+// MAP_CHUNK_RECORDS, each worker has a window of batches in flight and the coordinator doesn't
+// send more until results come back
+// setup frame: [u32 len] [u8 SETUP] [u32 record size] [u8 name len] [name bytes] [package bytes]
+// ready frame: [u32 len] [u8 READY] [u8 status] [u32 window]
+// batch frame: [u32 len] [u8 BATCH] [u64 batch index] [records]
+// result frame: [u32 len] [u8 RESULT] [u64 batch index] [u64 failed count] [u64 R0 of each record]
+// the coordinator shuts down its side of the connection when it has no more batches and the
+// worker closes the connection once the results of the batches in flight are sent
+enum DISPATCH_MSG: uint8_t
+{
+	DISPATCH_MSG_SETUP,
+	DISPATCH_MSG_READY,
+	DISPATCH_MSG_BATCH,
+	DISPATCH_MSG_RESULT
+};
+
+enum DISPATCH_STATUS: uint8_t
+{
+	DISPATCH_STATUS_OK,
+	DISPATCH_STATUS_BAD_PACKAGE,
+	DISPATCH_STATUS_UNKNOWN_PROC,
+	DISPATCH_STATUS_BAD_REQUEST
+};
+
+// runs the proc over the records on the workers, workers is a comma separated list of host:port
+// addresses, the batches in flight on a worker which hangs up are sent to the others, returns
+// the count of records which didn't halt or -1 if a worker failed the setup or they all hung up
+int64_t
+dispatch(const mn::Str& package, const mn::Str& proc_name, const mn::Str& workers, const uint8_t* input, uint8_t* output, size_t record_size, size_t records_count);
+
+// serves dispatch coordinators on the host:port address, the connections share a pool of jobs
+// threads
+int
+worker(const mn::Str& address, size_t jobs);
\ No newline at end of file
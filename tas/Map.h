@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vm/Core.h>
+#include <vm/Call.h>
+
+#include <string.h>
+
+// records are processed in chunks, worker threads grab one chunk at a time and dispatch ships
+// one chunk per batch
+constexpr size_t MAP_CHUNK_RECORDS = 16 * 1024;
+
+// runs the proc over each record, the record is loaded into R0-R7 and R0 is written to the output
+// after the proc halts, returns the count of records which didn't halt
+inline static size_t
+map_records(vm::Proc_Handle proc, vm::Core& core, const uint8_t* input, uint8_t* output, size_t record_size, size_t records_count)
+{
+	size_t regs_count = (record_size + sizeof(vm::Reg_Val) - 1) / sizeof(vm::Reg_Val);
+	size_t failed_count = 0;
+	for(size_t i = 0; i < records_count; ++i)
+	{
+		vm::Reg_Val regs[vm::Reg_IP] = {};
+		::memcpy(regs, input + i * record_size, record_size);
+
+		auto res = vm::call_regs(proc, core, regs, regs_count);
+		if(core.state != vm::Core::STATE_HALT)
+			++failed_count;
+		::memcpy(output + i * sizeof(res), &res, sizeof(res));
+	}
+	return failed_count;
+}
\ No newline at end of file
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <mn/Buf.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+// small helpers shared by the networked commands, all the integers on the wire are little endian
+// and every message is a frame prefixed with its u32 length
+
+inline static bool
+net_read_exact(int fd, void* ptr, size_t size)
+{
+#if defined(_WIN32)
+	(void)fd; (void)ptr; (void)size;
+	return false;
+#else
+	auto it = (uint8_t*)ptr;
+	while(size > 0)
+	{
+		ssize_t res = ::read(fd, it, size);
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0)
+			return false;
+		it += res;
+		size -= size_t(res);
+	}
+	return true;
+#endif
+}
+
+inline static bool
+net_write_all(int fd, const void* ptr, size_t size)
+{
+#if defined(_WIN32)
+	(void)fd; (void)ptr; (void)size;
+	return false;
+#else
+	auto it = (const uint8_t*)ptr;
+	while(size > 0)
+	{
+		ssize_t res = ::write(fd, it, size);
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0)
+			return false;
+		it += res;
+		size -= size_t(res);
+	}
+	return true;
+#endif
+}
+
+// reads a whole frame into the buffer, frames bigger than the limit are treated as errors
+inline static bool
+net_read_frame(int fd, mn::Buf<uint8_t>& frame, uint32_t limit)
+{
+	uint32_t len = 0;
+	if(net_read_exact(fd, &len, sizeof(len)) == false || len > limit)
+		return false;
+	mn::buf_resize(frame, len);
+	return net_read_exact(fd, frame.ptr, len);
+}
+
+// appends the value to the frame being built
+template<typename T>
+inline static void
+net_push(mn::Buf<uint8_t>& frame, const T& value)
+{
+	size_t offset = frame.count;
+	mn::buf_resize(frame, offset + sizeof(value));
+	::memcpy(frame.ptr + offset, &value, sizeof(value));
+}
+
+// reads a value from the frame at the offset, returns false if the frame is too short
+template<typename T>
+inline static bool
+net_pop(const mn::Buf<uint8_t>& frame, size_t& offset, T& value)
+{
+	if(offset + sizeof(value) > frame.count)
+		return false;
+	::memcpy(&value, frame.ptr + offset, sizeof(value));
+	offset += sizeof(value);
+	return true;
+}
+
+// starts a frame, the length is patched by net_frame_end
+inline static void
+net_frame_begin(mn::Buf<uint8_t>& frame)
+{
+	mn::buf_clear(frame);
+	net_push(frame, uint32_t(0));
+}
+
+inline static void
+net_frame_end(mn::Buf<uint8_t>& frame)
+{
+	uint32_t len = uint32_t(frame.count - sizeof(uint32_t));
+	::memcpy(frame.ptr, &len, sizeof(len));
+}
+
+#if !defined(_WIN32)
+// resolves a host:port address, the host can be empty to mean all the interfaces
+inline static addrinfo*
+net_tcp_resolve(const char* address, bool passive)
+{
+	auto colon = ::strrchr(address, ':');
+	if(colon == nullptr)
+		return nullptr;
+
+	char host[256];
+	size_t host_len = size_t(colon - address);
+	if(host_len >= sizeof(host))
+		return nullptr;
+	::memcpy(host, address, host_len);
+	host[host_len] = '\0';
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(passive)
+		hints.ai_flags = AI_PASSIVE;
+
+	addrinfo* res = nullptr;
+	if(::getaddrinfo(host_len > 0 ? host : nullptr, colon + 1, &hints, &res) != 0)
+		return nullptr;
+	return res;
+}
+
+// frames are written as soon as they're ready so nagle only adds latency
+inline static void
+net_tcp_nodelay(int fd)
+{
+	int one = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+#endif
+
+// returns a listening tcp socket on the host:port address or -1
+inline static int
+net_tcp_listen(const char* address)
+{
+#if defined(_WIN32)
+	(void)address;
+	return -1;
+#else
+	auto res = net_tcp_resolve(address, true);
+	if(res == nullptr)
+		return -1;
+
+	int fd = -1;
+	for(auto it = res; it != nullptr; it = it->ai_next)
+	{
+		fd = ::socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC, it->ai_protocol);
+		if(fd < 0)
+			continue;
+
+		int one = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(::bind(fd, it->ai_addr, it->ai_addrlen) == 0 && ::listen(fd, 128) == 0)
+			break;
+
+		::close(fd);
+		fd = -1;
+	}
+	::freeaddrinfo(res);
+	return fd;
+#endif
+}
+
+// returns a tcp socket connected to the host:port address or -1
+inline static int
+net_tcp_connect(const char* address)
+{
+#if defined(_WIN32)
+	(void)address;
+	return -1;
+#else
+	auto res = net_tcp_resolve(address, false);
+	if(res == nullptr)
+		return -1;
+
+	int fd = -1;
+	for(auto it = res; it != nullptr; it = it->ai_next)
+	{
+		fd = ::socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC, it->ai_protocol);
+		if(fd < 0)
+			continue;
+
+		if(::connect(fd, it->ai_addr, it->ai_addrlen) == 0)
+		{
+			net_tcp_nodelay(fd);
+			break;
+		}
+
+		::close(fd);
+		fd = -1;
+	}
+	::freeaddrinfo(res);
+	return fd;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,401 @@
+#include "Serve.h"
+#include "Net.h"
+
+#include <vm/Pkg.h>
+#include <vm/Pkg_Registry.h>
+#include <vm/Core.h>
+#include <vm/Call.h>
+
+#include <mn/IO.h>
+#include <mn/Defer.h>
+#include <mn/Path.h>
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// requests are small, anything bigger is a broken client
+constexpr uint32_t SERVE_MAX_FRAME = 4096;
+
+struct Connection
+{
+	int fd;
+	// responses are written by the pool threads so they take turns
+	std::mutex write_mtx;
+	// one reference for the reader thread and one for each request in flight
+	std::atomic<int> ref_count;
+};
+
+inline static void
+connection_unref(Connection* self)
+{
+	if(self->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		::close(self->fd);
+		delete self;
+	}
+}
+
+// the proc is looked up by the worker which runs it so it runs on the packages' current versions
+struct Task
+{
+	Connection* conn;
+	Serve_Request request;
+};
+
+struct Server
+{
+	// the package files, they're loaded again when the server gets a SIGHUP
+	const mn::Buf<mn::Str>* paths;
+	// a registry for each package so they're swapped while the calls in flight finish on the
+	// versions they started on
+	mn::Buf<vm::Pkg_Registry> pkgs;
+	// packages generated from the same templates have mostly the same procs, so their bodies
+	// are interned and kept in memory once
+	vm::Code_Intern intern;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	// tasks queue, the tasks before head are taken already
+	mn::Buf<Task> tasks;
+	size_t head;
+	// the connections being read, they're shut down when the server stops
+	mn::Buf<Connection*> conns;
+	// set when the server stops, the workers leave once the readers are gone and the queue drains
+	bool stopping;
+	// the pool threads and the packages reloader, they're joined when the server stops
+	std::thread* workers;
+	size_t workers_count;
+	std::thread reloader;
+};
+
+// pins the current versions of the packages, the proc's package stays pinned and the rest are
+// released, if there's no such proc nothing stays pinned
+inline static vm::Proc_Handle
+server_proc_find(Server& self, const mn::Str& name, vm::Pkg_Registry& registry, vm::Pkg_Ref& ref)
+{
+	for(auto pkg: self.pkgs)
+	{
+		auto pkg_ref = vm::pkg_registry_acquire(pkg);
+		auto proc = vm::proc_handle_get(*pkg_ref.pkg, name);
+		if(vm::proc_handle_valid(proc))
+		{
+			registry = pkg;
+			ref = pkg_ref;
+			return proc;
+		}
+		vm::pkg_registry_release(pkg, pkg_ref);
+	}
+	return vm::Proc_Handle{};
+}
+
+inline static void
+server_push(Server& self, const Task& task)
+{
+	std::lock_guard<std::mutex> lock(self.mtx);
+	mn::buf_push(self.tasks, task);
+	self.cv.notify_one();
+}
+
+// returns false once the server stops and there are no more tasks
+inline static bool
+server_pop(Server& self, Task& task)
+{
+	std::unique_lock<std::mutex> lock(self.mtx);
+	self.cv.wait(lock, [&self]{
+		return self.head < self.tasks.count || (self.stopping && self.conns.count == 0);
+	});
+	if(self.head == self.tasks.count)
+		return false;
+
+	task = self.tasks[self.head++];
+	// reclaim the taken tasks once the queue drains
+	if(self.head == self.tasks.count)
+	{
+		mn::buf_clear(self.tasks);
+		self.head = 0;
+	}
+	return true;
+}
+
+inline static void
+task_respond(const Task& task, uint64_t result, mn::Buf<uint8_t>& frame)
+{
+	net_frame_begin(frame);
+	net_push(frame, task.request.id);
+	net_push(frame, uint8_t(task.request.status));
+	net_push(frame, result);
+	net_frame_end(frame);
+
+	std::lock_guard<std::mutex> lock(task.conn->write_mtx);
+	// the client may be gone already, there's nothing to do about it
+	net_write_all(task.conn->fd, frame.ptr, frame.count);
+}
+
+inline static void
+server_worker(Server* self)
+{
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	Task task{};
+	while(server_pop(*self, task))
+	{
+		uint64_t result = 0;
+		if(task.request.status == SERVE_STATUS_OK)
+		{
+			vm::Pkg_Registry registry = nullptr;
+			vm::Pkg_Ref ref{};
+			auto proc = server_proc_find(*self, mn::str_lit(task.request.name), registry, ref);
+			if(vm::proc_handle_valid(proc))
+			{
+				result = vm::call_regs(proc, core, task.request.args, task.request.args_count).u64;
+				if(core.state != vm::Core::STATE_HALT)
+					task.request.status = SERVE_STATUS_PROC_FAILED;
+				vm::pkg_registry_release(registry, ref);
+			}
+			else
+			{
+				task.request.status = SERVE_STATUS_UNKNOWN_PROC;
+			}
+		}
+
+		task_respond(task, result, frame);
+		connection_unref(task.conn);
+	}
+}
+
+// loads the packages again every time the server gets a SIGHUP and swaps them in, a package
+// file which is gone or broken keeps its current version, the server wakes it with a SIGHUP too
+// when it stops
+inline static void
+server_reloader(Server* self, sigset_t signals)
+{
+	while(true)
+	{
+		int sig = 0;
+		if(::sigwait(&signals, &sig) != 0)
+			continue;
+
+		{
+			std::lock_guard<std::mutex> lock(self->mtx);
+			if(self->stopping)
+				return;
+		}
+
+		size_t reloaded = 0;
+		for(size_t i = 0; i < self->paths->count; ++i)
+		{
+			vm::Pkg pkg{};
+			if(serve_pkg_load((*self->paths)[i], pkg) == false)
+				continue;
+
+			vm::pkg_code_intern_attach(pkg, self->intern);
+			vm::pkg_registry_swap(self->pkgs[i], pkg);
+			++reloaded;
+		}
+		mn::print("reloaded {} packages\n", reloaded);
+	}
+}
+
+// reads the pipelined requests of the connection and hands them to the pool
+inline static void
+connection_reader(Server* self, Connection* conn)
+{
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	while(net_read_frame(conn->fd, frame, SERVE_MAX_FRAME))
+	{
+		Task task{};
+		task.conn = conn;
+		if(serve_request_parse(frame, task.request) == false)
+			break;
+
+		conn->ref_count.fetch_add(1, std::memory_order_relaxed);
+		server_push(*self, task);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(self->mtx);
+		for(size_t i = 0; i < self->conns.count; ++i)
+		{
+			if(self->conns[i] == conn)
+			{
+				mn::buf_remove(self->conns, i);
+				break;
+			}
+		}
+		self->cv.notify_all();
+	}
+	connection_unref(conn);
+}
+
+// stops reading the connections, lets the workers finish the tasks they have and waits for all
+// the threads, the requests in flight are still answered
+inline static void
+server_stop(Server& self)
+{
+	{
+		std::lock_guard<std::mutex> lock(self.mtx);
+		self.stopping = true;
+		for(auto conn: self.conns)
+			::shutdown(conn->fd, SHUT_RD);
+		self.cv.notify_all();
+	}
+
+	for(size_t i = 0; i < self.workers_count; ++i)
+		self.workers[i].join();
+	delete[] self.workers;
+
+	::pthread_kill(self.reloader.native_handle(), SIGHUP);
+	self.reloader.join();
+}
+
+bool
+serve_pkg_load(const mn::Str& path, vm::Pkg& pkg)
+{
+	if(mn::path_is_file(path) == false)
+		return false;
+
+	pkg = vm::pkg_load(path);
+	// a package which doesn't load comes back empty
+	if(vm::file_map_valid(pkg.file) == false && pkg.procs.count == 0)
+	{
+		vm::pkg_free(pkg);
+		return false;
+	}
+	return true;
+}
+
+bool
+serve_request_parse(const mn::Buf<uint8_t>& frame, Serve_Request& request)
+{
+	size_t offset = 0;
+	if(net_pop(frame, offset, request.id) == false)
+		return false;
+
+	request.status = SERVE_STATUS_BAD_REQUEST;
+	if(net_pop(frame, offset, request.args_count) == false || request.args_count > vm::Reg_IP)
+		return true;
+	for(uint8_t i = 0; i < request.args_count; ++i)
+		if(net_pop(frame, offset, request.args[i].u64) == false)
+			return true;
+
+	if(net_pop(frame, offset, request.name_len) == false || offset + request.name_len != frame.count)
+		return true;
+
+	::memcpy(request.name, frame.ptr + offset, request.name_len);
+	request.name[request.name_len] = '\0';
+	request.status = SERVE_STATUS_OK;
+	return true;
+}
+
+int
+serve(const mn::Buf<mn::Str>& packages, const mn::Str& address, size_t jobs)
+{
+#if defined(_WIN32)
+	(void)packages; (void)address; (void)jobs;
+	mn::printerr("serve is not supported on windows yet\n");
+	return -1;
+#else
+	Server self{};
+	self.paths = &packages;
+	self.pkgs = mn::buf_new<vm::Pkg_Registry>();
+	self.tasks = mn::buf_new<Task>();
+	self.head = 0;
+	self.conns = mn::buf_new<Connection*>();
+	self.stopping = false;
+	self.intern = vm::code_intern_new();
+	mn_defer(destruct(self.pkgs));
+	mn_defer(mn::buf_free(self.tasks));
+	mn_defer(mn::buf_free(self.conns));
+	mn_defer(vm::code_intern_free(self.intern));
+
+	for(const auto& path: packages)
+	{
+		auto pkg = vm::pkg_load(path);
+		vm::pkg_code_intern_attach(pkg, self.intern);
+		mn::buf_push(self.pkgs, vm::pkg_registry_new(pkg));
+	}
+
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if(address.count >= sizeof(addr.sun_path))
+	{
+		mn::printerr("'{}' socket path is too long\n", address);
+		return -1;
+	}
+	::memcpy(addr.sun_path, address.ptr, address.count);
+
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listener < 0)
+	{
+		mn::printerr("can't create the socket\n");
+		return -1;
+	}
+	mn_defer(::close(listener));
+
+	::unlink(address.ptr);
+	if(::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listener, 128) != 0)
+	{
+		mn::printerr("can't listen on '{}'\n", address);
+		return -1;
+	}
+
+	// clients which hang up while we're writing shouldn't kill the server
+	::signal(SIGPIPE, SIG_IGN);
+
+	// SIGHUP is blocked before any thread starts so only the reloader gets it
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	self.reloader = std::thread(server_reloader, &self, signals);
+
+	if(jobs == 0)
+		jobs = std::thread::hardware_concurrency();
+	if(jobs == 0)
+		jobs = 1;
+	self.workers = new std::thread[jobs];
+	self.workers_count = jobs;
+	for(size_t i = 0; i < jobs; ++i)
+		self.workers[i] = std::thread(server_worker, &self);
+
+	mn::print("serving {} packages on '{}' with {} threads\n", self.pkgs.count, address, jobs);
+	while(true)
+	{
+		int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			mn::printerr("accept failed\n");
+			server_stop(self);
+			return -1;
+		}
+
+		auto conn = new Connection;
+		conn->fd = fd;
+		conn->ref_count.store(1, std::memory_order_relaxed);
+		{
+			// the readers are tracked so the server waits for them when it stops
+			std::lock_guard<std::mutex> lock(self.mtx);
+			mn::buf_push(self.conns, conn);
+		}
+		std::thread(connection_reader, &self, conn).detach();
+	}
+#endif
+}
\ No newline at end of file
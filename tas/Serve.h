@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vm/Core.h>
+#include <vm/Pkg.h>
+
+#include <mn/Str.h>
+#include <mn/Buf.h>
+
+// serve preloads the packages and executes requests coming over a unix domain socket
+// request frame: [u32 len] [u64 id] [u8 args count] [u64 args...] [u8 name len] [name bytes]
+// response frame: [u32 len] [u64 id] [u8 status] [u64 R0]
+// clients can pipeline requests, the responses come back as they finish so they're matched
+// to the requests by id
+// a SIGHUP loads the packages again and swaps them in, the requests in flight finish on the
+// versions they started on
+enum SERVE_STATUS: uint8_t
+{
+	SERVE_STATUS_OK,
+	SERVE_STATUS_UNKNOWN_PROC,
+	// the proc stopped without halting
+	SERVE_STATUS_PROC_FAILED,
+	SERVE_STATUS_BAD_REQUEST
+};
+
+struct Serve_Request
+{
+	uint64_t id;
+	SERVE_STATUS status;
+	uint8_t args_count;
+	vm::Reg_Val args[vm::Reg_IP];
+	uint8_t name_len;
+	char name[256];
+};
+
+// loads the package at the path, returns false if it's missing or broken and doesn't load
+bool
+serve_pkg_load(const mn::Str& path, vm::Pkg& pkg);
+
+// parses the request frame without its length, a request which is malformed after its id gets
+// SERVE_STATUS_BAD_REQUEST so it can be answered, returns false if there's no id to answer to
+bool
+serve_request_parse(const mn::Buf<uint8_t>& frame, Serve_Request& request);
+
+int
+serve(const mn::Buf<mn::Str>& packages, const mn::Str& address, size_t jobs);
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <mn/Buf.h>
 #include <mn/Defer.h>
 #include <mn/Path.h>
+#include <mn/File.h>
 
 #include <as/Src.h>
 #include <as/Scan.h>
@@ -9,6 +10,19 @@
 #include <as/Gen.h>
 
 #include <vm/Core.h>
+#include <vm/Call.h>
+#include <vm/File_Map.h>
+#include <vm/Verify.h>
+
+#include "Map.h"
+#include "Dispatch.h"
+#include "Serve.h"
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <string.h>
 
 const char* HELP_MSG = R"MSG(tas tethys assembler
 tas [command] [targets] [flags]
@@ -23,9 +37,32 @@ COMMANDS:
     'tas build -o pkg_name.zyc path/to/file.zy'
   run: loads and runs the specified package
     'tas run path/to/pkg_name.zyc'
+  map: runs a proc over every fixed size record of the input file, the record is loaded
+       into R0-R7 and R0 is written to the output file after the proc halts
+    'tas map -p proc -s 16 -o output.bin pkg_name.zyc input.bin'
+  serve: preloads the packages and runs the procs requested over a unix domain socket, it
+         reloads the packages when it gets a SIGHUP
+    'tas serve -a tas.sock -j 8 pkg_a.zyc pkg_b.zyc'
+  dispatch: like map but shards the records over tas workers through tcp
+    'tas dispatch -a host_a:7070,host_b:7070 -p proc -s 16 -o output.bin pkg_name.zyc input.bin'
+  worker: runs the records dispatched to it, the package comes with the dispatch
+    'tas worker -a 0.0.0.0:7070 -j 8'
+  verify: verifies the bytecode of every proc of the package, the verified procs run without
+          any checks, the ones which fail are listed with the offset of the failing instruction
+    'tas verify pkg_name.zyc'
+  embed: writes a c++ header with the package as a constexpr byte array and a directory of its
+         procs, vm::pkg_from_memory loads it in place so there's no file to read at startup
+    'tas embed -o pkg.h pkg_name.zyc'
 FLAGS:
   -o: specifies output file
     'tas build -o pkg.zyc path/to/file.zy'
+  -p: specifies the proc to run, main by default
+  -s: specifies the record size in bytes, 8 by default and 64 at most
+  -j: specifies the count of worker threads, all the hardware threads by default
+  -a: specifies the address to listen on, tas.sock by default for serve and 127.0.0.1:7070 for
+      worker, or the comma separated worker addresses for dispatch
+  -z: builds a compressed package, it's smaller but it's decompressed when it's loaded
+    'tas build -z -o pkg.zyc path/to/file.zy'
 )MSG";
 
 inline static void
@@ -40,8 +77,24 @@ struct Args
 	mn::Buf<mn::Str> targets;
 	mn::Buf<mn::Str> flags;
 	mn::Str out_name;
+	mn::Str proc_name;
+	mn::Str address;
+	size_t record_size;
+	size_t jobs;
 };
 
+// returns the value of the flag at argv[i] and skips it, or nullptr if it's missing
+inline static const char*
+args_value(int argc, char** argv, size_t& i)
+{
+	if(i + 1 >= size_t(argc))
+	{
+		mn::printerr("you need to specify a value for '{}'\n", argv[i]);
+		return nullptr;
+	}
+	return argv[++i];
+}
+
 inline static bool
 args_parse(Args& self, int argc, char** argv)
 {
@@ -55,7 +108,7 @@ args_parse(Args& self, int argc, char** argv)
 	{
 		if(::strcmp(argv[i], "-o") == 0)
 		{
-			if(i + 1 >= argc)
+			if(i + 1 >= size_t(argc))
 			{
 				mn::printerr("you need to specify output name\n");
 				return false;
@@ -65,6 +118,34 @@ args_parse(Args& self, int argc, char** argv)
 			self.out_name = mn::str_from_c(argv[i + 1]);
 			++i;
 		}
+		else if(::strcmp(argv[i], "-p") == 0 || ::strcmp(argv[i], "-a") == 0)
+		{
+			auto& str = argv[i][1] == 'p' ? self.proc_name : self.address;
+			auto value = args_value(argc, argv, i);
+			if(value == nullptr)
+				return false;
+
+			mn::str_free(str);
+			str = mn::str_from_c(value);
+		}
+		else if(::strcmp(argv[i], "-s") == 0 || ::strcmp(argv[i], "-j") == 0)
+		{
+			bool is_size = argv[i][1] == 's';
+			auto value = args_value(argc, argv, i);
+			if(value == nullptr)
+				return false;
+
+			size_t v = 0;
+			if(mn::reads(value, v) != 1)
+			{
+				mn::printerr("'{}' is not a number\n", value);
+				return false;
+			}
+			if(is_size)
+				self.record_size = v;
+			else
+				self.jobs = v;
+		}
 		else if (mn::str_prefix(argv[i], "--"))
 		{
 			buf_push(self.flags, mn::str_from_c(argv[i] + 2));
@@ -88,7 +169,11 @@ args_new()
 	self.command = mn::str_new();
 	self.targets = mn::buf_new<mn::Str>();
 	self.flags = mn::buf_new<mn::Str>();
-	self.out_name = mn::str_from_c("pkg.zyc");
+	self.out_name = mn::str_new();
+	self.proc_name = mn::str_from_c("main");
+	self.address = mn::str_new();
+	self.record_size = 8;
+	self.jobs = 0;
 	return self;
 }
 
@@ -99,6 +184,8 @@ args_free(Args& self)
 	destruct(self.targets);
 	destruct(self.flags);
 	mn::str_free(self.out_name);
+	mn::str_free(self.proc_name);
+	mn::str_free(self.address);
 }
 
 inline static bool
@@ -110,6 +197,311 @@ args_has_flag(Args& self, const char* search)
 	return false;
 }
 
+struct Map_Job
+{
+	vm::Proc_Handle proc;
+	const uint8_t* input;
+	uint8_t* output;
+	size_t record_size;
+	size_t records_count;
+	std::atomic<size_t> next_record;
+	std::atomic<size_t> failed_count;
+};
+
+inline static void
+map_worker(Map_Job* self)
+{
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	size_t failed_count = 0;
+	while(true)
+	{
+		size_t begin = self->next_record.fetch_add(MAP_CHUNK_RECORDS, std::memory_order_relaxed);
+		if(begin >= self->records_count)
+			break;
+
+		size_t count = MAP_CHUNK_RECORDS;
+		if(count > self->records_count - begin)
+			count = self->records_count - begin;
+
+		auto input = self->input + begin * self->record_size;
+		auto output = self->output + begin * sizeof(vm::Reg_Val);
+		failed_count += map_records(self->proc, core, input, output, self->record_size, count);
+	}
+	self->failed_count.fetch_add(failed_count, std::memory_order_relaxed);
+}
+
+inline static int
+map_command(const Args& args)
+{
+	bool remote = args.command == "dispatch";
+	if(args.targets.count != 2)
+	{
+		mn::printerr("{} needs a package and an input file\n", args.command);
+		return -1;
+	}
+
+	if(args.out_name.count == 0)
+	{
+		mn::printerr("you need to specify the output file with -o\n");
+		return -1;
+	}
+
+	if(args.record_size == 0 || args.record_size > vm::Reg_IP * sizeof(vm::Reg_Val))
+	{
+		mn::printerr("record size should be between 1 and {} bytes\n", vm::Reg_IP * sizeof(vm::Reg_Val));
+		return -1;
+	}
+
+	for(const auto& target: args.targets)
+	{
+		if(mn::path_is_file(target) == false)
+		{
+			mn::printerr("'{}' is not a file \n", target);
+			return -1;
+		}
+	}
+
+	auto pkg = vm::pkg_load(args.targets[0].ptr);
+	mn_defer(vm::pkg_free(pkg));
+
+	auto proc = vm::proc_handle_get(pkg, args.proc_name);
+	if(vm::proc_handle_valid(proc) == false)
+	{
+		mn::printerr("'{}' has no '{}' proc\n", args.targets[0], args.proc_name);
+		return -1;
+	}
+
+	auto input = vm::file_map_read(args.targets[1].ptr);
+	if(vm::file_map_valid(input) == false)
+	{
+		mn::printerr("can't map '{}'\n", args.targets[1]);
+		return -1;
+	}
+	mn_defer(vm::file_map_close(input));
+
+	size_t records_count = input.size / args.record_size;
+	if(input.size % args.record_size != 0)
+		mn::printerr("ignoring the last {} bytes of the input which don't make a whole record\n", input.size % args.record_size);
+
+	auto output = vm::file_map_write(args.out_name.ptr, records_count * sizeof(vm::Reg_Val));
+	if(vm::file_map_valid(output) == false)
+	{
+		mn::printerr("can't map '{}'\n", args.out_name);
+		return -1;
+	}
+	mn_defer(vm::file_map_close(output));
+
+	size_t failed_count = 0;
+	auto start = std::chrono::steady_clock::now();
+	if(remote)
+	{
+		auto res = dispatch(args.targets[0], args.proc_name, args.address, input.ptr, output.ptr, args.record_size, records_count);
+		if(res < 0)
+			return -1;
+		failed_count = size_t(res);
+	}
+	else
+	{
+		Map_Job job{};
+		job.proc = proc;
+		job.input = input.ptr;
+		job.output = output.ptr;
+		job.record_size = args.record_size;
+		job.records_count = records_count;
+		job.next_record.store(0, std::memory_order_relaxed);
+		job.failed_count.store(0, std::memory_order_relaxed);
+
+		size_t jobs = args.jobs;
+		if(jobs == 0)
+			jobs = std::thread::hardware_concurrency();
+		if(jobs == 0)
+			jobs = 1;
+
+		auto threads = mn::buf_new<std::thread*>();
+		mn_defer(mn::buf_free(threads));
+		for(size_t i = 0; i < jobs; ++i)
+			mn::buf_push(threads, new std::thread(map_worker, &job));
+		for(auto thread: threads)
+		{
+			thread->join();
+			delete thread;
+		}
+		failed_count = job.failed_count.load();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	mn::print("mapped {} records in {}s, {} records/s\n", records_count, seconds, seconds > 0 ? uint64_t(records_count / seconds) : 0);
+	if(failed_count > 0)
+	{
+		mn::printerr("{} records didn't halt\n", failed_count);
+		return -1;
+	}
+	return 0;
+}
+
+inline static int
+verify_command(const Args& args)
+{
+	if(args.targets.count != 1)
+	{
+		mn::printerr("verify needs a package\n");
+		return -1;
+	}
+
+	if(mn::path_is_file(args.targets[0]) == false)
+	{
+		mn::printerr("'{}' is not a file \n", args.targets[0]);
+		return -1;
+	}
+
+	auto pkg = vm::pkg_load(args.targets[0].ptr);
+	mn_defer(vm::pkg_free(pkg));
+
+	auto names = vm::pkg_proc_names(pkg);
+	mn_defer(destruct(names));
+
+	size_t failed_count = 0;
+	for(const auto& name: names)
+	{
+		auto res = vm::code_verify(vm::proc_handle_get(pkg, name).code);
+		if(res.err == vm::VERIFY_OK)
+			continue;
+
+		mn::printerr("{}: {} at offset {}\n", name, vm::verify_err_str(res.err), res.offset);
+		++failed_count;
+	}
+	mn::print("{} of {} procs verified\n", names.count - failed_count, names.count);
+	return failed_count == 0 ? 0 : -1;
+}
+
+// the header's namespace is the output file's name without its extension
+inline static mn::Str
+embed_namespace(const mn::Str& out_name)
+{
+	const char* begin = out_name.ptr;
+	const char* end = out_name.ptr + out_name.count;
+	for(auto it = begin; it != end; ++it)
+		if(*it == '/' || *it == '\\')
+			begin = it + 1;
+	for(auto it = begin; it != end; ++it)
+	{
+		if(*it == '.')
+		{
+			end = it;
+			break;
+		}
+	}
+
+	auto name = mn::str_new();
+	if(begin == end || (*begin >= '0' && *begin <= '9'))
+		mn::str_push(name, "_");
+	for(auto it = begin; it != end; ++it)
+	{
+		bool ident = (*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') || (*it >= '0' && *it <= '9');
+		char c[2] = {ident ? *it : '_', '\0'};
+		mn::str_push(name, c);
+	}
+	return name;
+}
+
+inline static int
+embed_command(const Args& args)
+{
+	if(args.targets.count != 1)
+	{
+		mn::printerr("embed needs a package\n");
+		return -1;
+	}
+
+	if(args.out_name.count == 0)
+	{
+		mn::printerr("you need to specify the output file with -o\n");
+		return -1;
+	}
+
+	if(mn::path_is_file(args.targets[0]) == false)
+	{
+		mn::printerr("'{}' is not a file \n", args.targets[0]);
+		return -1;
+	}
+
+	auto file = vm::file_map_read(args.targets[0].ptr);
+	mn_defer(vm::file_map_close(file));
+	if(vm::file_map_valid(file) == false)
+	{
+		mn::printerr("failed to read '{}'\n", args.targets[0]);
+		return -1;
+	}
+
+	// the package is embedded as it is, it should load from memory the way it'll be used
+	auto pkg = vm::pkg_from_memory(file.ptr, file.size);
+	mn_defer(vm::pkg_free(pkg));
+	if(pkg.file.ptr == nullptr && pkg.procs.count == 0)
+	{
+		mn::printerr("'{}' is not a package tas can embed, build it again\n", args.targets[0]);
+		return -1;
+	}
+
+	auto names = vm::pkg_proc_names(pkg);
+	mn_defer(destruct(names));
+
+	auto ns = embed_namespace(args.out_name);
+	mn_defer(mn::str_free(ns));
+
+	auto out = mn::str_new();
+	mn_defer(mn::str_free(out));
+	out = mn::strf(out, "// generated by tas embed from {}, don't edit\n", args.targets[0]);
+	out = mn::strf(out, "#pragma once\n\n#include <vm/Pkg.h>\n\n#include <stdint.h>\n#include <stddef.h>\n\n");
+	out = mn::strf(out, "namespace {}\n{{\n", ns);
+
+	// page aligned like a mapped file so the procs and data have the alignment they're saved with
+	out = mn::strf(out, "\talignas(vm::PKG_PAGE_SIZE) inline constexpr uint8_t bytes[] = {{");
+	for(size_t i = 0; i < file.size; ++i)
+	{
+		if(i % 16 == 0)
+			mn::str_push(out, "\n\t\t");
+		char byte[8];
+		::snprintf(byte, sizeof(byte), "0x%02x,", file.ptr[i]);
+		mn::str_push(out, byte);
+	}
+	out = mn::strf(out, "\n\t}};\n\n");
+
+	// the directory ends with a nullptr so it's never empty
+	out = mn::strf(out, "\tinline constexpr size_t procs_count = {};\n", names.count);
+	out = mn::strf(out, "\tinline constexpr const char* procs[] = {{\n");
+	for(const auto& name: names)
+	{
+		mn::str_push(out, "\t\t\"");
+		for(auto c: name)
+		{
+			char escaped[8];
+			if(c == '"' || c == '\\')
+				::snprintf(escaped, sizeof(escaped), "\\%c", c);
+			else if(c < 0x20 || c > 0x7e)
+				::snprintf(escaped, sizeof(escaped), "\\%03o", uint8_t(c));
+			else
+				::snprintf(escaped, sizeof(escaped), "%c", c);
+			mn::str_push(out, escaped);
+		}
+		mn::str_push(out, "\",\n");
+	}
+	out = mn::strf(out, "\t\tnullptr,\n\t}};\n\n");
+
+	out = mn::strf(out, "\tinline static vm::Pkg\n\tload()\n\t{{\n\t\treturn vm::pkg_from_memory(bytes, sizeof(bytes));\n\t}}\n}}\n");
+
+	auto f = mn::file_open(args.out_name, mn::IO_MODE::WRITE, mn::OPEN_MODE::CREATE_OVERWRITE);
+	if(f == nullptr)
+	{
+		mn::printerr("failed to write '{}'\n", args.out_name);
+		return -1;
+	}
+	mn_defer(mn::file_close(f));
+	mn::stream_write(f, mn::block_from(out));
+	return 0;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -232,7 +624,11 @@ main(int argc, char** argv)
 		auto pkg = as::src_gen(src);
 		mn_defer(vm::pkg_free(pkg));
 
-		vm::pkg_save(pkg, args.out_name);
+		auto out_name = args.out_name.count > 0 ? args.out_name : mn::str_lit("pkg.zyc");
+		if(args_has_flag(args, "z"))
+			vm::pkg_save_compressed(pkg, out_name);
+		else
+			vm::pkg_save(pkg, out_name);
 		return 0;
 	}
 	else if(args.command == "run")
@@ -257,15 +653,54 @@ main(int argc, char** argv)
 		auto pkg = vm::pkg_load(args.targets[0].ptr);
 		mn_defer(vm::pkg_free(pkg));
 
-		auto code = vm::pkg_load_proc(pkg, "main");
-		mn_defer(mn::buf_free(code));
+		auto main = vm::proc_handle_get(pkg, "main");
+		if(vm::proc_handle_valid(main) == false)
+		{
+			mn::printerr("'{}' has no main proc\n", args.targets[0]);
+			return -1;
+		}
 
 		auto cpu = vm::core_new();
-		while (cpu.state == vm::Core::STATE_OK)
-			vm::core_ins_execute(cpu, code);
+		mn_defer(vm::core_free(cpu));
+		auto res = vm::call(main, cpu);
 
-		mn::print("R0 = {}\n", cpu.r[vm::Reg_R0].i32);
+		mn::print("R0 = {}\n", res.i32);
 		return 0;
 	}
+	else if(args.command == "map" || args.command == "dispatch")
+	{
+		return map_command(args);
+	}
+	else if(args.command == "verify")
+	{
+		return verify_command(args);
+	}
+	else if(args.command == "embed")
+	{
+		return embed_command(args);
+	}
+	else if(args.command == "worker")
+	{
+		return worker(args.address.count > 0 ? args.address : mn::str_lit("127.0.0.1:7070"), args.jobs);
+	}
+	else if(args.command == "serve")
+	{
+		if(args.targets.count == 0)
+		{
+			mn::printerr("no input packages\n");
+			return -1;
+		}
+
+		for(const auto& target: args.targets)
+		{
+			if(mn::path_is_file(target) == false)
+			{
+				mn::printerr("'{}' is not a file \n", target);
+				return -1;
+			}
+		}
+
+		return serve(args.targets, args.address.count > 0 ? args.address : mn::str_lit("tas.sock"), args.jobs);
+	}
 	return 0;
 }
\ No newline at end of file
@@ -3,11 +3,54 @@
 #include <as/Src.h>
 #include <as/Scan.h>
 #include <as/Parse.h>
+#include <as/Gen.h>
+
+#include <tas/Dispatch.h>
+#include <tas/Map.h>
+#include <tas/Serve.h>
+#include <tas/Net.h>
+
+#include <vm/Pkg.h>
 
 #include <mn/Defer.h>
 #include <mn/IO.h>
 #include <mn/Path.h>
 
+#include <thread>
+#include <chrono>
+
+inline static vm::Pkg
+pkg_from_str(const char* code)
+{
+	auto src = as::src_from_str(code);
+	mn_defer(as::src_free(src));
+
+	if (as::scan(src) == false || as::parse(src) == false)
+	{
+		mn::printerr("{}", as::src_errs_dump(src, mn::memory::tmp()));
+		return vm::pkg_new();
+	}
+
+	return as::src_gen(src);
+}
+
+// waits for a worker thread to start listening on the address
+inline static bool
+wait_listening(const char* address)
+{
+	for (int i = 0; i < 500; ++i)
+	{
+		int fd = net_tcp_connect(address);
+		if (fd >= 0)
+		{
+			::close(fd);
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
 mn::Str
 file_content_normalized(const mn::Str& filename)
 {
@@ -87,4 +130,204 @@ TEST_CASE("parse tests")
 		}
 		CHECK(expected == answer);
 	}
+}
+
+TEST_CASE("dispatch over loopback workers")
+{
+	auto pkg = pkg_from_str("proc add\n\ti64.add r0 r1\n\thalt\nend\n");
+	mn_defer(vm::pkg_free(pkg));
+	vm::pkg_save(pkg, "tethys_dispatch_test.zyc");
+	mn_defer(::remove("tethys_dispatch_test.zyc"));
+
+	// the workers serve until the process exits
+	const char* addresses[] = {"127.0.0.1:17071", "127.0.0.1:17072"};
+	for (auto address: addresses)
+		std::thread([address]{ worker(mn::str_lit(address), 2); }).detach();
+	for (auto address: addresses)
+		REQUIRE(wait_listening(address));
+
+	// enough records for a few batches so both workers get some
+	constexpr size_t records_count = 40000;
+	auto input = mn::buf_with_count<uint64_t>(records_count * 2);
+	mn_defer(mn::buf_free(input));
+	for (size_t i = 0; i < records_count; ++i)
+	{
+		input[i * 2] = i;
+		input[i * 2 + 1] = i * 3;
+	}
+	auto output = mn::buf_with_count<uint64_t>(records_count);
+	mn_defer(mn::buf_free(output));
+
+	auto workers = mn::str_lit("127.0.0.1:17071,127.0.0.1:17072");
+	auto failed_count = dispatch(mn::str_lit("tethys_dispatch_test.zyc"), mn::str_lit("add"), workers, (const uint8_t*)input.ptr, (uint8_t*)output.ptr, 2 * sizeof(uint64_t), records_count);
+	CHECK(failed_count == 0);
+	size_t wrong = 0;
+	for (size_t i = 0; i < records_count; ++i)
+		if (output[i] != i * 4)
+			++wrong;
+	CHECK(wrong == 0);
+
+	// the workers refuse procs they don't have and the coordinator refuses names it can't send
+	CHECK(dispatch(mn::str_lit("tethys_dispatch_test.zyc"), mn::str_lit("missing"), workers, (const uint8_t*)input.ptr, (uint8_t*)output.ptr, 2 * sizeof(uint64_t), records_count) == -1);
+	auto long_name = mn::str_new();
+	mn_defer(mn::str_free(long_name));
+	for (int i = 0; i < 300; ++i)
+		mn::str_push(long_name, "a");
+	CHECK(dispatch(mn::str_lit("tethys_dispatch_test.zyc"), long_name, workers, (const uint8_t*)input.ptr, (uint8_t*)output.ptr, 2 * sizeof(uint64_t), records_count) == -1);
+
+	// a worker which hangs up after taking a batch has its batches sent to the others
+	int listener = net_tcp_listen("127.0.0.1:17073");
+	REQUIRE(listener >= 0);
+	std::thread flaky([listener]{
+		int fd = ::accept(listener, nullptr, nullptr);
+		::close(listener);
+		if (fd < 0)
+			return;
+
+		auto frame = mn::buf_new<uint8_t>();
+		mn_defer(mn::buf_free(frame));
+		if (net_read_frame(fd, frame, 1024 * 1024))
+		{
+			net_frame_begin(frame);
+			net_push(frame, DISPATCH_MSG_READY);
+			net_push(frame, DISPATCH_STATUS_OK);
+			net_push(frame, uint32_t(4));
+			net_frame_end(frame);
+			net_write_all(fd, frame.ptr, frame.count);
+			net_read_frame(fd, frame, 1024 * 1024);
+		}
+		::close(fd);
+	});
+	::memset(output.ptr, 0, output.count * sizeof(uint64_t));
+	auto flaky_workers = mn::str_lit("127.0.0.1:17073,127.0.0.1:17071");
+	failed_count = dispatch(mn::str_lit("tethys_dispatch_test.zyc"), mn::str_lit("add"), flaky_workers, (const uint8_t*)input.ptr, (uint8_t*)output.ptr, 2 * sizeof(uint64_t), records_count);
+	flaky.join();
+	CHECK(failed_count == 0);
+	wrong = 0;
+	for (size_t i = 0; i < records_count; ++i)
+		if (output[i] != i * 4)
+			++wrong;
+	CHECK(wrong == 0);
+}
+
+TEST_CASE("map records")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i64.load r3 0
+	i64.je r1 r3 stop
+	i64.add r0 r1
+	halt
+stop:
+	join r3
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+	auto proc = vm::proc_handle_get(pkg, "main");
+	REQUIRE(vm::proc_handle_valid(proc));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	// each record fills r0 and r1, the ones with a zero r1 join a fiber which isn't there and fail
+	uint64_t input[20] = {};
+	for (uint64_t i = 0; i < 10; ++i)
+	{
+		input[i * 2] = i;
+		input[i * 2 + 1] = i % 3;
+	}
+	uint64_t output[10] = {};
+	CHECK(map_records(proc, core, (const uint8_t*)input, (uint8_t*)output, 2 * sizeof(uint64_t), 10) == 4);
+	for (uint64_t i = 0; i < 10; ++i)
+		if (i % 3 != 0)
+			CHECK(output[i] == i + i % 3);
+
+	// a record smaller than a register leaves the rest of it zeroed, R0 is written even when the
+	// proc fails
+	uint8_t bytes[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+	uint64_t odd[3] = {};
+	CHECK(map_records(proc, core, bytes, (uint8_t*)odd, 4, 3) == 3);
+	CHECK(odd[0] == 0x04030201);
+	CHECK(odd[2] == 0x0c0b0a09);
+}
+
+TEST_CASE("serve request parsing")
+{
+	auto frame = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(frame));
+
+	auto request_frame = [&frame](uint64_t id, uint8_t args_count, const char* name) {
+		mn::buf_clear(frame);
+		net_push(frame, id);
+		net_push(frame, args_count);
+		for (uint8_t i = 0; i < args_count; ++i)
+			net_push(frame, uint64_t(i + 1));
+		net_push(frame, uint8_t(::strlen(name)));
+		mn::buf_resize(frame, frame.count + ::strlen(name));
+		::memcpy(frame.ptr + frame.count - ::strlen(name), name, ::strlen(name));
+	};
+
+	Serve_Request request{};
+	request_frame(7, 2, "main");
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.id == 7);
+	CHECK(request.status == SERVE_STATUS_OK);
+	CHECK(request.args_count == 2);
+	CHECK(request.args[1].u64 == 2);
+	CHECK(::strcmp(request.name, "main") == 0);
+
+	// the most args a proc can take and one more
+	request_frame(8, vm::Reg_IP, "main");
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.status == SERVE_STATUS_OK);
+	request_frame(9, vm::Reg_IP + 1, "main");
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.id == 9);
+	CHECK(request.status == SERVE_STATUS_BAD_REQUEST);
+
+	// the name runs past the end of the frame, and then there are bytes after it
+	request_frame(10, 1, "main");
+	mn::buf_pop(frame);
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.id == 10);
+	CHECK(request.status == SERVE_STATUS_BAD_REQUEST);
+	request_frame(11, 1, "main");
+	mn::buf_push(frame, uint8_t(0));
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.status == SERVE_STATUS_BAD_REQUEST);
+
+	// the args are cut off
+	request_frame(12, 3, "main");
+	mn::buf_resize(frame, sizeof(uint64_t) + 1 + sizeof(uint64_t));
+	CHECK(serve_request_parse(frame, request));
+	CHECK(request.status == SERVE_STATUS_BAD_REQUEST);
+
+	// there's no id to answer to
+	mn::buf_resize(frame, 4);
+	CHECK(serve_request_parse(frame, request) == false);
+}
+
+TEST_CASE("serve package reloads")
+{
+	auto pkg = pkg_from_str("proc add\n\ti64.add r0 r1\n\thalt\nend\n");
+	mn_defer(vm::pkg_free(pkg));
+	vm::pkg_save(pkg, "tethys_serve_test.zyc");
+	mn_defer(::remove("tethys_serve_test.zyc"));
+
+	vm::Pkg loaded{};
+	REQUIRE(serve_pkg_load(mn::str_lit("tethys_serve_test.zyc"), loaded));
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(loaded, "add")));
+	vm::pkg_free(loaded);
+
+	// a package cut off in the middle of being written is kept out like a missing one
+	auto file = mn::file_content_str("tethys_serve_test.zyc");
+	mn_defer(mn::str_free(file));
+	auto f = ::fopen("tethys_serve_test.zyc", "wb");
+	REQUIRE(f != nullptr);
+	::fwrite(file.ptr, 1, 64, f);
+	::fclose(f);
+	CHECK(serve_pkg_load(mn::str_lit("tethys_serve_test.zyc"), loaded) == false);
+
+	CHECK(serve_pkg_load(mn::str_lit("tethys_serve_missing.zyc"), loaded) == false);
 }
\ No newline at end of file
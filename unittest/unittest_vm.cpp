@@ -0,0 +1,1677 @@
+#include <doctest/doctest.h>
+
+#include <as/Src.h>
+#include <as/Scan.h>
+#include <as/Parse.h>
+#include <as/Gen.h>
+
+#include <vm/Core.h>
+#include <vm/Op.h>
+#include <vm/Pkg.h>
+#include <vm/Lz.h>
+#include <vm/Pkg_Registry.h>
+#include <vm/Verify.h>
+#include <vm/Scheduler.h>
+#include <vm/Chan.h>
+#include <vm/Host.h>
+#include <vm/Call.h>
+#include <vm/Snapshot.h>
+#include <vm/Core_Pool.h>
+
+#include <mn/Defer.h>
+#include <mn/IO.h>
+#include <mn/Path.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+inline static vm::Pkg
+pkg_from_str(const char* code)
+{
+	auto src = as::src_from_str(code);
+	mn_defer(as::src_free(src));
+
+	if (as::scan(src) == false || as::parse(src) == false)
+	{
+		mn::printerr("{}", as::src_errs_dump(src, mn::memory::tmp()));
+		return vm::pkg_new();
+	}
+
+	return as::src_gen(src);
+}
+
+const char* SUM_PROC = R"CODE(
+proc main
+	i32.load r2 1
+	i32.load r3 1
+	jmp cond
+loop:
+	i32.add r0 r3
+	i32.add r3 r2
+cond:
+	i32.jle r3 r1 loop
+	halt
+end
+)CODE";
+
+TEST_CASE("scheduler runs many jobs")
+{
+	auto pkg = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto scheduler = vm::scheduler_new(4);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	auto jobs = mn::buf_new<vm::Job>();
+	mn_defer(destruct(jobs));
+
+	for (int32_t i = 0; i < 1000; ++i)
+	{
+		auto core = vm::core_new();
+		core.r[vm::Reg_R1].i32 = i;
+		mn::buf_push(jobs, vm::scheduler_submit(scheduler, code, core));
+	}
+
+	for (int32_t i = 0; i < 1000; ++i)
+	{
+		const auto& core = vm::job_wait(jobs[i]);
+		CHECK(core.state == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R0].i32 == i * (i + 1) / 2);
+	}
+
+	// fire and forget
+	for (int32_t i = 0; i < 1000; ++i)
+		vm::job_free(vm::scheduler_submit(scheduler, code, vm::core_new()));
+	vm::scheduler_wait(scheduler);
+}
+
+TEST_CASE("instruction budget is charged per basic block")
+{
+	auto pkg = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto blocks = vm::blocks_build(code);
+	mn_defer(vm::blocks_free(blocks));
+
+	// count the instructions the slow way
+	auto reference = vm::core_new();
+	reference.r[vm::Reg_R1].i32 = 100;
+	uint64_t expected_count = 0;
+	while (reference.state == vm::Core::STATE_OK)
+	{
+		vm::core_ins_execute(reference, code);
+		++expected_count;
+	}
+
+	auto core = vm::core_new();
+	core.r[vm::Reg_R1].i32 = 100;
+	uint64_t count = 0;
+	size_t yields = 0;
+	while (true)
+	{
+		uint64_t budget = 7;
+		auto state = vm::core_run_for(core, code, blocks, budget);
+		count += 7 - budget;
+		if (state != vm::Core::STATE_YIELD)
+			break;
+		++yields;
+	}
+
+	CHECK(core.state == vm::Core::STATE_HALT);
+	CHECK(core.r[vm::Reg_R0].i32 == reference.r[vm::Reg_R0].i32);
+	CHECK(count == expected_count);
+	CHECK(yields > 0);
+
+	auto scheduler = vm::scheduler_new(2, 16);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	auto start = vm::core_new();
+	start.r[vm::Reg_R1].i32 = 100;
+	auto job = vm::scheduler_submit(scheduler, code, blocks, start);
+	mn_defer(vm::job_free(job));
+
+	CHECK(vm::job_wait(job).r[vm::Reg_R0].i32 == reference.r[vm::Reg_R0].i32);
+	CHECK(vm::job_ins_count(job) == expected_count);
+
+	// a core which stops in the middle of a block gets back what it didn't execute
+	uint8_t broken_bytes[] = {
+		3, 0, 1, 0, 0, 0,  // i32.load r0 1
+		3, 12, 1, 0, 0, 0, // i32.load r12 1
+		3, 1, 1, 0, 0, 0,  // i32.load r1 1
+		44,                // halt
+	};
+	auto broken = mn::buf_with_count<uint8_t>(sizeof(broken_bytes));
+	mn_defer(mn::buf_free(broken));
+	::memcpy(broken.ptr, broken_bytes, sizeof(broken_bytes));
+	auto broken_blocks = vm::blocks_build(broken);
+	mn_defer(vm::blocks_free(broken_blocks));
+	CHECK(broken_blocks.len[0] == 4);
+	CHECK(broken_blocks.last[0] == 18);
+
+	auto stopped = vm::core_new();
+	mn_defer(vm::core_free(stopped));
+	uint64_t budget = 10;
+	CHECK(vm::core_run_for(stopped, broken, broken_blocks, budget) == vm::Core::STATE_ERR);
+	CHECK(budget == 8);
+}
+
+TEST_CASE("fibers")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i32.load r1 10
+	spawn r4 worker
+	i32.load r1 20
+	spawn r5 worker
+	join r4
+	join r5
+	i32.load r0 0
+	i32.add r0 r4
+	i32.add r0 r5
+	halt
+worker:
+	i32.load r0 0
+	i32.load r2 1
+	i32.load r3 1
+	jmp cond
+loop:
+	i32.add r0 r3
+	i32.add r3 r2
+	yield
+cond:
+	i32.jle r3 r1 loop
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	CHECK(vm::core_run(core, code) == vm::Core::STATE_HALT);
+	CHECK(core.r[vm::Reg_R0].i32 == 55 + 210);
+	CHECK(core.fibers.count == 3);
+
+	// fibers should work the same under a budget
+	auto blocks = vm::blocks_build(code);
+	mn_defer(vm::blocks_free(blocks));
+
+	auto metered = vm::core_new();
+	mn_defer(vm::core_free(metered));
+	while (true)
+	{
+		uint64_t budget = 5;
+		if (vm::core_run_for(metered, code, blocks, budget) != vm::Core::STATE_YIELD)
+			break;
+	}
+	CHECK(metered.state == vm::Core::STATE_HALT);
+	CHECK(metered.r[vm::Reg_R0].i32 == 55 + 210);
+}
+
+TEST_CASE("channels between cores")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc producer
+	i32.load r1 1
+	i32.load r2 1
+	jmp cond
+loop:
+	send 0 r1
+	i32.add r1 r2
+cond:
+	i32.jle r1 r3 loop
+	halt
+end
+
+proc consumer
+	i32.load r1 0
+	i32.load r2 1
+	jmp cond
+loop:
+	recv 0 r4
+	i32.add r0 r4
+	i32.add r1 r2
+cond:
+	i32.jl r1 r3 loop
+	try_recv 0 r4 r5
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto producer = vm::pkg_load_proc(pkg, "producer");
+	mn_defer(mn::buf_free(producer));
+
+	auto consumer = vm::pkg_load_proc(pkg, "consumer");
+	mn_defer(mn::buf_free(consumer));
+
+	for (auto kind: {vm::CHAN_KIND_SPSC, vm::CHAN_KIND_MPMC})
+	{
+		auto chan = vm::chan_new(4, kind);
+		mn_defer(vm::chan_free(chan));
+
+		auto scheduler = vm::scheduler_new(2);
+		mn_defer(vm::scheduler_free(scheduler));
+
+		auto producer_core = vm::core_new();
+		producer_core.r[vm::Reg_R3].i32 = 1000;
+		vm::core_chan_attach(producer_core, chan);
+
+		auto consumer_core = vm::core_new();
+		consumer_core.r[vm::Reg_R3].i32 = 1000;
+		consumer_core.r[vm::Reg_R5].u64 = 42;
+		vm::core_chan_attach(consumer_core, chan);
+
+		auto consumer_job = vm::scheduler_submit(scheduler, consumer, consumer_core);
+		mn_defer(vm::job_free(consumer_job));
+		vm::job_free(vm::scheduler_submit(scheduler, producer, producer_core));
+
+		const auto& res = vm::job_wait(consumer_job);
+		CHECK(res.state == vm::Core::STATE_HALT);
+		CHECK(res.r[vm::Reg_R0].i32 == 1000 * 1001 / 2);
+		CHECK(res.r[vm::Reg_R5].u64 == 0);
+	}
+
+	// a lone consumer parks on the empty channel
+	auto chan = vm::chan_new(4);
+	mn_defer(vm::chan_free(chan));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	core.r[vm::Reg_R3].i32 = 2;
+	vm::core_chan_attach(core, chan);
+
+	CHECK(vm::core_run(core, consumer) == vm::Core::STATE_BLOCK);
+	CHECK(vm::chan_try_send(chan, 5));
+	CHECK(vm::core_run(core, consumer) == vm::Core::STATE_BLOCK);
+	CHECK(vm::chan_try_send(chan, 6));
+	CHECK(vm::core_run(core, consumer) == vm::Core::STATE_HALT);
+	CHECK(core.r[vm::Reg_R0].i32 == 11);
+
+	// a job blocked on the channel is parked there instead of being retried until the host sends,
+	// each retry would be charged for the receive
+	auto blocks = vm::blocks_build(consumer);
+	mn_defer(vm::blocks_free(blocks));
+	auto scheduler = vm::scheduler_new(2);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	auto parked_core = vm::core_new();
+	parked_core.r[vm::Reg_R3].i32 = 2;
+	vm::core_chan_attach(parked_core, chan);
+	auto parked = vm::scheduler_submit(scheduler, consumer, blocks, parked_core);
+	mn_defer(vm::job_free(parked));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK(vm::job_done(parked) == false);
+	CHECK(vm::chan_try_send(chan, 7));
+	CHECK(vm::chan_try_send(chan, 8));
+	CHECK(vm::job_wait(parked).r[vm::Reg_R0].i32 == 15);
+	CHECK(vm::job_ins_count(parked) < 100);
+}
+
+TEST_CASE("atomics over shared memory")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i32.load r2 1
+	i32.load r3 0
+	jmp cond
+loop:
+	u64.load r4 0
+	u64.load r7 1
+	u64.fetch_add r4 r7
+	u64.load r4 8
+	u32.load r5 0
+	u32.load r6 1
+	u32.cas r4 r5 r6
+	u64.load r4 16
+	u8.load r5 1
+	u8.fetch_or r4 r5
+	i32.add r3 r2
+cond:
+	i32.jl r3 r1 loop
+	fence
+	halt
+end
+
+proc misaligned
+	u64.load r4 3
+	u64.xchg r4 r5
+	halt
+end
+
+proc out_of_bounds
+	u64.load r4 24
+	u64.xchg r4 r5
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	alignas(8) uint64_t mem[3] = {};
+
+	auto scheduler = vm::scheduler_new(4);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	auto jobs = mn::buf_new<vm::Job>();
+	mn_defer(destruct(jobs));
+	for (int i = 0; i < 8; ++i)
+	{
+		auto core = vm::core_new();
+		core.r[vm::Reg_R1].i32 = 1000;
+		vm::core_mem_attach(core, mem, sizeof(mem));
+		mn::buf_push(jobs, vm::scheduler_submit(scheduler, code, core));
+	}
+
+	for (auto job: jobs)
+		CHECK(vm::job_wait(job).state == vm::Core::STATE_HALT);
+	CHECK(mem[0] == 8 * 1000);
+	CHECK(mem[1] == 1);
+	CHECK(mem[2] == 1);
+
+	for (auto name: {"misaligned", "out_of_bounds"})
+	{
+		auto bad = vm::pkg_load_proc(pkg, name);
+		mn_defer(mn::buf_free(bad));
+
+		auto core = vm::core_new();
+		mn_defer(vm::core_free(core));
+		vm::core_mem_attach(core, mem, sizeof(mem));
+		CHECK(vm::core_run(core, bad) == vm::Core::STATE_ERR);
+	}
+}
+
+struct Host_Requests
+{
+	std::mutex mtx;
+	mn::Buf<vm::Job> jobs;
+	mn::Buf<int32_t> args;
+};
+
+inline static vm::HOST_CALL
+test_host_call(vm::Core& core, uint32_t id, void* user)
+{
+	// 0 doubles R1 right away, 1 doubles it later
+	if (id == 0)
+	{
+		core.r[vm::Reg_R0].i32 = core.r[vm::Reg_R1].i32 * 2;
+		return vm::HOST_CALL_DONE;
+	}
+
+	auto requests = (Host_Requests*)user;
+	std::lock_guard<std::mutex> lock(requests->mtx);
+	mn::buf_push(requests->jobs, vm::job_current());
+	mn::buf_push(requests->args, core.r[vm::Reg_R1].i32);
+	return vm::HOST_CALL_PENDING;
+}
+
+TEST_CASE("suspendable host calls")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	hcall 1
+	i32.add r1 r0
+	hcall 1
+	halt
+end
+
+proc sync
+	hcall 0
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto sync = vm::pkg_load_proc(pkg, "sync");
+	mn_defer(mn::buf_free(sync));
+
+	Host_Requests requests{};
+	mn_defer(mn::buf_free(requests.jobs));
+	mn_defer(mn::buf_free(requests.args));
+
+	// a single core
+	{
+		auto core = vm::core_new();
+		mn_defer(vm::core_free(core));
+		core.r[vm::Reg_R1].i32 = 5;
+		vm::core_host_call_set(core, test_host_call, &requests);
+
+		CHECK(vm::core_run(core, sync) == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R0].i32 == 10);
+
+		core = vm::core_new();
+		core.r[vm::Reg_R1].i32 = 5;
+		vm::core_host_call_set(core, test_host_call, &requests);
+		CHECK(vm::core_run(core, code) == vm::Core::STATE_PENDING);
+		CHECK(vm::core_run(core, code) == vm::Core::STATE_PENDING);
+
+		vm::Reg_Val res{};
+		res.i32 = 10;
+		vm::core_resume(core, res);
+		CHECK(vm::core_run(core, code) == vm::Core::STATE_PENDING);
+		res.i32 = 30;
+		vm::core_resume(core, res);
+		CHECK(vm::core_run(core, code) == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R0].i32 == 30);
+		mn::buf_clear(requests.jobs);
+		mn::buf_clear(requests.args);
+	}
+
+	// many jobs in flight on the scheduler, served by a single host thread
+	auto scheduler = vm::scheduler_new(2);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	constexpr int32_t JOBS_COUNT = 500;
+	std::atomic<bool> serving{true};
+	std::thread host([&]{
+		auto jobs = mn::buf_new<vm::Job>();
+		auto args = mn::buf_new<int32_t>();
+		while (serving.load())
+		{
+			{
+				std::lock_guard<std::mutex> lock(requests.mtx);
+				std::swap(jobs, requests.jobs);
+				std::swap(args, requests.args);
+			}
+			for (size_t i = 0; i < jobs.count; ++i)
+			{
+				vm::Reg_Val res{};
+				res.i32 = args[i] * 2;
+				vm::job_resume(jobs[i], res);
+			}
+			mn::buf_clear(jobs);
+			mn::buf_clear(args);
+			std::this_thread::yield();
+		}
+		mn::buf_free(jobs);
+		mn::buf_free(args);
+	});
+
+	auto jobs = mn::buf_new<vm::Job>();
+	mn_defer(destruct(jobs));
+	for (int32_t i = 0; i < JOBS_COUNT; ++i)
+	{
+		auto core = vm::core_new();
+		core.r[vm::Reg_R1].i32 = i;
+		vm::core_host_call_set(core, test_host_call, &requests);
+		mn::buf_push(jobs, vm::scheduler_submit(scheduler, code, core));
+	}
+
+	for (int32_t i = 0; i < JOBS_COUNT; ++i)
+	{
+		const auto& core = vm::job_wait(jobs[i]);
+		CHECK(core.state == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R0].i32 == i * 6);
+	}
+
+	serving.store(false);
+	host.join();
+}
+
+const char* IO_PROC = R"CODE(
+proc main
+	u64.load r4 1
+	io.open r1 r4
+	u64.load r5 0
+	u64.add r5 r0
+	io.write r5 r2 r3
+	io.close r5
+	u64.load r4 0
+	io.open r1 r4
+	u64.load r5 0
+	u64.add r5 r0
+	io.read r5 r6 r3
+	u64.load r7 0
+	u64.add r7 r0
+	io.close r5
+	halt
+end
+)CODE";
+
+// the core's memory has the file path at 0, the data at 64, and it's read back at 128
+inline static vm::Core
+io_core_new(uint8_t* mem, size_t mem_size, const char* path, const char* data)
+{
+	::memset(mem, 0, mem_size);
+	::snprintf((char*)mem, 64, "%s", path);
+	::snprintf((char*)mem + 64, 64, "%s", data);
+
+	auto core = vm::core_new();
+	vm::core_mem_attach(core, mem, mem_size);
+	core.r[vm::Reg_R1].u64 = 0;
+	core.r[vm::Reg_R2].u64 = 64;
+	core.r[vm::Reg_R3].u64 = ::strlen(data);
+	core.r[vm::Reg_R6].u64 = 128;
+	return core;
+}
+
+TEST_CASE("batched file io")
+{
+	auto pkg = pkg_from_str(IO_PROC);
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	const char* data = "hello from the vm";
+
+	for (auto backend: {vm::IO_BACKEND_URING, vm::IO_BACKEND_THREADS})
+	{
+		auto io = vm::io_new(64, backend);
+		// the kernel may not have io_uring
+		if (io == nullptr)
+			continue;
+		mn_defer(vm::io_free(io));
+
+		alignas(8) uint8_t mem[192];
+		auto core = io_core_new(mem, sizeof(mem), "tethys_io_test.bin", data);
+		mn_defer(vm::core_free(core));
+
+		while (vm::core_run(core, code) == vm::Core::STATE_PENDING)
+		{
+			vm::core_io_submit(core, io);
+			vm::io_flush(io);
+			CHECK(vm::io_reap(io, true) == 1);
+		}
+		CHECK(core.state == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R7].u64 == ::strlen(data));
+		CHECK(::memcmp(mem + 64, mem + 128, ::strlen(data)) == 0);
+		::remove("tethys_io_test.bin");
+	}
+
+	// a ring smaller than the requests in flight doesn't lose any of them
+	if (auto io = vm::io_new(1, vm::IO_BACKEND_URING))
+	{
+		mn_defer(vm::io_free(io));
+		size_t done = 0;
+		for (size_t i = 0; i < 256; ++i)
+			vm::io_submit(io, vm::Io_Req{}, [](void* user, int64_t result) {
+				CHECK(result == -EINVAL);
+				++*(size_t*)user;
+			}, &done);
+		vm::io_flush(io);
+		while (vm::io_inflight(io) > 0)
+			vm::io_reap(io, true);
+		CHECK(done == 256);
+	}
+
+	// the scheduler's workers batch the requests of their jobs
+	constexpr size_t JOBS_COUNT = 64;
+	alignas(8) static uint8_t mems[JOBS_COUNT][192];
+
+	auto scheduler = vm::scheduler_new(4);
+	mn_defer(vm::scheduler_free(scheduler));
+
+	auto jobs = mn::buf_new<vm::Job>();
+	mn_defer(destruct(jobs));
+	for (size_t i = 0; i < JOBS_COUNT; ++i)
+	{
+		char path[64];
+		::snprintf(path, sizeof(path), "tethys_io_test_%zu.bin", i);
+		char job_data[64];
+		::snprintf(job_data, sizeof(job_data), "job %zu data", i);
+		mn::buf_push(jobs, vm::scheduler_submit(scheduler, code, io_core_new(mems[i], sizeof(mems[i]), path, job_data)));
+	}
+
+	for (size_t i = 0; i < JOBS_COUNT; ++i)
+	{
+		const auto& core = vm::job_wait(jobs[i]);
+		CHECK(core.state == vm::Core::STATE_HALT);
+		CHECK(core.r[vm::Reg_R7].u64 == core.r[vm::Reg_R3].u64);
+		CHECK(::memcmp(mems[i] + 64, mems[i] + 128, core.r[vm::Reg_R3].u64) == 0);
+		::remove((const char*)mems[i]);
+	}
+}
+
+inline static void
+native_add3(vm::Core& core)
+{
+	core.r[vm::Reg_R0].i64 = core.r[vm::Reg_R0].i64 + core.r[vm::Reg_R1].i64 + core.r[vm::Reg_R2].i64;
+}
+
+inline static void
+native_twice(vm::Core& core)
+{
+	core.r[vm::Reg_R0].i64 *= 2;
+}
+
+TEST_CASE("native host functions")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i64.load r0 1
+	i64.load r1 2
+	i64.load r2 3
+	ncall add3
+	ncall twice
+	ncall add3
+	halt
+end
+
+proc missing
+	ncall not_registered
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	REQUIRE(pkg.imports.count == 3);
+	CHECK(pkg.imports[0] == "add3");
+	CHECK(pkg.imports[1] == "twice");
+
+	auto registry = vm::host_registry_new();
+	mn_defer(vm::host_registry_free(registry));
+	CHECK(vm::host_registry_add(registry, "add3", native_add3));
+	CHECK(vm::host_registry_add(registry, "twice", native_twice));
+	CHECK(vm::host_registry_add(registry, "twice", native_add3) == false);
+
+	// imports survive a save and load
+	vm::pkg_save(pkg, "tethys_natives_test.zyc");
+	auto loaded = vm::pkg_load("tethys_natives_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_natives_test.zyc");
+	REQUIRE(loaded.imports.count == 3);
+	CHECK(loaded.imports[1] == "twice");
+
+	auto table = vm::host_registry_bind(registry, loaded);
+	mn_defer(mn::buf_free(table));
+	CHECK(table[2] == nullptr);
+
+	auto code = vm::pkg_load_proc(loaded, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	vm::core_natives_attach(core, table);
+	CHECK(vm::core_run(core, code) == vm::Core::STATE_HALT);
+	CHECK(core.r[vm::Reg_R0].i64 == 17);
+
+	auto missing = vm::pkg_load_proc(loaded, "missing");
+	mn_defer(mn::buf_free(missing));
+
+	auto bad = vm::core_new();
+	mn_defer(vm::core_free(bad));
+	vm::core_natives_attach(bad, table);
+	CHECK(vm::core_run(bad, missing) == vm::Core::STATE_ERR);
+}
+
+TEST_CASE("calling procs from the host")
+{
+	auto pkg = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(pkg));
+
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(pkg, "not_there")) == false);
+
+	auto sum = vm::proc_handle_get(pkg, "main");
+	REQUIRE(vm::proc_handle_valid(sum));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	for (int32_t i = 0; i < 10000; ++i)
+	{
+		auto res = vm::call(sum, core, 0, i);
+		CHECK(core.state == vm::Core::STATE_HALT);
+		CHECK(res.i32 == i * (i + 1) / 2);
+	}
+}
+
+TEST_CASE("core snapshot and restore")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i32.load r1 10
+	spawn r4 worker
+	i32.load r1 20
+	spawn r5 worker
+	join r4
+	join r5
+	i32.load r0 0
+	i32.add r0 r4
+	i32.add r0 r5
+	u64.load r6 0
+	u64.fetch_add r6 r0
+	halt
+worker:
+	i32.load r0 0
+	i32.load r2 1
+	i32.load r3 1
+	jmp cond
+loop:
+	i32.add r0 r3
+	i32.add r3 r2
+	yield
+cond:
+	i32.jle r3 r1 loop
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto code = vm::pkg_load_proc(pkg, "main");
+	mn_defer(mn::buf_free(code));
+
+	auto blocks = vm::blocks_build(code);
+	mn_defer(vm::blocks_free(blocks));
+
+	// run the core part of the way, snapshot it, and finish it on another thread
+	alignas(8) uint64_t mem[2] = {100, 0};
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	vm::core_mem_attach(core, mem, sizeof(mem));
+
+	uint64_t budget = 40;
+	CHECK(vm::core_run_for(core, code, blocks, budget) == vm::Core::STATE_YIELD);
+
+	auto snapshot = vm::core_snapshot(core);
+	mn_defer(mn::buf_free(snapshot));
+
+	alignas(8) uint64_t migrated_mem[2] = {};
+	auto migrated = vm::core_new();
+	mn_defer(vm::core_free(migrated));
+	vm::core_mem_attach(migrated, migrated_mem, sizeof(migrated_mem));
+
+	std::thread other([&]{
+		REQUIRE(vm::core_restore(migrated, snapshot));
+		vm::core_run(migrated, code);
+	});
+	other.join();
+	vm::core_run(core, code);
+
+	CHECK(migrated.state == vm::Core::STATE_HALT);
+	CHECK(migrated.r[vm::Reg_R0].i32 == core.r[vm::Reg_R0].i32);
+	CHECK(migrated_mem[0] == mem[0]);
+	CHECK(mem[0] == 100 + 55 + 210);
+
+	// the out buffer is reused, and bad snapshots are rejected
+	CHECK(vm::core_snapshot(core, snapshot));
+	auto small = vm::core_new();
+	mn_defer(vm::core_free(small));
+	CHECK(vm::core_restore(small, snapshot) == false);
+
+	snapshot[4] = uint8_t(vm::SNAPSHOT_VERSION + 1);
+	CHECK(vm::core_restore(migrated, snapshot) == false);
+
+	// snapshots from other processes can't be trusted, the counts which would overflow the size
+	// and the values out of their enums are rejected
+	auto patched = [&](size_t offset, uint64_t value, size_t size) {
+		vm::core_snapshot(core, snapshot);
+		::memcpy(snapshot.ptr + offset, &value, size);
+		return vm::core_restore(migrated, snapshot);
+	};
+	CHECK(patched(0, vm::SNAPSHOT_MAGIC, 4));
+	CHECK(patched(32, (UINT64_MAX / sizeof(vm::Core::Fiber)) + 2, 8) == false);
+	CHECK(patched(32, 1ull << 60, 8) == false);
+	CHECK(patched(16, vm::Core::STATE_PENDING, 4) == false);
+	CHECK(patched(16, 1000, 4) == false);
+	CHECK(patched(20, vm::Core::CMP_GREATER + 1, 4) == false);
+	CHECK(patched(40, UINT64_MAX, 8) == false);
+	REQUIRE(core.fibers.count > 0);
+	CHECK(patched(48 + sizeof(core.r), UINT32_MAX, 4) == false);
+
+	// a joining fiber can't point past the fibers
+	vm::core_snapshot(core, snapshot);
+	uint32_t join_state = vm::Core::Fiber::STATE_JOIN;
+	uint64_t join = core.fibers.count;
+	::memcpy(snapshot.ptr + 48 + sizeof(core.r), &join_state, sizeof(join_state));
+	::memcpy(snapshot.ptr + 48 + sizeof(core.r) + offsetof(vm::Core::Fiber, join), &join, sizeof(join));
+	CHECK(vm::core_restore(migrated, snapshot) == false);
+	join = core.fibers.count - 1;
+	::memcpy(snapshot.ptr + 48 + sizeof(core.r) + offsetof(vm::Core::Fiber, join), &join, sizeof(join));
+	CHECK(vm::core_restore(migrated, snapshot));
+
+	// a restored IP in the middle of an instruction makes the verified runs use the checks
+	core.state = vm::Core::STATE_YIELD;
+	mn::buf_clear(core.fibers);
+	core.r[vm::Reg_IP].u64 = code.count - 2;
+	REQUIRE(vm::blocks_is_start(blocks, code.count - 2) == false);
+	REQUIRE(vm::core_snapshot(core, snapshot));
+	REQUIRE(vm::core_restore(migrated, snapshot));
+	budget = 100;
+	CHECK(vm::core_run_for_verified(migrated, code, blocks, budget) == vm::Core::STATE_ERR);
+	REQUIRE(vm::core_restore(migrated, snapshot));
+	CHECK(vm::core_run_verified(migrated, code) == vm::Core::STATE_ERR);
+}
+
+TEST_CASE("copy on write core forks")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc init
+	u64.load r1 4096
+	u64.load r2 7
+	u64.xchg r1 r2
+	halt
+end
+
+proc work
+	u64.load r1 4096
+	u64.fetch_add r1 r3
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto init = vm::proc_handle_get(pkg, "init");
+	auto work = vm::proc_handle_get(pkg, "work");
+
+	auto mem = vm::mem_new(1024 * 1024);
+	mn_defer(vm::mem_free(mem));
+
+	auto parent = vm::core_new();
+	mn_defer(vm::core_free(parent));
+	vm::core_mem_attach(parent, mem);
+	vm::call(init, parent);
+
+	auto forks = mn::buf_new<vm::Core>();
+	mn_defer(destruct(forks));
+	for (uint64_t i = 0; i < 4; ++i)
+		mn::buf_push(forks, vm::core_fork(parent));
+
+	for (uint64_t i = 0; i < forks.count; ++i)
+	{
+		auto& fork = forks[i];
+		CHECK(fork.mem != parent.mem);
+		CHECK(((uint64_t*)fork.mem)[512] == 7);
+		vm::call(work, fork, 0, 0, 0, i + 1);
+		CHECK(fork.state == vm::Core::STATE_HALT);
+	}
+
+	// every fork only sees its own writes
+	CHECK(((uint64_t*)parent.mem)[512] == 7);
+	for (uint64_t i = 0; i < forks.count; ++i)
+		CHECK(((uint64_t*)forks[i].mem)[512] == 7 + i + 1);
+
+	// an unchanged parent isn't copied again however many times it's forked, while reading it
+	// or forking its forks which didn't write
+	CHECK(((uint64_t*)parent.mem)[1024] == 0);
+	for (uint64_t i = 0; i < 64; ++i)
+	{
+		auto fork = vm::core_fork(parent);
+		mn_defer(vm::core_free(fork));
+		CHECK(vm::mem_image_shared(fork.mem_region, forks[0].mem_region));
+
+		auto nested = vm::core_fork(fork);
+		mn_defer(vm::core_free(nested));
+		CHECK(vm::mem_image_shared(nested.mem_region, forks[0].mem_region));
+	}
+
+	// the next fork of a written one starts from a new image with the write
+	auto written = vm::core_fork(forks[0]);
+	mn_defer(vm::core_free(written));
+	CHECK(vm::mem_image_shared(written.mem_region, parent.mem_region) == false);
+	CHECK(((uint64_t*)written.mem)[512] == 8);
+}
+
+TEST_CASE("forks see the current memory")
+{
+	auto mem = vm::mem_new(64 * 1024);
+	mn_defer(vm::mem_free(mem));
+	auto ptr = (uint64_t*)vm::mem_ptr(mem);
+
+	// writes between forks show up in the later forks
+	ptr[0] = 1;
+	auto first = vm::mem_fork(mem);
+	mn_defer(vm::mem_free(first));
+	ptr[0] = 2;
+	ptr[4096] = 3;
+	auto second = vm::mem_fork(mem);
+	mn_defer(vm::mem_free(second));
+	CHECK(((uint64_t*)vm::mem_ptr(first))[0] == 1);
+	CHECK(((uint64_t*)vm::mem_ptr(first))[4096] == 0);
+	CHECK(((uint64_t*)vm::mem_ptr(second))[0] == 2);
+	CHECK(((uint64_t*)vm::mem_ptr(second))[4096] == 3);
+
+	// a fork of a fork starts from the fork's content
+	((uint64_t*)vm::mem_ptr(first))[0] = 9;
+	auto nested = vm::mem_fork(first);
+	mn_defer(vm::mem_free(nested));
+	CHECK(((uint64_t*)vm::mem_ptr(nested))[0] == 9);
+
+	// and they all stay apart
+	((uint64_t*)vm::mem_ptr(nested))[0] = 10;
+	ptr[0] = 11;
+	CHECK(((uint64_t*)vm::mem_ptr(first))[0] == 9);
+	CHECK(((uint64_t*)vm::mem_ptr(second))[0] == 2);
+	CHECK(((uint64_t*)vm::mem_ptr(nested))[0] == 10);
+}
+
+TEST_CASE("core pool")
+{
+	auto pkg = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(pkg));
+	auto sum = vm::proc_handle_get(pkg, "main");
+
+	auto pool = vm::core_pool_new(8);
+	mn_defer(vm::core_pool_free(pool));
+
+	// cores are spread over threads, each one gets its cores from its own node
+	std::thread threads[4];
+	for (auto& thread: threads)
+	{
+		thread = std::thread([&]{
+			vm::Core* cores[20];
+			for (int round = 0; round < 10; ++round)
+			{
+				for (int32_t i = 0; i < 20; ++i)
+				{
+					cores[i] = vm::core_pool_get(pool);
+					CHECK(uintptr_t(cores[i]) % 64 == 0);
+					CHECK(vm::call(sum, *cores[i], 0, i).i32 == i * (i + 1) / 2);
+				}
+				for (auto core: cores)
+					vm::core_pool_put(pool, core);
+			}
+		});
+	}
+	for (auto& thread: threads)
+		thread.join();
+
+	// a recycled core starts fresh
+	auto a = vm::core_pool_get(pool);
+	a->r[vm::Reg_R3].u64 = 42;
+	vm::core_pool_put(pool, a);
+	auto b = vm::core_pool_get(pool);
+	CHECK(b->r[vm::Reg_R3].u64 == 0);
+	vm::core_pool_put(pool, b);
+}
+
+TEST_CASE("mapped packages")
+{
+	auto pkg = pkg_from_str(R"CODE(
+proc main
+	i64.load r0 40
+	i64.add r0 r1
+	halt
+end
+
+proc twice
+	i64.add r0 r0
+	halt
+end
+)CODE");
+	mn_defer(vm::pkg_free(pkg));
+	vm::pkg_import(pkg, "unused");
+
+	vm::pkg_save(pkg, "tethys_mapped_test.zyc");
+	auto loaded = vm::pkg_load("tethys_mapped_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_mapped_test.zyc");
+	REQUIRE(vm::file_map_valid(loaded.file));
+	REQUIRE(loaded.imports.count == 1);
+	CHECK(loaded.imports[0] == "unused");
+
+	// the bytecode is executed right from the page aligned bodies of the mapped file
+	for (auto name: {"main", "twice"})
+	{
+		auto handle = vm::proc_handle_get(loaded, name);
+		REQUIRE(vm::proc_handle_valid(handle));
+		CHECK(handle.code.ptr >= loaded.file.ptr);
+		CHECK(size_t(handle.code.ptr - loaded.file.ptr) % vm::PKG_PAGE_SIZE == 0);
+
+		auto original = vm::proc_handle_get(pkg, name);
+		REQUIRE(handle.code.count == original.code.count);
+		CHECK(::memcmp(handle.code.ptr, original.code.ptr, original.code.count) == 0);
+	}
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(vm::proc_handle_get(loaded, "main"), core, 0, 2).i64 == 42);
+	CHECK(vm::call(vm::proc_handle_get(loaded, "twice"), core, 21).i64 == 42);
+
+	// packages saved before the header existed still load, and their encoding 1 bytecode which
+	// has a byte per register and 64-bit jump offsets is upgraded, this is SUM_PROC
+	uint8_t v1_code[] = {
+		3, 2, 1, 0, 0, 0,                   // i32.load r2 1
+		3, 3, 1, 0, 0, 0,                   // i32.load r3 1
+		37, 6, 0, 0, 0, 0, 0, 0, 0,         // jmp cond
+		7, 0, 3,                            // loop: i32.add r0 r3
+		7, 3, 2,                            // i32.add r3 r2
+		35, 3, 1,                           // cond: icmp32 r3 r1
+		41, 238, 255, 255, 255, 255, 255, 255, 255, // jle loop
+		44,                                 // halt
+	};
+	auto f = ::fopen("tethys_legacy_test.zyc", "wb");
+	REQUIRE(f != nullptr);
+	uint32_t procs_count = 1, name_size = 4, code_size = sizeof(v1_code), imports_count = 0;
+	::fwrite(&procs_count, sizeof(procs_count), 1, f);
+	::fwrite(&name_size, sizeof(name_size), 1, f);
+	::fwrite("main", 1, 4, f);
+	::fwrite(&code_size, sizeof(code_size), 1, f);
+	::fwrite(v1_code, 1, code_size, f);
+	::fwrite(&imports_count, sizeof(imports_count), 1, f);
+	::fclose(f);
+
+	auto legacy = vm::pkg_load("tethys_legacy_test.zyc");
+	mn_defer(vm::pkg_free(legacy));
+	::remove("tethys_legacy_test.zyc");
+	CHECK(vm::file_map_valid(legacy.file) == false);
+	CHECK(vm::call(vm::proc_handle_get(legacy, "main"), core, 0, 10).i32 == 55);
+}
+
+TEST_CASE("package directory")
+{
+	auto sum = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(sum));
+	auto sum_code = vm::proc_handle_get(sum, "main").code;
+
+	auto pkg = vm::pkg_new();
+	mn_defer(vm::pkg_free(pkg));
+	for (int i = 0; i < 200; ++i)
+		CHECK(vm::pkg_proc_add(pkg, mn::strf("proc_{}", i), mn::buf_clone(sum_code)));
+
+	vm::pkg_save(pkg, "tethys_directory_test.zyc");
+	auto loaded = vm::pkg_load("tethys_directory_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_directory_test.zyc");
+
+	// nothing is read from the file until the procs are looked up
+	CHECK(loaded.procs.count == 0);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	for (int i = 0; i < 200; ++i)
+	{
+		auto name = mn::strf("proc_{}", i);
+		mn_defer(mn::str_free(name));
+		auto handle = vm::proc_handle_get(loaded, name);
+		REQUIRE(vm::proc_handle_valid(handle));
+		CHECK(vm::call(handle, core, 0, 10).i32 == 55);
+	}
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(loaded, "proc_200")) == false);
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(loaded, "")) == false);
+
+	// names in the file are taken, new ones go next to them and both survive a save
+	CHECK(vm::pkg_proc_add(loaded, mn::str_lit("proc_7"), mn::buf_new<uint8_t>()) == false);
+	CHECK(vm::pkg_proc_add(loaded, mn::str_from_c("extra"), mn::buf_clone(sum_code)));
+	vm::pkg_save(loaded, "tethys_directory_test.zyc");
+	auto resaved = vm::pkg_load("tethys_directory_test.zyc");
+	mn_defer(vm::pkg_free(resaved));
+	::remove("tethys_directory_test.zyc");
+	CHECK(vm::call(vm::proc_handle_get(resaved, "extra"), core, 0, 4).i32 == 10);
+	CHECK(vm::call(vm::proc_handle_get(resaved, "proc_199"), core, 0, 4).i32 == 10);
+}
+
+
+TEST_CASE("compact bytecode encoding")
+{
+	auto sum = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(sum));
+
+	// register pairs take a byte and the loop's jumps take 1 byte offsets
+	auto code = vm::proc_handle_get(sum, "main").code;
+	CHECK(code.count == 23);
+	CHECK(code[12] == vm::Op_JMP8);
+	CHECK(code[20] == vm::Op_JLE8);
+
+	// jumps which don't reach with a 1 byte offset grow to 2 or 4 bytes
+	auto src = mn::str_from_c("proc main\n\ti64.load r1 1\n\tjmp far\nnear:\n\ti64.add r0 r1\n\ti64.add r0 r1\n");
+	mn_defer(mn::str_free(src));
+	for (int i = 0; i < 100; ++i)
+		mn::str_push(src, "\ti64.add r0 r1\n");
+	mn::str_push(src, "\ti64.jl r0 r2 near\n\thalt\nfar:\n");
+	for (int i = 0; i < 20000; ++i)
+		mn::str_push(src, "\ti64.sub r0 r1\n");
+	mn::str_push(src, "\ti64.load r2 204\n\tjmp near\nend\n");
+
+	auto pkg = pkg_from_str(src.ptr);
+	mn_defer(vm::pkg_free(pkg));
+	auto far = vm::proc_handle_get(pkg, "main");
+	REQUIRE(vm::proc_handle_valid(far));
+	CHECK(far.code.count == 10 + 3 + 2 * 102 + 2 + 3 + 1 + 2 * 20000 + 10 + 5);
+	CHECK(far.code[10] == vm::Op_JMP16);
+	CHECK(far.code[10 + 3 + 2 * 102 + 2] == vm::Op_JL16);
+	CHECK(far.code[far.code.count - 5] == vm::Op_JMP);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(far, core, 20000).i64 == 204);
+	CHECK(core.state == vm::Core::STATE_HALT);
+}
+
+TEST_CASE("read only data")
+{
+	auto pkg = pkg_from_str(R"CODE(
+	u32.data squares 0 1 4 9 16 25 36 49
+	u64.data big 81985529216486895
+	proc main
+		i64.load r1 81985529216486895
+		u64.load r2 big
+		i32.load r3 0
+		i32.load r4 8
+	loop:
+		u32.load r5 squares r3
+		i64.add r0 r5
+		i32.load r6 1
+		i32.add r3 r6
+		i32.jl r3 r4 loop
+		halt
+	end
+	proc oob
+		u32.load r0 squares r0
+		halt
+	end
+	)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	// the large constant is the same as big so they share the same 8 bytes
+	CHECK(pkg.rodata.count == 40);
+	auto code = vm::proc_handle_get(pkg, "main").code;
+	CHECK(code[0] == vm::Op_KLOAD64);
+	CHECK(code.count == 6 + 6 + 6 + 6 + 6 + 2 + 6 + 2 + 2 + 2 + 1);
+
+	// blocks which are already there are reused, even as a part of a bigger one
+	uint32_t nine = 9;
+	CHECK(vm::pkg_data_add(pkg, &nine, sizeof(nine), sizeof(nine)) == 12);
+	CHECK(pkg.rodata.count == 40);
+
+	vm::pkg_save(pkg, "tethys_rodata_test.zyc");
+	auto loaded = vm::pkg_load("tethys_rodata_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_rodata_test.zyc");
+
+	// the data is mapped along with the code
+	auto main = vm::proc_handle_get(loaded, "main");
+	REQUIRE(vm::proc_handle_valid(main));
+	CHECK(loaded.rodata.count == 0);
+	CHECK(main.rodata.count == 40);
+	CHECK(uintptr_t(main.rodata.ptr) % vm::PKG_PAGE_SIZE == 0);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(main, core).u64 == 140);
+	CHECK(core.state == vm::Core::STATE_HALT);
+	CHECK(core.r[vm::Reg_R1].u64 == 81985529216486895ULL);
+	CHECK(core.r[vm::Reg_R2].u64 == 81985529216486895ULL);
+
+	auto oob = vm::proc_handle_get(loaded, "oob");
+	CHECK(vm::call(oob, core, 7).u32 == 49);
+	CHECK(core.state == vm::Core::STATE_HALT);
+	vm::call(oob, core, 100);
+	CHECK(core.state == vm::Core::STATE_ERR);
+}
+
+TEST_CASE("content addressed bodies")
+{
+	auto abc = vm::sha256("abc", 3);
+	CHECK(abc.bytes[0] == 0xba);
+	CHECK(abc.bytes[31] == 0xad);
+	const char* two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	auto digest = vm::sha256(two_blocks, ::strlen(two_blocks));
+	CHECK(digest.bytes[0] == 0x24);
+	CHECK(digest.bytes[31] == 0xc1);
+
+	auto sum = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(sum));
+	auto twice = pkg_from_str("proc main\n\ti64.add r0 r0\n\thalt\nend\n");
+	mn_defer(vm::pkg_free(twice));
+	auto sum_code = vm::proc_handle_get(sum, "main").code;
+	auto twice_code = vm::proc_handle_get(twice, "main").code;
+
+	// two tenants generated from the same template, the procs with the same body share it
+	vm::Bundle bundle = vm::bundle_new();
+	for (int i = 0; i < 2; ++i)
+	{
+		auto pkg = vm::pkg_new();
+		CHECK(vm::pkg_proc_add(pkg, "sum", mn::buf_clone(sum_code)));
+		CHECK(vm::pkg_proc_add(pkg, "total", mn::buf_clone(sum_code)));
+		CHECK(vm::pkg_proc_add(pkg, "twice", mn::buf_clone(twice_code)));
+		CHECK(vm::bundle_pkg_add(bundle, mn::strf("tenant_{}", i), pkg));
+	}
+	vm::bundle_save(bundle, "tethys_bundle_test.zyb");
+	vm::bundle_free(bundle);
+
+	auto loaded = vm::bundle_load("tethys_bundle_test.zyb");
+	mn_defer(vm::bundle_free(loaded));
+	::remove("tethys_bundle_test.zyb");
+	REQUIRE(loaded.pkgs.count == 2);
+
+	// the bundle has a page for its header, a page for each image and one for each distinct body
+	CHECK(loaded.file.size == 5 * vm::PKG_PAGE_SIZE);
+
+	auto t0 = vm::bundle_pkg(loaded, "tenant_0");
+	auto t1 = vm::bundle_pkg(loaded, "tenant_1");
+	REQUIRE(t0 != nullptr);
+	REQUIRE(t1 != nullptr);
+	CHECK(vm::bundle_pkg(loaded, "tenant_2") == nullptr);
+	CHECK(vm::proc_handle_get(*t0, "sum").code.ptr == vm::proc_handle_get(*t1, "total").code.ptr);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(vm::proc_handle_get(*t1, "sum"), core, 0, 10).i32 == 55);
+	CHECK(vm::call(vm::proc_handle_get(*t1, "twice"), core, 21).i64 == 42);
+
+	// separate package files share their bodies in memory through the intern
+	vm::pkg_save(*t0, "tethys_intern_test.zyc");
+	auto a = vm::pkg_load("tethys_intern_test.zyc");
+	mn_defer(vm::pkg_free(a));
+	auto b = vm::pkg_load("tethys_intern_test.zyc");
+	mn_defer(vm::pkg_free(b));
+	::remove("tethys_intern_test.zyc");
+
+	auto intern = vm::code_intern_new();
+	mn_defer(vm::code_intern_free(intern));
+	vm::pkg_code_intern_attach(a, intern);
+	vm::pkg_code_intern_attach(b, intern);
+
+	auto a_sum = vm::proc_handle_get(a, "sum");
+	auto b_total = vm::proc_handle_get(b, "total");
+	CHECK(a_sum.code.ptr == b_total.code.ptr);
+	CHECK(a_sum.blocks == b_total.blocks);
+	REQUIRE(a_sum.blocks != nullptr);
+	CHECK(a_sum.blocks->len.count == a_sum.code.count);
+	vm::proc_handle_get(b, "twice");
+	CHECK(vm::code_intern_count(intern) == 2);
+	CHECK(vm::call(b_total, core, 0, 4).i32 == 10);
+
+	// a package which binds the digest of another body to its code doesn't get it interned
+	vm::pkg_save(*t0, "tethys_intern_test.zyc");
+	auto file = mn::file_content_str("tethys_intern_test.zyc");
+	mn_defer(mn::str_free(file));
+	auto sum_digest = vm::sha256(sum_code.ptr, sum_code.count);
+	auto twice_digest = vm::sha256(twice_code.ptr, twice_code.count);
+	size_t tampered = 0;
+	for (size_t i = 0; i + sizeof(sum_digest.bytes) <= file.count; ++i)
+	{
+		if (::memcmp(file.ptr + i, sum_digest.bytes, sizeof(sum_digest.bytes)) != 0)
+			continue;
+		::memcpy(file.ptr + i, twice_digest.bytes, sizeof(twice_digest.bytes));
+		++tampered;
+	}
+	CHECK(tampered == 2);
+	auto f = ::fopen("tethys_intern_test.zyc", "wb");
+	REQUIRE(f != nullptr);
+	::fwrite(file.ptr, 1, file.count, f);
+	::fclose(f);
+	auto c = vm::pkg_load("tethys_intern_test.zyc");
+	mn_defer(vm::pkg_free(c));
+	::remove("tethys_intern_test.zyc");
+
+	auto clean_intern = vm::code_intern_new();
+	mn_defer(vm::code_intern_free(clean_intern));
+	CHECK(vm::code_intern_get(clean_intern, twice_digest, sum_code) == nullptr);
+	vm::pkg_code_intern_attach(c, clean_intern);
+	auto c_sum = vm::proc_handle_get(c, "sum");
+	CHECK(c_sum.blocks == nullptr);
+	CHECK(vm::code_intern_count(clean_intern) == 0);
+	CHECK(vm::call(c_sum, core, 0, 10).i32 == 55);
+
+	// the real body still gets interned under its digest afterwards
+	vm::pkg_code_intern_attach(b, clean_intern);
+	CHECK(vm::call(vm::proc_handle_get(b, "twice"), core, 21).i64 == 42);
+	CHECK(vm::code_intern_count(clean_intern) == 1);
+
+	// the body is kept in the package once it's looked up, and dropped when the intern changes
+	CHECK(vm::proc_handle_get(a, "sum").blocks == a_sum.blocks);
+	CHECK(vm::proc_handle_get(b, "total").blocks != a_sum.blocks);
+	vm::pkg_code_intern_attach(b, intern);
+	CHECK(vm::proc_handle_get(b, "total").blocks == a_sum.blocks);
+	CHECK(vm::proc_handle_get(c, "sum").blocks == nullptr);
+	CHECK(vm::code_intern_count(clean_intern) == 2);
+}
+
+TEST_CASE("compressed packages")
+{
+	// runs compress well and bytes which don't are stored at about their size
+	uint8_t raw[4096];
+	for (size_t i = 0; i < sizeof(raw); ++i)
+		raw[i] = uint8_t(i < 2048 ? i % 7 : (i * 2654435761u) >> 13);
+	uint8_t compressed[4096 + 4096 / 255 + 16];
+	REQUIRE(vm::lz_compress_bound(sizeof(raw)) <= sizeof(compressed));
+	auto compressed_size = vm::lz_compress(raw, sizeof(raw), compressed, sizeof(compressed));
+	CHECK(compressed_size > 0);
+	CHECK(compressed_size < 2048 + 100);
+	uint8_t decompressed[4096];
+	CHECK(vm::lz_decompress(compressed, compressed_size, decompressed, sizeof(decompressed)));
+	CHECK(::memcmp(raw, decompressed, sizeof(raw)) == 0);
+	CHECK(vm::lz_decompress(compressed, compressed_size - 1, decompressed, sizeof(decompressed)) == false);
+	CHECK(vm::lz_decompress(compressed, compressed_size, decompressed, sizeof(decompressed) - 1) == false);
+
+	// big enough to be decompressed on many threads
+	auto src = mn::str_from_c("u64.data base 1000000\n");
+	mn_defer(mn::str_free(src));
+	for (int i = 0; i < 128; ++i)
+	{
+		mn::str_push(src, "proc p");
+		auto index = mn::strf("{}", i);
+		mn::str_push(src, index);
+		mn::str_push(src, "\n\tu64.load r0 base\n\ti64.load r1 ");
+		mn::str_push(src, index);
+		mn::str_free(index);
+		mn::str_push(src, "\n");
+		for (int j = 0; j < 1000; ++j)
+			mn::str_push(src, "\ti64.add r0 r1\n");
+		mn::str_push(src, "\thalt\nend\n");
+	}
+	auto pkg = pkg_from_str(src.ptr);
+	mn_defer(vm::pkg_free(pkg));
+
+	vm::pkg_save(pkg, "tethys_plain_test.zyc");
+	vm::pkg_save_compressed(pkg, "tethys_compressed_test.zyc");
+	auto plain_file = vm::file_map_read("tethys_plain_test.zyc");
+	auto compressed_file = vm::file_map_read("tethys_compressed_test.zyc");
+	CHECK(compressed_file.size * 10 < plain_file.size);
+	vm::file_map_close(plain_file);
+	vm::file_map_close(compressed_file);
+	::remove("tethys_plain_test.zyc");
+
+	auto loaded = vm::pkg_load("tethys_compressed_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_compressed_test.zyc");
+	CHECK(loaded.image.count > 128 * 2000);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(vm::proc_handle_get(loaded, "p0"), core).u64 == 1000000);
+	CHECK(vm::call(vm::proc_handle_get(loaded, "p127"), core).u64 == 1000000 + 127 * 1000);
+	CHECK(core.state == vm::Core::STATE_HALT);
+
+	// a broken one loads empty
+	auto f = ::fopen("tethys_broken_test.zyc", "wb");
+	REQUIRE(f != nullptr);
+	::fwrite(&vm::PKG_Z_MAGIC, sizeof(vm::PKG_Z_MAGIC), 1, f);
+	::fwrite(compressed, 1, 64, f);
+	::fclose(f);
+	auto broken = vm::pkg_load("tethys_broken_test.zyc");
+	mn_defer(vm::pkg_free(broken));
+	::remove("tethys_broken_test.zyc");
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(broken, "p0")) == false);
+}
+
+TEST_CASE("packages from memory")
+{
+	auto pkg = pkg_from_str(R"CODE(
+	u64.data base 100
+	proc main
+		u64.load r0 base
+		i64.add r0 r1
+		halt
+	end
+	proc twice
+		i64.add r0 r0
+		halt
+	end
+	)CODE");
+	mn_defer(vm::pkg_free(pkg));
+
+	auto names = vm::pkg_proc_names(pkg);
+	mn_defer(destruct(names));
+	CHECK(names.count == 2);
+
+	vm::pkg_save(pkg, "tethys_memory_test.zyc");
+	auto file = vm::file_map_read("tethys_memory_test.zyc");
+	mn_defer(vm::file_map_close(file));
+	::remove("tethys_memory_test.zyc");
+
+	// the procs point right into the bytes
+	auto loaded = vm::pkg_from_memory(file.ptr, file.size);
+	mn_defer(vm::pkg_free(loaded));
+	auto main = vm::proc_handle_get(loaded, "main");
+	REQUIRE(vm::proc_handle_valid(main));
+	CHECK(main.code.ptr >= file.ptr);
+	CHECK(main.code.ptr < file.ptr + file.size);
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(main, core, 0, 5).u64 == 105);
+	CHECK(vm::call(vm::proc_handle_get(loaded, "twice"), core, 21).i64 == 42);
+
+	// compressed ones are decompressed out of the bytes
+	vm::pkg_save_compressed(pkg, "tethys_memory_test.zyc");
+	auto compressed_file = vm::file_map_read("tethys_memory_test.zyc");
+	mn_defer(vm::file_map_close(compressed_file));
+	::remove("tethys_memory_test.zyc");
+	auto compressed = vm::pkg_from_memory(compressed_file.ptr, compressed_file.size);
+	mn_defer(vm::pkg_free(compressed));
+	CHECK(vm::call(vm::proc_handle_get(compressed, "main"), core, 0, 1).u64 == 101);
+
+	uint8_t junk[64] = {1, 2, 3};
+	auto broken = vm::pkg_from_memory(junk, sizeof(junk));
+	mn_defer(vm::pkg_free(broken));
+	CHECK(vm::proc_handle_valid(vm::proc_handle_get(broken, "main")) == false);
+}
+
+TEST_CASE("package registry")
+{
+	auto first = pkg_from_str("proc main\n\ti64.load r0 1\n\thalt\nend\n");
+	auto registry = vm::pkg_registry_new(first, 4);
+	mn_defer(vm::pkg_registry_free(registry));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+
+	// the call in flight keeps its version while new calls get the new one
+	auto old_ref = vm::pkg_registry_acquire(registry);
+	auto old_main = vm::proc_handle_get(*old_ref.pkg, "main");
+	vm::pkg_registry_swap(registry, pkg_from_str("proc main\n\ti64.load r0 2\n\thalt\nend\n"));
+	CHECK(vm::pkg_registry_retired_count(registry) == 1);
+
+	auto new_ref = vm::pkg_registry_acquire(registry);
+	CHECK(new_ref.pkg != old_ref.pkg);
+	CHECK(vm::call(vm::proc_handle_get(*new_ref.pkg, "main"), core).i64 == 2);
+	CHECK(vm::call(old_main, core).i64 == 1);
+
+	// pins taken after the swap don't hold the old version back
+	CHECK(vm::pkg_registry_reclaim(registry) == 0);
+	vm::pkg_registry_release(registry, old_ref);
+	CHECK(vm::pkg_registry_reclaim(registry) == 1);
+	CHECK(vm::pkg_registry_retired_count(registry) == 0);
+	vm::pkg_registry_release(registry, new_ref);
+
+	// swaps while calls run on other threads
+	std::atomic<bool> done{false};
+	std::atomic<size_t> wrong{0};
+	auto callers = mn::buf_new<std::thread*>();
+	mn_defer(mn::buf_free(callers));
+	for (int i = 0; i < 3; ++i)
+	{
+		mn::buf_push(callers, new std::thread([registry, &done, &wrong]{
+			auto core = vm::core_new();
+			mn_defer(vm::core_free(core));
+			while (done == false)
+			{
+				auto ref = vm::pkg_registry_acquire(registry);
+				auto res = vm::call(vm::proc_handle_get(*ref.pkg, "main"), core).i64;
+				if (res < 2 || core.state != vm::Core::STATE_HALT)
+					++wrong;
+				vm::pkg_registry_release(registry, ref);
+			}
+		}));
+	}
+	for (int i = 0; i < 200; ++i)
+	{
+		auto src = mn::strf("proc main\n\ti64.load r0 {}\n\thalt\nend\n", i + 3);
+		vm::pkg_registry_swap(registry, pkg_from_str(src.ptr));
+		mn::str_free(src);
+	}
+	done = true;
+	for (auto caller: callers)
+	{
+		caller->join();
+		delete caller;
+	}
+	CHECK(wrong == 0);
+	vm::pkg_registry_reclaim(registry);
+	CHECK(vm::pkg_registry_retired_count(registry) == 0);
+
+	auto ref = vm::pkg_registry_acquire(registry);
+	CHECK(vm::call(vm::proc_handle_get(*ref.pkg, "main"), core).i64 == 202);
+	vm::pkg_registry_release(registry, ref);
+}
+
+TEST_CASE("shared procs")
+{
+	auto pkg = pkg_from_str(R"CODE(
+	u64.data base 1000
+	proc main
+		u64.load r2 base
+		i64.add r0 r1
+		i64.add r0 r2
+		halt
+	end
+	)CODE");
+	auto proc = vm::pkg_proc_new(pkg, "main");
+	CHECK(vm::pkg_proc_new(pkg, "missing") == nullptr);
+	// the proc has its own copy so it outlives the package
+	vm::pkg_free(pkg);
+	REQUIRE(proc != nullptr);
+	mn_defer(vm::proc_unref(proc));
+	CHECK(vm::proc_blocks(proc).len.count == vm::proc_code(proc).count);
+
+	// every thread runs the same bytes
+	std::atomic<size_t> wrong{0};
+	auto threads = mn::buf_new<std::thread*>();
+	mn_defer(mn::buf_free(threads));
+	for (int i = 0; i < 4; ++i)
+	{
+		mn::buf_push(threads, new std::thread([proc = vm::proc_ref(proc), i, &wrong]{
+			auto core = vm::core_new();
+			mn_defer(vm::core_free(core));
+			for (int j = 0; j < 1000; ++j)
+				if (vm::call(proc, core, i, j).i64 != i + j + 1000)
+					++wrong;
+			vm::proc_unref(proc);
+		}));
+	}
+	for (auto thread: threads)
+	{
+		thread->join();
+		delete thread;
+	}
+	CHECK(wrong == 0);
+
+	// jobs hold a reference until they're freed
+	auto scheduler = vm::scheduler_new(2);
+	mn_defer(vm::scheduler_free(scheduler));
+	auto core = vm::core_new();
+	core.r[vm::Reg_R0].i64 = 1;
+	core.r[vm::Reg_R1].i64 = 2;
+	auto job = vm::scheduler_submit(scheduler, proc, core);
+	auto& done = vm::job_wait(job);
+	CHECK(done.state == vm::Core::STATE_HALT);
+	CHECK(done.r[vm::Reg_R0].i64 == 1003);
+	CHECK(vm::job_ins_count(job) == 4);
+	vm::job_free(job);
+}
+
+TEST_CASE("bytecode verifier")
+{
+	auto pkg = pkg_from_str(SUM_PROC);
+	mn_defer(vm::pkg_free(pkg));
+	auto code = vm::proc_handle_get(pkg, "main").code;
+	CHECK(vm::code_verify(code).err == vm::VERIFY_OK);
+
+	auto proc = vm::pkg_proc_new(pkg, "main");
+	mn_defer(vm::proc_unref(proc));
+	CHECK(vm::proc_verified(proc));
+
+	auto core = vm::core_new();
+	mn_defer(vm::core_free(core));
+	CHECK(vm::call(proc, core, 0, 10).i32 == 55);
+
+	auto check = [&core](mn::Buf<uint8_t> bad, vm::VERIFY_ERR err, uint64_t offset) {
+		auto res = vm::code_verify(bad);
+		CHECK(res.err == err);
+		CHECK(res.offset == offset);
+
+		// the checked path stops at the malformed instruction instead of reading past it
+		vm::call(vm::Proc_Handle{bad, {}, nullptr, false}, core);
+		if (err != vm::VERIFY_ERR_TARGET && err != vm::VERIFY_ERR_FALLTHROUGH && err != vm::VERIFY_ERR_IP_OPERAND)
+			CHECK(core.state == vm::Core::STATE_ERR);
+		mn::buf_free(bad);
+	};
+
+	// the load's constant is cut off
+	auto truncated = mn::buf_clone(code);
+	mn::buf_resize(truncated, 3);
+	check(truncated, vm::VERIFY_ERR_TRUNCATED, 0);
+
+	auto bad_reg = mn::buf_clone(code);
+	bad_reg[1] = 12;
+	check(bad_reg, vm::VERIFY_ERR_REGISTER, 0);
+
+	// the loop's jump lands in the middle of the first load
+	auto bad_target = mn::buf_clone(code);
+	CHECK(bad_target[20] == vm::Op_JLE8);
+	bad_target[21] = int8_t(-21);
+	check(bad_target, vm::VERIFY_ERR_TARGET, 20);
+
+	auto fallthrough = mn::buf_clone(code);
+	mn::buf_pop(fallthrough);
+	check(fallthrough, vm::VERIFY_ERR_FALLTHROUGH, 20);
+
+	auto ip_write = pkg_from_str("proc main\n\ti64.load ip 10\n\thalt\nend\n");
+	mn_defer(vm::pkg_free(ip_write));
+	check(mn::buf_clone(vm::proc_handle_get(ip_write, "main").code), vm::VERIFY_ERR_IP_OPERAND, 0);
+
+	auto illegal = mn::buf_new<uint8_t>();
+	mn::buf_push(illegal, uint8_t(250));
+	mn::buf_push(illegal, uint8_t(vm::Op_HALT));
+	check(illegal, vm::VERIFY_ERR_OPCODE, 0);
+
+	// procs are verified once per package without an intern, added ones when they're added and
+	// the ones in a file the first time they're looked up
+	CHECK(vm::proc_handle_get(pkg, "main").verified);
+	CHECK(vm::proc_handle_get(ip_write, "main").verified == false);
+	vm::pkg_proc_add(pkg, mn::str_from_c("ip_write"), mn::buf_clone(vm::proc_handle_get(ip_write, "main").code));
+	CHECK(vm::proc_handle_get(pkg, "ip_write").verified == false);
+
+	vm::pkg_save(pkg, "tethys_verify_test.zyc");
+	auto loaded = vm::pkg_load("tethys_verify_test.zyc");
+	mn_defer(vm::pkg_free(loaded));
+	::remove("tethys_verify_test.zyc");
+	REQUIRE(loaded.verified != nullptr);
+	auto loaded_main = vm::proc_handle_get(loaded, "main");
+	CHECK(loaded_main.verified);
+	CHECK(loaded_main.blocks == nullptr);
+	CHECK(vm::proc_handle_get(loaded, "ip_write").verified == false);
+	CHECK(vm::call(loaded_main, core, 0, 10).i32 == 55);
+
+	// a verified proc entered in the middle of an instruction runs with the checks, here the last
+	// byte of the immediate decodes as an i64.load which runs past the end of the code
+	auto inner_code = mn::buf_with_count<uint8_t>(11);
+	memset(inner_code.ptr, 0, inner_code.count);
+	inner_code[0] = vm::Op_LOAD64;
+	inner_code[9] = vm::Op_LOAD64;
+	inner_code[10] = vm::Op_HALT;
+	mn_defer(mn::buf_free(inner_code));
+	auto inner_rodata = mn::buf_new<uint8_t>();
+	mn_defer(mn::buf_free(inner_rodata));
+	auto inner_proc = vm::proc_new(inner_code, inner_rodata);
+	mn_defer(vm::proc_unref(inner_proc));
+	REQUIRE(vm::proc_verified(inner_proc));
+	CHECK(vm::blocks_is_start(vm::proc_blocks(inner_proc), 0));
+	CHECK(vm::blocks_is_start(vm::proc_blocks(inner_proc), 9) == false);
+	CHECK(vm::blocks_is_start(vm::proc_blocks(inner_proc), 10));
+	for (bool metered: {false, true})
+	{
+		auto inner_core = vm::core_new();
+		mn_defer(vm::core_free(inner_core));
+		inner_core.r[vm::Reg_IP].u64 = 9;
+		uint64_t budget = 100;
+		if (metered)
+			vm::core_run_for(inner_core, inner_proc, budget);
+		else
+			vm::core_run(inner_core, inner_proc);
+		CHECK(inner_core.state == vm::Core::STATE_ERR);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <mn/Buf.h>
+
+#include <stdint.h>
+
+namespace vm
+{
+	// basic blocks of a proc, they're computed once at load time from the jump targets
+	// so that instruction budgets can be charged once per block instead of once per instruction
+	struct Blocks
+	{
+		// indexed by the bytecode offset, it holds the count of instructions in the block
+		// which starts at this offset, or 0 if the offset is not a block leader
+		mn::Buf<uint32_t> len;
+		// indexed by the bytecode offset of a block leader, it holds the offset of the last
+		// instruction of the block which is the only one that can leave it
+		mn::Buf<uint64_t> last;
+		// bitmap of the offsets which start an instruction
+		mn::Buf<uint64_t> starts;
+	};
+
+	VM_EXPORT Blocks
+	blocks_build(const mn::Buf<uint8_t>& code);
+
+	VM_EXPORT void
+	blocks_free(Blocks& self);
+
+	// returns whether an instruction starts at the offset
+	inline static bool
+	blocks_is_start(const Blocks& self, uint64_t offset)
+	{
+		if (offset / 64 >= self.starts.count)
+			return false;
+		return (self.starts[offset / 64] >> (offset % 64)) & 1;
+	}
+
+	inline static void
+	destruct(Blocks& self)
+	{
+		blocks_free(self);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "vm/Core.h"
+#include "vm/Pkg.h"
+
+#include <type_traits>
+
+namespace vm
+{
+	template<typename T>
+	inline static void
+	call_arg_set(Core& core, uint8_t& index, T value)
+	{
+		static_assert(std::is_integral_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>, "call arguments should fit in a register");
+
+		Reg_Val& r = core.r[Reg_R0 + index++];
+		if constexpr (std::is_pointer_v<T>)
+			r.u64 = uint64_t(uintptr_t(value));
+		else if constexpr (std::is_signed_v<T>)
+			r.i64 = int64_t(value);
+		else
+			r.u64 = uint64_t(value);
+	}
+
+	inline static void
+	call_reset(Core& core)
+	{
+		for (auto& r: core.r)
+			r.u64 = 0;
+		core.state = Core::STATE_OK;
+		core.cmp = Core::CMP_NONE;
+		core.fiber = 0;
+		mn::buf_clear(core.fibers);
+	}
+
+	// runs the proc on the core with the arguments in R0, R1, ... and returns R0, the core starts
+	// from a clean state each call but keeps its attached resources (memory, channels, natives),
+	// the package's read only data is attached by the call itself
+	// so the same core can be reused for millions of calls without any allocations
+	// check core.state after the call to know whether the proc halted or stopped early
+	template<typename... TArgs>
+	inline static Reg_Val
+	call(const Proc_Handle& handle, Core& core, TArgs&&... args)
+	{
+		static_assert(sizeof...(TArgs) <= Reg_IP - Reg_R0, "procs take at most 8 arguments");
+		assert(proc_handle_valid(handle));
+		call_reset(core);
+
+		uint8_t index = 0;
+		(call_arg_set(core, index, args), ...);
+		(void)index;
+
+		core_rodata_attach(core, handle.rodata);
+		if (handle.verified)
+			core_run_verified(core, handle.code);
+		else
+			core_run(core, handle.code);
+		return core.r[Reg_R0];
+	}
+
+	// same as call but the arguments are a runtime array of at most 8 register values
+	inline static Reg_Val
+	call_regs(const Proc_Handle& handle, Core& core, const Reg_Val* args, size_t count)
+	{
+		assert(proc_handle_valid(handle) && count <= size_t(Reg_IP - Reg_R0));
+		call_reset(core);
+
+		for (size_t i = 0; i < count; ++i)
+			core.r[Reg_R0 + i] = args[i];
+
+		core_rodata_attach(core, handle.rodata);
+		if (handle.verified)
+			core_run_verified(core, handle.code);
+		else
+			core_run(core, handle.code);
+		return core.r[Reg_R0];
+	}
+
+	// same as call but it runs a shared proc with its read only data
+	template<typename... TArgs>
+	inline static Reg_Val
+	call(Proc proc, Core& core, TArgs&&... args)
+	{
+		static_assert(sizeof...(TArgs) <= Reg_IP - Reg_R0, "procs take at most 8 arguments");
+		call_reset(core);
+
+		uint8_t index = 0;
+		(call_arg_set(core, index, args), ...);
+		(void)index;
+
+		core_rodata_attach(core, proc_rodata(proc));
+		core_run(core, proc);
+		return core.r[Reg_R0];
+	}
+
+	inline static Reg_Val
+	call_regs(Proc proc, Core& core, const Reg_Val* args, size_t count)
+	{
+		assert(count <= size_t(Reg_IP - Reg_R0));
+		call_reset(core);
+
+		for (size_t i = 0; i < count; ++i)
+			core.r[Reg_R0 + i] = args[i];
+
+		core_rodata_attach(core, proc_rodata(proc));
+		core_run(core, proc);
+		return core.r[Reg_R0];
+	}
+}
\ No newline at end of file
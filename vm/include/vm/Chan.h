@@ -0,0 +1,60 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vm
+{
+	// channel is a bounded lock-free ring buffer of 64-bit values used to pass messages
+	// between cores, it's created and freed by the host and attached to the cores which use it
+	typedef struct IChan* Chan;
+
+	enum CHAN_KIND
+	{
+		// single producer single consumer
+		CHAN_KIND_SPSC,
+		// multiple producers multiple consumers
+		CHAN_KIND_MPMC
+	};
+
+	// creates a new channel, the capacity is rounded up to the next power of 2
+	VM_EXPORT Chan
+	chan_new(size_t capacity, CHAN_KIND kind = CHAN_KIND_MPMC);
+
+	VM_EXPORT void
+	chan_free(Chan self);
+
+	inline static void
+	destruct(Chan self)
+	{
+		chan_free(self);
+	}
+
+	VM_EXPORT size_t
+	chan_capacity(Chan self);
+
+	// tries to send the value and returns false if the channel is full
+	VM_EXPORT bool
+	chan_try_send(Chan self, uint64_t value);
+
+	// tries to receive a value and returns false if the channel is empty
+	VM_EXPORT bool
+	chan_try_recv(Chan self, uint64_t& value);
+
+	// waiter parked on a channel, wake is called once with the user data when the channel
+	// might be able to do what the waiter is waiting for
+	struct Chan_Waiter
+	{
+		void (*wake)(void* user);
+		void* user;
+		Chan_Waiter* next;
+	};
+
+	// parks the waiter on the channel until a value is received if it's waiting to send, or until
+	// a value is sent if it's waiting to receive, returns false without parking it if the channel
+	// can already do it, the waiter should stay alive until it's woken
+	VM_EXPORT bool
+	chan_park(Chan self, Chan_Waiter* waiter, bool send);
+}
\ No newline at end of file
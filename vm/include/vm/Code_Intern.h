@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Sha256.h"
+#include "vm/Blocks.h"
+
+#include <mn/Buf.h>
+
+namespace vm
+{
+	// code intern is a process wide table of proc bodies keyed by their sha-256, packages which
+	// have it attached hand out the interned copy of their procs, so a body which is in many
+	// packages is in memory once and its basic blocks are found once, it's safe to share between
+	// threads and the bodies live until it's freed
+	typedef struct ICode_Intern* Code_Intern;
+
+	struct Code_Body
+	{
+		mn::Buf<uint8_t> code;
+		Blocks blocks;
+		// whether the code passed code_verify
+		bool verified;
+	};
+
+	VM_EXPORT Code_Intern
+	code_intern_new();
+
+	// frees the intern and all of its bodies, the packages which have it attached shouldn't be
+	// used after that
+	VM_EXPORT void
+	code_intern_free(Code_Intern self);
+
+	inline static void
+	destruct(Code_Intern self)
+	{
+		code_intern_free(self);
+	}
+
+	// returns the body with the digest, the first time a digest is seen the code is hashed, and if
+	// it matches the digest it's copied in, its blocks are built and it's verified, after that the
+	// code isn't even read, if it doesn't match nullptr is returned and nothing is interned
+	VM_EXPORT const Code_Body*
+	code_intern_get(Code_Intern self, const Sha256& digest, const mn::Buf<uint8_t>& code);
+
+	// returns the count of distinct bodies in the intern
+	VM_EXPORT size_t
+	code_intern_count(Code_Intern self);
+}
\ No newline at end of file
@@ -2,18 +2,47 @@
 
 #include "vm/Exports.h"
 #include "vm/Reg.h"
+#include "vm/Blocks.h"
+#include "vm/Chan.h"
+#include "vm/Io.h"
+#include "vm/Mem.h"
+#include "vm/Proc.h"
 
 #include <mn/Buf.h>
 
 namespace vm
 {
+	struct Core;
+
+	enum HOST_CALL
+	{
+		// the call is done and its result is in the core's registers
+		HOST_CALL_DONE,
+		// the call is still in flight, the core is suspended until the host resumes it
+		HOST_CALL_PENDING
+	};
+
+	// host call handler, it gets the call id and the core with the call's arguments in its registers
+	typedef HOST_CALL (*Host_Call_Fn)(Core& core, uint32_t id, void* user);
+
+	// native function the host exposes to the bytecode, it takes its arguments from R0-R7 and
+	// puts its result in R0
+	typedef void (*Host_Fn)(Core& core);
+
 	struct Core
 	{
 		enum STATE
 		{
 			STATE_OK,
 			STATE_HALT,
-			STATE_ERR
+			STATE_ERR,
+			// the core ran out of its instruction budget, running it again resumes it
+			STATE_YIELD,
+			// the core is parked on a full or an empty channel, running it again retries
+			STATE_BLOCK,
+			// the core is waiting on a pending host call or an I/O request, it won't run until
+			// it's resumed
+			STATE_PENDING
 		};
 
 		enum CMP
@@ -24,10 +53,63 @@ namespace vm
 			CMP_GREATER
 		};
 
+		// fiber is a green thread inside the core, the running fiber's registers live in the
+		// core itself and the rest are parked here, so switching is a register file swap
+		struct Fiber
+		{
+			enum STATE
+			{
+				STATE_READY,
+				STATE_JOIN,
+				STATE_DONE
+			};
+
+			STATE state;
+			CMP cmp;
+			// the fiber we're waiting on when in join state
+			uint64_t join;
+			Reg_Val r[Reg_COUNT];
+		};
+
 		STATE state;
 		// any compare result will be put here
 		CMP cmp;
 		Reg_Val r[Reg_COUNT];
+
+		// fibers are empty until the first spawn, then the root fiber is fibers[0]
+		mn::Buf<Fiber> fibers;
+		// index of the running fiber
+		uint64_t fiber;
+
+		// channels attached by the host, instructions refer to them by index
+		mn::Buf<Chan> chans;
+		// the channel the core is parked on when it's blocked, and whether it waits to send on it
+		Chan blocked_chan;
+		bool blocked_send;
+
+		// memory region attached by the host, the atomic instructions address it by offset
+		// and it can be shared between cores, the core doesn't own it
+		uint8_t* mem;
+		uint64_t mem_size;
+		// set when the memory is a vm region, which is what makes the core forkable, a fork
+		// owns its region and frees it with the core
+		Mem mem_region;
+		bool mem_owned;
+
+		// host call handler and its user data, a host call without a handler is an error
+		Host_Call_Fn host_call;
+		void* host_call_user;
+
+		// the I/O request the core is waiting on, whoever runs the core submits it to its io
+		Io_Req io;
+
+		// native functions table bound to the package's imports, ncall indexes it directly
+		const Host_Fn* natives;
+		size_t natives_count;
+
+		// read only data of the package the code comes from, kload reads its constants from here
+		const uint8_t* rodata;
+		uint64_t rodata_size;
 	};
 
 	inline static Core
@@ -36,6 +118,94 @@ namespace vm
 		return Core{};
 	}
 
+	VM_EXPORT void
+	core_free(Core& self);
+
+	inline static void
+	destruct(Core& self)
+	{
+		core_free(self);
+	}
+
+	// attaches the channel to the core and returns its index which the instructions use
+	// the core doesn't own the channel
+	VM_EXPORT uint8_t
+	core_chan_attach(Core& self, Chan chan);
+
+	// attaches the memory region to the core, atomic accesses must be naturally aligned
+	// so the region's pointer should be 8 bytes aligned
+	VM_EXPORT void
+	core_mem_attach(Core& self, void* ptr, uint64_t size);
+
+	// attaches the vm memory region to the core, the core doesn't own it
+	VM_EXPORT void
+	core_mem_attach(Core& self, Mem mem);
+
+	// returns a new core with the same execution state as the parent, the parent's vm memory
+	// region is forked copy on write so the fork costs about as much as copying the registers
+	// host memory attached as a plain pointer is shared with the fork instead, and the host
+	// resources (channels, natives, read only data, host call handler) are shared too
+	// the parent shouldn't be running or waiting on a pending host call or I/O request
+	VM_EXPORT Core
+	core_fork(const Core& parent);
+
+	VM_EXPORT void
+	core_host_call_set(Core& self, Host_Call_Fn fn, void* user);
+
+	// completes the core's pending host call, the result is put in R0 and the core continues
+	// from the instruction after the host call the next time it runs
+	VM_EXPORT void
+	core_resume(Core& self, Reg_Val result);
+
+	// attaches the table of native functions, the core doesn't own it
+	VM_EXPORT void
+	core_natives_attach(Core& self, const mn::Buf<Host_Fn>& table);
+
+	// attaches the package's read only data, the core doesn't own it
+	VM_EXPORT void
+	core_rodata_attach(Core& self, const mn::Buf<uint8_t>& rodata);
+
+	// submits the I/O request of a pending core to the given io, the core is resumed with the
+	// request's result once it's reaped
+	VM_EXPORT void
+	core_io_submit(Core& self, Io io);
+
+	// executes the instruction at the IP, the instruction is checked first and if it's malformed
+	// the core stops with STATE_ERR
 	VM_EXPORT void
 	core_ins_execute(Core& self, const mn::Buf<uint8_t>& code);
+
+	// executes the code until the core leaves the ok state, and returns the final state
+	// yielded and blocked cores are resumed, a pending core stays pending until core_resume
+	VM_EXPORT Core::STATE
+	core_run(Core& self, const mn::Buf<uint8_t>& code);
+
+	// executes the code with an instruction budget which is charged once per basic block, the
+	// budget is decremented by the count of executed instructions, and once it's exhausted the
+	// core stops with STATE_YIELD
+	// the blocks should come from blocks_build of this very code and be rebuilt whenever it
+	// changes, blocks of other code charge and refund the wrong counts, procs and the code intern
+	// build theirs so prefer the proc version
+	VM_EXPORT Core::STATE
+	core_run_for(Core& self, const mn::Buf<uint8_t>& code, const Blocks& blocks, uint64_t& budget);
+
+	// the verified versions skip the checks of every instruction, the code should pass code_verify,
+	// a core whose IP or fibers' IPs aren't at the start of its instructions runs with the checks
+	VM_EXPORT Core::STATE
+	core_run_verified(Core& self, const mn::Buf<uint8_t>& code);
+
+	VM_EXPORT Core::STATE
+	core_run_for_verified(Core& self, const mn::Buf<uint8_t>& code, const Blocks& blocks, uint64_t& budget);
+
+	// the proc versions run its code in place, verified procs without the checks, the proc's
+	// read only data should be attached
+	VM_EXPORT void
+	core_ins_execute(Core& self, Proc proc);
+
+	VM_EXPORT Core::STATE
+	core_run(Core& self, Proc proc);
+
+	// metered using the proc's blocks
+	VM_EXPORT Core::STATE
+	core_run_for(Core& self, Proc proc, uint64_t& budget);
 }
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Core.h"
+
+namespace vm
+{
+	// pool of cores for hosts which run many of them on many threads, every core sits on its
+	// own cache lines so cores running on different threads don't false share, the memory of a
+	// core is placed on the NUMA node of the thread which gets it from the pool, and freed cores
+	// are recycled on a per node free list instead of going back to the allocator
+	typedef struct ICore_Pool* Core_Pool;
+
+	// creates a new pool which allocates cores in chunks of the given count
+	VM_EXPORT Core_Pool
+	core_pool_new(size_t chunk_count = 64);
+
+	// frees the pool and all of its memory, all the cores should be put back before that
+	VM_EXPORT void
+	core_pool_free(Core_Pool self);
+
+	inline static void
+	destruct(Core_Pool self)
+	{
+		core_pool_free(self);
+	}
+
+	// returns a fresh core from the NUMA node of the calling thread
+	VM_EXPORT Core*
+	core_pool_get(Core_Pool self);
+
+	// frees the core's resources and puts it back into the pool
+	VM_EXPORT void
+	core_pool_put(Core_Pool self, Core* core);
+}
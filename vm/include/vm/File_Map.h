@@ -0,0 +1,53 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vm
+{
+	// file mapped into memory, reads and writes go straight to the page cache without copies
+	struct File_Map
+	{
+		uint8_t* ptr;
+		size_t size;
+		intptr_t handle;
+		intptr_t mapping;
+	};
+
+	// returns a map which holds nothing, closing it does nothing
+	inline static File_Map
+	file_map_invalid()
+	{
+		return File_Map{nullptr, 0, -1, -1};
+	}
+
+	// returns a map of memory which someone else mapped, closing it does nothing
+	inline static File_Map
+	file_map_view(uint8_t* ptr, size_t size)
+	{
+		return File_Map{ptr, size, -1, -1};
+	}
+
+	// maps the whole file read only, use file_map_valid to check whether it failed, an empty
+	// file maps fine to a null ptr with a zero size
+	VM_EXPORT File_Map
+	file_map_read(const char* path);
+
+	// creates or truncates the file to the given size and maps it for writing
+	VM_EXPORT File_Map
+	file_map_write(const char* path, size_t size);
+
+	VM_EXPORT bool
+	file_map_valid(const File_Map& self);
+
+	VM_EXPORT void
+	file_map_close(File_Map& self);
+
+	inline static void
+	destruct(File_Map& self)
+	{
+		file_map_close(self);
+	}
+}
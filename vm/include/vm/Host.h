@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Core.h"
+#include "vm/Pkg.h"
+
+#include <mn/Str.h>
+#include <mn/Buf.h>
+#include <mn/Map.h>
+
+namespace vm
+{
+	// native functions the host registers by name, packages import them by name and they're
+	// bound to a table which the cores index directly
+	struct Host_Registry
+	{
+		mn::Map<mn::Str, Host_Fn> fns;
+	};
+
+	VM_EXPORT Host_Registry
+	host_registry_new();
+
+	VM_EXPORT void
+	host_registry_free(Host_Registry& self);
+
+	inline static void
+	destruct(Host_Registry& self)
+	{
+		host_registry_free(self);
+	}
+
+	// registers the function and returns false if the name is already taken
+	VM_EXPORT bool
+	host_registry_add(Host_Registry& self, const mn::Str& name, Host_Fn fn);
+
+	inline static bool
+	host_registry_add(Host_Registry& self, const char* name, Host_Fn fn)
+	{
+		return host_registry_add(self, mn::str_lit(name), fn);
+	}
+
+	// returns the table of functions in the package's import order, imports which aren't
+	// registered are null and calling them stops the core with an error
+	VM_EXPORT mn::Buf<Host_Fn>
+	host_registry_bind(const Host_Registry& self, const Pkg& pkg);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vm
+{
+	// io is an asynchronous file I/O queue, requests are staged and sent to the kernel in
+	// batches and their completions are reaped in bulk, it uses io_uring when it's available
+	// and falls back to a small thread pool doing blocking calls otherwise
+	// it's owned by a single thread which does all the submits, flushes and reaps
+	typedef struct IIo* Io;
+
+	enum IO_BACKEND
+	{
+		// io_uring if the kernel supports it, threads otherwise
+		IO_BACKEND_AUTO,
+		IO_BACKEND_URING,
+		IO_BACKEND_THREADS
+	};
+
+	enum IO_OP
+	{
+		IO_OP_NONE,
+		IO_OP_OPEN,
+		IO_OP_READ,
+		IO_OP_WRITE,
+		IO_OP_CLOSE
+	};
+
+	enum IO_OPEN
+	{
+		IO_OPEN_READ,
+		// creates the file if it doesn't exist and truncates it if it does
+		IO_OPEN_WRITE
+	};
+
+	struct Io_Req
+	{
+		IO_OP op;
+		// file descriptor of read, write and close
+		int64_t fd;
+		// path of open, or buffer of read and write
+		void* ptr;
+		// buffer size of read and write
+		uint64_t size;
+		// IO_OPEN flags of open
+		uint64_t flags;
+	};
+
+	// called when the request is done with its result, which is the file descriptor for open,
+	// the count of bytes for read and write, 0 for close, or a negative errno on failure
+	typedef void (*Io_Done_Fn)(void* user, int64_t result);
+
+	// creates a new io, entries is the count of requests the io_uring queues can hold, the
+	// requests which don't fit while the kernel is busy go to the threads, if the uring backend
+	// is requested and it's not available this returns nullptr
+	VM_EXPORT Io
+	io_new(size_t entries = 256, IO_BACKEND backend = IO_BACKEND_AUTO);
+
+	// waits for the requests in flight then frees the io
+	VM_EXPORT void
+	io_free(Io self);
+
+	inline static void
+	destruct(Io self)
+	{
+		io_free(self);
+	}
+
+	VM_EXPORT IO_BACKEND
+	io_backend(Io self);
+
+	// stages the request, it's sent with the next flush or once enough requests are staged
+	VM_EXPORT void
+	io_submit(Io self, const Io_Req& req, Io_Done_Fn done, void* user);
+
+	// sends the staged requests
+	VM_EXPORT void
+	io_flush(Io self);
+
+	// calls the done callback of every finished request and returns their count, if wait is
+	// true and there are requests in flight it blocks until at least one of them is done
+	VM_EXPORT size_t
+	io_reap(Io self, bool wait);
+
+	// returns the count of submitted requests which are not reaped yet
+	VM_EXPORT size_t
+	io_inflight(Io self);
+}
\ No newline at end of file
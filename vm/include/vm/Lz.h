@@ -0,0 +1,26 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vm
+{
+	// lz is a small lz77 block codec in the spirit of lz4, it trades ratio for speed, a block is a
+	// run of sequences each one being a token, literals, then a match which copies bytes from a
+	// 16-bit offset back, decoding is nothing but copies and blocks don't depend on each other
+	// so they can be decoded in any order on any thread
+
+	// returns the size the compressed block can reach in the worst case
+	VM_EXPORT size_t
+	lz_compress_bound(size_t size);
+
+	// compresses the bytes into dst and returns the compressed size, or 0 if dst is too small
+	VM_EXPORT size_t
+	lz_compress(const void* src, size_t src_size, void* dst, size_t dst_size);
+
+	// decompresses the block into exactly raw_size bytes, returns false if the block is broken
+	VM_EXPORT bool
+	lz_decompress(const void* src, size_t src_size, void* dst, size_t raw_size);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace vm
+{
+	// memory region owned by the vm which can be forked copy on write, on linux it lives in a
+	// memfd so a fork is a private mapping of the same pages and each fork only pays for the
+	// pages it writes, on other platforms forking falls back to a copy
+	typedef struct IMem* Mem;
+
+	// creates a new zeroed memory region, the size is rounded up to the page size
+	VM_EXPORT Mem
+	mem_new(size_t size);
+
+	VM_EXPORT void
+	mem_free(Mem self);
+
+	inline static void
+	destruct(Mem self)
+	{
+		mem_free(self);
+	}
+
+	VM_EXPORT uint8_t*
+	mem_ptr(Mem self);
+
+	VM_EXPORT size_t
+	mem_size(Mem self);
+
+	// returns a fork of the memory with its current content, which shares its pages with the
+	// original until they're written, the first fork of a region freezes it in place for free,
+	// later forks, and forks of a fork, are free too until the region is written, after that the
+	// next fork writes the region's non zero pages into a new image first, so fork a region once
+	// it's done initializing to pay for that at most once
+	VM_EXPORT Mem
+	mem_fork(Mem self);
+
+	// returns whether both regions are mapped over the same image, forks share it until one of
+	// them is written and forked again
+	VM_EXPORT bool
+	mem_image_shared(Mem self, Mem other);
+}
@@ -4,6 +4,13 @@
 
 namespace vm
 {
+	// version of the bytecode encoding, 2 packs register pairs and picks the smallest jump offset
+	// which fits while 1 used a byte per register and 64-bit jump offsets
+	constexpr uint8_t BYTECODE_VERSION = 2;
+
+	// operands are written in the order they're listed, [a b] is a register pair packed in a
+	// single byte with a in the low nibble and b in the high nibble, offsets are relative to the
+	// end of the instruction
 	enum Op: uint8_t
 	{
 		// illegal opcode
@@ -15,84 +22,377 @@ namespace vm
 		Op_LOAD32,
 		Op_LOAD64,
 
-		// ADD [dst + op1] [op2]
+		// ADD [dst + op1, op2]
 		Op_ADD8,
 		Op_ADD16,
 		Op_ADD32,
 		Op_ADD64,
 
-		// SUB [dst + op1] [op2]
+		// SUB [dst + op1, op2]
 		Op_SUB8,
 		Op_SUB16,
 		Op_SUB32,
 		Op_SUB64,
 
-		// MUL [dst + op1] [op2]
+		// MUL [dst + op1, op2]
 		Op_MUL8,
 		Op_MUL16,
 		Op_MUL32,
 		Op_MUL64,
 
-		// IMUL [dst + op1] [op2]
+		// IMUL [dst + op1, op2]
 		Op_IMUL8,
 		Op_IMUL16,
 		Op_IMUL32,
 		Op_IMUL64,
 
-		// DIV [dst + op1] [op2]
+		// DIV [dst + op1, op2]
 		Op_DIV8,
 		Op_DIV16,
 		Op_DIV32,
 		Op_DIV64,
 
-		// IDIV [dst + op1] [op2]
+		// IDIV [dst + op1, op2]
 		Op_IDIV8,
 		Op_IDIV16,
 		Op_IDIV32,
 		Op_IDIV64,
 
 		// unsigned compare
-		// CMP [op1] [op2]
+		// CMP [op1, op2]
 		Op_CMP8,
 		Op_CMP16,
 		Op_CMP32,
 		Op_CMP64,
 
 		// signed compare
-		// ICMP [op1] [op2]
+		// ICMP [op1, op2]
 		Op_ICMP8,
 		Op_ICMP16,
 		Op_ICMP32,
 		Op_ICMP64,
 
 		// jump unconditionall
-		// JMP [offset 64-bit]
+		// JMP [offset 32-bit]
 		Op_JMP,
 
 		// jump if equal
-		// JE [offset 64-bit]
+		// JE [offset 32-bit]
 		Op_JE,
 
 		// jump if not equal
-		// JNE [offset 64-bit]
+		// JNE [offset 32-bit]
 		Op_JNE,
 
 		// jump if less than
-		// JL [offset 64-bit]
+		// JL [offset 32-bit]
 		Op_JL,
 
 		// jump if less than or equal
-		// JLE [offset 64-bit]
+		// JLE [offset 32-bit]
 		Op_JLE,
 
 		// jump if greater than
-		// JG [offset 64-bit]
+		// JG [offset 32-bit]
 		Op_JG,
 
 		// jump if greater than or equal
-		// JGE [offset 64-bit]
+		// JGE [offset 32-bit]
 		Op_JGE,
 
 		Op_HALT,
+
+		// spawns a new fiber which starts at the offset with a copy of the current registers
+		// and puts the fiber id in dst
+		// SPAWN [dst] [offset 32-bit]
+		Op_SPAWN,
+
+		// switches to the next ready fiber, round robin
+		// YIELD
+		Op_YIELD,
+
+		// waits for the fiber with the id in the register to halt then puts its R0 in the register
+		// JOIN [op1]
+		Op_JOIN,
+
+		// sends the register value over the channel, parks the core if the channel is full
+		// SEND [chan 8-bit] [op1]
+		Op_SEND,
+
+		// receives a value from the channel into the register, parks the core if the channel is empty
+		// RECV [chan 8-bit] [dst]
+		Op_RECV,
+
+		// non blocking variants, ok register is set to 1 on success and 0 otherwise
+		// TRY_SEND [chan 8-bit] [op1, ok]
+		Op_TRY_SEND,
+		// TRY_RECV [chan 8-bit] [dst, ok]
+		Op_TRY_RECV,
+
+		// atomic compare and swap on the memory at the address, the expected register gets the old value
+		// and the memory is set to desired only if the old value equals expected
+		// CAS [addr, expected] [desired]
+		Op_CAS8,
+		Op_CAS16,
+		Op_CAS32,
+		Op_CAS64,
+
+		// atomic exchange, the register gets the old value of the memory at the address
+		// XCHG [addr, op1]
+		Op_XCHG8,
+		Op_XCHG16,
+		Op_XCHG32,
+		Op_XCHG64,
+
+		// atomic add to the memory at the address, the register gets the old value
+		// FETCH_ADD [addr, op1]
+		Op_FETCH_ADD8,
+		Op_FETCH_ADD16,
+		Op_FETCH_ADD32,
+		Op_FETCH_ADD64,
+
+		// atomic or with the memory at the address, the register gets the old value
+		// FETCH_OR [addr, op1]
+		Op_FETCH_OR8,
+		Op_FETCH_OR16,
+		Op_FETCH_OR32,
+		Op_FETCH_OR64,
+
+		// full memory fence
+		// FENCE
+		Op_FENCE,
+
+		// calls the host's handler with the call id, the arguments and the result are in registers
+		// the handler can leave the call pending which suspends the core until it's resumed
+		// HCALL [id 32-bit]
+		Op_HCALL,
+
+		// calls the native function at the index of the core's natives table, the arguments
+		// and the result are in registers
+		// NCALL [index 32-bit]
+		Op_NCALL,
+
+		// file I/O on the core's memory, the core is suspended until the request is done and
+		// its result is put in R0, which is the file descriptor for open, the count of bytes
+		// for read and write, or a negative errno on failure, paths are null terminated
+		// IO_OPEN [path addr, flags]
+		Op_IO_OPEN,
+		// IO_READ [fd, addr] [size]
+		Op_IO_READ,
+		// IO_WRITE [fd, addr] [size]
+		Op_IO_WRITE,
+		// IO_CLOSE [fd]
+		Op_IO_CLOSE,
+
+		// short forms of the jumps above, the assembler picks the smallest one which reaches
+		// JMP8 [offset 8-bit]
+		Op_JMP8,
+		Op_JE8,
+		Op_JNE8,
+		Op_JL8,
+		Op_JLE8,
+		Op_JG8,
+		Op_JGE8,
+
+		// JMP16 [offset 16-bit]
+		Op_JMP16,
+		Op_JE16,
+		Op_JNE16,
+		Op_JL16,
+		Op_JLE16,
+		Op_JG16,
+		Op_JGE16,
+
+		// loads the value at the offset of the core's read only data, which is where the package
+		// keeps its constants and tables
+		// KLOAD [dst] [offset 32-bit]
+		Op_KLOAD8,
+		Op_KLOAD16,
+		Op_KLOAD32,
+		Op_KLOAD64,
+
+		// loads the element at the index of the table at the offset of the read only data
+		// KLOADX [dst, index] [offset 32-bit]
+		Op_KLOADX8,
+		Op_KLOADX16,
+		Op_KLOADX32,
+		Op_KLOADX64,
 	};
+
+	// returns the size in bytes of the instruction with the given opcode, operands included
+	// illegal opcodes have a size of 1
+	inline static uint64_t
+	op_size(Op op)
+	{
+		switch(op)
+		{
+		case Op_LOAD8: return 3;
+		case Op_LOAD16: return 4;
+		case Op_LOAD32: return 6;
+		case Op_LOAD64: return 10;
+		case Op_ADD8: case Op_ADD16: case Op_ADD32: case Op_ADD64:
+		case Op_SUB8: case Op_SUB16: case Op_SUB32: case Op_SUB64:
+		case Op_MUL8: case Op_MUL16: case Op_MUL32: case Op_MUL64:
+		case Op_IMUL8: case Op_IMUL16: case Op_IMUL32: case Op_IMUL64:
+		case Op_DIV8: case Op_DIV16: case Op_DIV32: case Op_DIV64:
+		case Op_IDIV8: case Op_IDIV16: case Op_IDIV32: case Op_IDIV64:
+		case Op_CMP8: case Op_CMP16: case Op_CMP32: case Op_CMP64:
+		case Op_ICMP8: case Op_ICMP16: case Op_ICMP32: case Op_ICMP64:
+			return 2;
+		case Op_JMP8: case Op_JE8: case Op_JNE8: case Op_JL8: case Op_JLE8: case Op_JG8: case Op_JGE8:
+			return 2;
+		case Op_JMP16: case Op_JE16: case Op_JNE16: case Op_JL16: case Op_JLE16: case Op_JG16: case Op_JGE16:
+			return 3;
+		case Op_JMP: case Op_JE: case Op_JNE: case Op_JL: case Op_JLE: case Op_JG: case Op_JGE:
+			return 5;
+		case Op_SPAWN:
+			return 6;
+		case Op_KLOAD8: case Op_KLOAD16: case Op_KLOAD32: case Op_KLOAD64:
+		case Op_KLOADX8: case Op_KLOADX16: case Op_KLOADX32: case Op_KLOADX64:
+			return 6;
+		case Op_JOIN:
+			return 2;
+		case Op_SEND:
+		case Op_RECV:
+			return 3;
+		case Op_HCALL:
+		case Op_NCALL:
+			return 5;
+		case Op_IO_CLOSE:
+			return 2;
+		case Op_IO_OPEN:
+			return 2;
+		case Op_IO_READ:
+		case Op_IO_WRITE:
+			return 3;
+		case Op_TRY_SEND:
+		case Op_TRY_RECV:
+		case Op_CAS8: case Op_CAS16: case Op_CAS32: case Op_CAS64:
+			return 3;
+		case Op_XCHG8: case Op_XCHG16: case Op_XCHG32: case Op_XCHG64:
+		case Op_FETCH_ADD8: case Op_FETCH_ADD16: case Op_FETCH_ADD32: case Op_FETCH_ADD64:
+		case Op_FETCH_OR8: case Op_FETCH_OR16: case Op_FETCH_OR32: case Op_FETCH_OR64:
+			return 2;
+		case Op_HALT:
+		case Op_IGL:
+		default:
+			return 1;
+		}
+	}
+
+	inline static bool
+	op_is_jump(Op op)
+	{
+		return (op >= Op_JMP && op <= Op_JGE) || (op >= Op_JMP8 && op <= Op_JGE16);
+	}
+
+	// returns the 32-bit form of the jump
+	inline static Op
+	op_jump_long(Op op)
+	{
+		if (op >= Op_JMP16)
+			return Op(Op_JMP + (op - Op_JMP16));
+		if (op >= Op_JMP8)
+			return Op(Op_JMP + (op - Op_JMP8));
+		return op;
+	}
+
+	// returns the form of the jump with an offset of the given size in bytes
+	inline static Op
+	op_jump_sized(Op op, uint64_t offset_size)
+	{
+		op = op_jump_long(op);
+		if (offset_size == 1)
+			return Op(Op_JMP8 + (op - Op_JMP));
+		if (offset_size == 2)
+			return Op(Op_JMP16 + (op - Op_JMP));
+		return op;
+	}
+
+	// returns whether the instruction ends with an offset to another instruction
+	inline static bool
+	op_has_target(Op op)
+	{
+		return op_is_jump(op) || op == Op_SPAWN;
+	}
+
+	// returns the size in bytes of the offset which ends the instruction
+	inline static uint64_t
+	op_target_size(Op op)
+	{
+		if (op >= Op_JMP8 && op <= Op_JGE8)
+			return 1;
+		if (op >= Op_JMP16 && op <= Op_JGE16)
+			return 2;
+		return 4;
+	}
+
+	// returns the index of the packed register pair in the instruction, or 0 if it has none
+	inline static uint64_t
+	op_reg_pair_index(Op op)
+	{
+		if (op >= Op_ADD8 && op <= Op_ICMP64)
+			return 1;
+		if (op >= Op_CAS8 && op <= Op_FETCH_OR64)
+			return 1;
+		if (op == Op_IO_OPEN || op == Op_IO_READ || op == Op_IO_WRITE)
+			return 1;
+		if (op >= Op_KLOADX8 && op <= Op_KLOADX64)
+			return 1;
+		if (op == Op_TRY_SEND || op == Op_TRY_RECV)
+			return 2;
+		return 0;
+	}
+
+	// returns the index of the lone register operand in the instruction, or 0 if it has none
+	inline static uint64_t
+	op_reg_index(Op op)
+	{
+		if (op >= Op_LOAD8 && op <= Op_LOAD64)
+			return 1;
+		if (op >= Op_KLOAD8 && op <= Op_KLOAD64)
+			return 1;
+		if (op == Op_SPAWN || op == Op_JOIN || op == Op_IO_CLOSE)
+			return 1;
+		if (op == Op_SEND || op == Op_RECV || op == Op_IO_READ || op == Op_IO_WRITE)
+			return 2;
+		if (op >= Op_CAS8 && op <= Op_CAS64)
+			return 2;
+		return 0;
+	}
+
+	// returns whether the opcode is one the core executes, the last opcode should be updated as
+	// opcodes are added
+	inline static bool
+	op_valid(Op op)
+	{
+		return op > Op_IGL && op <= Op_KLOADX64;
+	}
+
+	// returns whether the instruction ends a basic block, the next instruction if any is a block leader
+	inline static bool
+	op_is_block_end(Op op)
+	{
+		return (op_is_jump(op) ||
+				op == Op_HALT ||
+				op == Op_IGL ||
+				op == Op_SPAWN ||
+				op == Op_YIELD ||
+				op == Op_JOIN ||
+				op == Op_SEND ||
+				op == Op_RECV ||
+				op == Op_HCALL ||
+				op == Op_IO_OPEN ||
+				op == Op_IO_READ ||
+				op == Op_IO_WRITE ||
+				op == Op_IO_CLOSE);
+	}
+
+	// returns whether the instruction can rewind the IP to itself to be executed again later,
+	// such instructions start a basic block of their own
+	inline static bool
+	op_is_retried(Op op)
+	{
+		return op == Op_JOIN || op == Op_SEND || op == Op_RECV;
+	}
 }
\ No newline at end of file
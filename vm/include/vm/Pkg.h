@@ -1,16 +1,65 @@
 #pragma once
 
 #include "vm/Exports.h"
+#include "vm/File_Map.h"
+#include "vm/Code_Intern.h"
+#include "vm/Proc.h"
 
 #include <mn/Str.h>
 #include <mn/Buf.h>
 #include <mn/Map.h>
 
+#include <atomic>
+
 namespace vm
 {
+	// packages are saved as a header, a hash table directory of the procs, a table of procs and
+	// imports and their names, then the read only data and the procs bytecode each starting at a
+	// page aligned offset
+	// loading maps the file read only and reads nothing but the header and the imports, a proc
+	// lookup probes the directory in place and its bytecode points right into the mapped pages,
+	// so only the pages of the procs which are used are ever read, nothing is copied, and every
+	// process running the same package shares the same pages of the page cache, the same goes
+	// for the read only data
+	// every proc entry has the sha-256 of its body, procs with the same body share it in the file,
+	// and with a code intern attached they share it in memory too, across packages
+	// packages saved before the header existed are still loaded, by copying, and the procs of an
+	// older BYTECODE_VERSION are upgraded to the current one when they're loaded
+	constexpr uint32_t PKG_MAGIC = 0x474B5054; // "TPKG"
+	// 3: the header has the offset and size of the read only data
+	// 4: the proc entries have the sha-256 of their bodies
+	constexpr uint32_t PKG_VERSION = 4;
+	constexpr uint64_t PKG_PAGE_SIZE = 4096;
+	// compressed packages have their image split into blocks which are compressed on their own, the
+	// tables and data in one block and every body in another, they're all decompressed into one
+	// buffer when the package is loaded, on all the hardware threads if the package is big enough,
+	// and the package reads it like it would read its mapped file
+	constexpr uint32_t PKG_Z_MAGIC = 0x5A4B5054; // "TPKZ"
+	constexpr uint32_t PKG_Z_VERSION = 1;
+
 	struct Pkg
 	{
+		// procs added to the package, the procs of a loaded package are in its file
 		mn::Map<mn::Str, mn::Buf<uint8_t>> procs;
+		// names of the host functions the bytecode calls, ncall refers to them by index
+		mn::Buf<mn::Str> imports;
+		// constants and tables the bytecode reads with kload, the data of a loaded package is
+		// in its file until more data is added to it
+		mn::Buf<uint8_t> rodata;
+		// the package file the procs are mapped from
+		File_Map file;
+		// intern the bodies of the procs in the file are looked up in, if any
+		Code_Intern intern;
+		// decompressed image of a compressed package, the file is a view of it
+		mn::Buf<uint8_t> image;
+		// whether each proc in the file passed code_verify, it's 0 until the proc is looked up
+		// the first time, then 1 if it did and 2 if it didn't
+		std::atomic<uint8_t>* verified;
+		// interned body of each proc in the file, it's nullptr until the proc is looked up the
+		// first time with an intern attached, so later lookups don't take the intern's lock
+		std::atomic<const Code_Body*>* bodies;
+		// names of the added procs which didn't pass code_verify
+		mn::Buf<mn::Str> unverified;
 	};
 
 	VM_EXPORT Pkg
@@ -34,6 +83,31 @@ namespace vm
 		return pkg_proc_add(self, mn::str_from_c(name), bytes);
 	}
 
+	// attaches the code intern to the package, the handles of the procs in its file point to the
+	// interned bodies after that, the package doesn't own the intern
+	VM_EXPORT void
+	pkg_code_intern_attach(Pkg& self, Code_Intern intern);
+
+	// returns the index of the host function import with the given name, adding it if it's new
+	VM_EXPORT uint32_t
+	pkg_import(Pkg& self, const mn::Str& name);
+
+	inline static uint32_t
+	pkg_import(Pkg& self, const char* name)
+	{
+		return pkg_import(self, mn::str_lit(name));
+	}
+
+	// adds the block to the read only data and returns its offset which kload takes, the block
+	// starts at a multiple of the alignment, which is a power of 2, and if the same bytes are
+	// already there at such an offset they're reused instead
+	VM_EXPORT uint32_t
+	pkg_data_add(Pkg& self, const void* ptr, size_t size, size_t alignment);
+
+	// returns a view of the package's read only data
+	VM_EXPORT mn::Buf<uint8_t>
+	pkg_rodata(const Pkg& self);
+
 	VM_EXPORT void
 	pkg_save(const Pkg& self, const mn::Str& filename);
 
@@ -43,6 +117,17 @@ namespace vm
 		pkg_save(self, mn::str_lit(filename));
 	}
 
+	// saves the package compressed, it's smaller on disk but it's read and decompressed as a whole
+	// when it's loaded instead of being mapped, pkg_load loads both
+	VM_EXPORT void
+	pkg_save_compressed(const Pkg& self, const mn::Str& filename);
+
+	inline static void
+	pkg_save_compressed(const Pkg& self, const char* filename)
+	{
+		pkg_save_compressed(self, mn::str_lit(filename));
+	}
+
 	VM_EXPORT Pkg
 	pkg_load(const mn::Str& filename);
 
@@ -52,7 +137,61 @@ namespace vm
 		return pkg_load(mn::str_lit(filename));
 	}
 
-	// prepares the bytecode for vm execution
+	// loads the package from the bytes of a package file, like the ones tas embed writes, in
+	// place, nothing is copied unless it's compressed or of an older encoding, the bytes should
+	// outlive the package, packages from before the header existed aren't supported
+	VM_EXPORT Pkg
+	pkg_from_memory(const void* ptr, size_t size);
+
+	// returns the names of the package's procs, the added ones then the ones in its file
+	VM_EXPORT mn::Buf<mn::Str>
+	pkg_proc_names(const Pkg& self);
+
+	// handle to a proc's bytecode inside a package, it's valid as long as the package is alive
+	// and no procs or data are added to it
+	struct Proc_Handle
+	{
+		// view of the proc's bytecode, it's not owned by the handle so don't free it
+		mn::Buf<uint8_t> code;
+		// view of the package's read only data, the core should have it attached to run the proc
+		mn::Buf<uint8_t> rodata;
+		// basic blocks of the proc if it comes from a code intern, nullptr otherwise
+		const Blocks* blocks;
+		// whether the code passed code_verify, it's done once per proc, or once per body for the
+		// procs which come from a code intern
+		bool verified;
+	};
+
+	inline static bool
+	proc_handle_valid(const Proc_Handle& self)
+	{
+		return self.code.ptr != nullptr;
+	}
+
+	// returns the handle of the proc with the given name, or an invalid handle if there's no
+	// such proc, unlike pkg_load_proc it doesn't copy the bytecode
+	VM_EXPORT Proc_Handle
+	proc_handle_get(const Pkg& self, const mn::Str& name);
+
+	inline static Proc_Handle
+	proc_handle_get(const Pkg& self, const char* name)
+	{
+		return proc_handle_get(self, mn::str_lit(name));
+	}
+
+	// returns a new proc with the bytecode and the read only data of the proc with the given name,
+	// or nullptr if there's no such proc, it's copied once and shared by reference after that
+	VM_EXPORT Proc
+	pkg_proc_new(const Pkg& self, const mn::Str& name);
+
+	inline static Proc
+	pkg_proc_new(const Pkg& self, const char* name)
+	{
+		return pkg_proc_new(self, mn::str_lit(name));
+	}
+
+	// returns a copy of the proc's bytecode, every call copies it again, pkg_proc_new makes a proc
+	// which threads share instead
 	VM_EXPORT mn::Buf<uint8_t>
 	pkg_load_proc(const Pkg& self, const mn::Str& name);
 
@@ -61,4 +200,67 @@ namespace vm
 	{
 		return pkg_load_proc(self, mn::str_lit(name));
 	}
+
+	// bundle is a file of many packages which share their bodies, the packages' images are stored
+	// one after the other and then every distinct body once, however many procs of however many
+	// packages have it, the packages are loaded in place like a package file
+	constexpr uint32_t BUNDLE_MAGIC = 0x444E4254; // "TBND"
+	constexpr uint32_t BUNDLE_VERSION = 1;
+
+	struct Bundle
+	{
+		mn::Map<mn::Str, Pkg> pkgs;
+		// the bundle file the packages are mapped from
+		File_Map file;
+	};
+
+	VM_EXPORT Bundle
+	bundle_new();
+
+	VM_EXPORT void
+	bundle_free(Bundle& self);
+
+	inline static void
+	destruct(Bundle& self)
+	{
+		bundle_free(self);
+	}
+
+	// adds the package with the given name to the bundle, the bundle owns both after that
+	VM_EXPORT bool
+	bundle_pkg_add(Bundle& self, const mn::Str& name, const Pkg& pkg);
+
+	inline static bool
+	bundle_pkg_add(Bundle& self, const char* name, const Pkg& pkg)
+	{
+		return bundle_pkg_add(self, mn::str_from_c(name), pkg);
+	}
+
+	// returns the package with the given name or nullptr if there's no such package
+	VM_EXPORT Pkg*
+	bundle_pkg(Bundle& self, const mn::Str& name);
+
+	inline static Pkg*
+	bundle_pkg(Bundle& self, const char* name)
+	{
+		return bundle_pkg(self, mn::str_lit(name));
+	}
+
+	VM_EXPORT void
+	bundle_save(const Bundle& self, const mn::Str& filename);
+
+	inline static void
+	bundle_save(const Bundle& self, const char* filename)
+	{
+		bundle_save(self, mn::str_lit(filename));
+	}
+
+	VM_EXPORT Bundle
+	bundle_load(const mn::Str& filename);
+
+	inline static Bundle
+	bundle_load(const char* filename)
+	{
+		return bundle_load(mn::str_lit(filename));
+	}
 }
\ No newline at end of file
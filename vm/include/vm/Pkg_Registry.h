@@ -0,0 +1,62 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Pkg.h"
+
+namespace vm
+{
+	// pkg registry holds the current version of a package and swaps in new ones while the procs
+	// of the old ones are still running, a call pins the version it starts on, which takes a
+	// couple of atomics and no lock, and a swap never waits for the calls in flight
+	// it's epoch based reclamation, every swap bumps the epoch and retires the old version with
+	// it, a pin records the epoch it's taken in, and a retired version is freed once no pin from
+	// its epoch or before is left
+	typedef struct IPkg_Registry* Pkg_Registry;
+
+	// a pinned version of the package, the package and the proc handles got from it stay valid
+	// until the reference is released
+	struct Pkg_Ref
+	{
+		const Pkg* pkg;
+		// the pin the reference holds
+		size_t pin;
+	};
+
+	// creates a new registry with the package as its current version, the registry owns it after
+	// that, pins_count is the count of references which can be held at once, 0 means 4 for each
+	// hardware thread
+	VM_EXPORT Pkg_Registry
+	pkg_registry_new(const Pkg& pkg, size_t pins_count = 0);
+
+	// frees the registry and every version it holds, all the references should be released
+	VM_EXPORT void
+	pkg_registry_free(Pkg_Registry self);
+
+	inline static void
+	destruct(Pkg_Registry self)
+	{
+		pkg_registry_free(self);
+	}
+
+	// pins the current version, if all the pins are held it spins until one of them is released
+	VM_EXPORT Pkg_Ref
+	pkg_registry_acquire(Pkg_Registry self);
+
+	VM_EXPORT void
+	pkg_registry_release(Pkg_Registry self, const Pkg_Ref& ref);
+
+	// makes the package the current version and retires the old one, the registry owns the package
+	// after that, calls which acquire after the swap get it while the ones which pinned the old
+	// version finish on that
+	VM_EXPORT void
+	pkg_registry_swap(Pkg_Registry self, const Pkg& pkg);
+
+	// frees the retired versions which no one can be using anymore and returns their count, swaps
+	// do it too so it's only needed to free the old versions sooner
+	VM_EXPORT size_t
+	pkg_registry_reclaim(Pkg_Registry self);
+
+	// returns the count of retired versions which are not freed yet
+	VM_EXPORT size_t
+	pkg_registry_retired_count(Pkg_Registry self);
+}
\ No newline at end of file
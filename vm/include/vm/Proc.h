@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Blocks.h"
+
+#include <mn/Buf.h>
+
+namespace vm
+{
+	// proc is a compiled proc, its bytecode, the read only data it reads and its basic blocks,
+	// it's immutable and reference counted so every thread which runs it shares the same one
+	// instead of having its own copy
+	typedef struct IProc* Proc;
+
+	// creates a new proc with a reference count of 1, the code and data are copied in, and the
+	// blocks are built and the code is verified once
+	VM_EXPORT Proc
+	proc_new(const mn::Buf<uint8_t>& code, const mn::Buf<uint8_t>& rodata);
+
+	// adds a reference to the proc and returns it, it can be called from any thread
+	VM_EXPORT Proc
+	proc_ref(Proc self);
+
+	// drops a reference to the proc, the last one frees it
+	VM_EXPORT void
+	proc_unref(Proc self);
+
+	inline static void
+	destruct(Proc self)
+	{
+		proc_unref(self);
+	}
+
+	VM_EXPORT const mn::Buf<uint8_t>&
+	proc_code(Proc self);
+
+	VM_EXPORT const mn::Buf<uint8_t>&
+	proc_rodata(Proc self);
+
+	VM_EXPORT const Blocks&
+	proc_blocks(Proc self);
+
+	// returns whether the proc's code passed code_verify, verified procs run without checks
+	VM_EXPORT bool
+	proc_verified(Proc self);
+}
\ No newline at end of file
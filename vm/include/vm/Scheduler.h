@@ -0,0 +1,89 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Core.h"
+
+#include <mn/Buf.h>
+
+namespace vm
+{
+	// a job is a proc's code and the core which executes it, it's also the future
+	// you wait on to get the final core state back
+	typedef struct IJob* Job;
+
+	// scheduler is a pool of worker threads, each worker has its own chase-lev deque
+	// of runnable jobs and steals from other workers when it runs out of work, jobs which
+	// yield go to the back of the worker's queue, jobs which block on a channel are parked on it
+	// until it's sent to or received from, and jobs waiting on a host call are parked until
+	// they're resumed
+	typedef struct IScheduler* Scheduler;
+
+	// creates a new scheduler with the given workers count, 0 means use all the hardware threads
+	// slice is the instruction budget a metered job gets each time it's picked up by a worker
+	VM_EXPORT Scheduler
+	scheduler_new(size_t workers_count = 0, uint64_t slice = 100000);
+
+	// waits for all the submitted jobs then stops the worker threads
+	VM_EXPORT void
+	scheduler_free(Scheduler self);
+
+	inline static void
+	destruct(Scheduler self)
+	{
+		scheduler_free(self);
+	}
+
+	VM_EXPORT size_t
+	scheduler_workers_count(Scheduler self);
+
+	// submits the code to be executed on the given core, the code should outlive the job
+	// and the job takes ownership of the core
+	// the returned job should be freed with job_free, you can free it right away if you
+	// don't care about the result
+	VM_EXPORT Job
+	scheduler_submit(Scheduler self, const mn::Buf<uint8_t>& code, const Core& core);
+
+	// submits a metered job, it's time sliced using the code's basic blocks and the count of
+	// instructions it executes is tracked, both the code and blocks should outlive the job
+	VM_EXPORT Job
+	scheduler_submit(Scheduler self, const mn::Buf<uint8_t>& code, const Blocks& blocks, const Core& core);
+
+	// submits a metered job which runs the proc with its read only data, the job holds a reference
+	// to the proc until it's freed
+	VM_EXPORT Job
+	scheduler_submit(Scheduler self, Proc proc, const Core& core);
+
+	// waits until all the submitted jobs are done
+	VM_EXPORT void
+	scheduler_wait(Scheduler self);
+
+	VM_EXPORT bool
+	job_done(Job self);
+
+	// waits until the job is done and returns its core
+	VM_EXPORT const Core&
+	job_wait(Job self);
+
+	// returns the count of instructions executed by a metered job
+	VM_EXPORT uint64_t
+	job_ins_count(Job self);
+
+	// returns the job running on the calling worker thread or nullptr, host call handlers use it
+	// to know which job to resume once their pending call is done
+	VM_EXPORT Job
+	job_current();
+
+	// completes the pending host call of the job and puts it back into the scheduler, it can be
+	// called from any thread but only once per pending call
+	VM_EXPORT void
+	job_resume(Job self, Reg_Val result);
+
+	VM_EXPORT void
+	job_free(Job self);
+
+	inline static void
+	destruct(Job self)
+	{
+		job_free(self);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "vm/Exports.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace vm
+{
+	// sha-256 digest, it's what proc bodies are keyed by so byte identical bodies are stored once
+	struct Sha256
+	{
+		uint8_t bytes[32];
+	};
+
+	inline static bool
+	operator==(const Sha256& a, const Sha256& b)
+	{
+		return ::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+	}
+
+	inline static bool
+	operator!=(const Sha256& a, const Sha256& b)
+	{
+		return !(a == b);
+	}
+
+	// returns the first 8 bytes of the digest, they're as good a hash as any for tables
+	inline static uint64_t
+	sha256_prefix(const Sha256& self)
+	{
+		uint64_t res = 0;
+		::memcpy(&res, self.bytes, sizeof(res));
+		return res;
+	}
+
+	VM_EXPORT Sha256
+	sha256(const void* ptr, size_t size);
+}
\ No newline at end of file
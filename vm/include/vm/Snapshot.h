@@ -0,0 +1,41 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Core.h"
+
+#include <mn/Buf.h>
+
+namespace vm
+{
+	// snapshot is a versioned binary image of a core's execution state, which is its registers,
+	// compare flag, fibers and the content of its attached memory, it's laid out so that taking
+	// and restoring it is a handful of memcpy calls, so it's only portable between builds with
+	// the same snapshot version on machines with the same endianness
+	// host resources (channels, natives, read only data, host call handler, the memory region
+	// itself) are not part of the snapshot, the restoring host attaches its own
+	constexpr uint32_t SNAPSHOT_MAGIC = 0x504E5354; // "TSNP"
+	// 2: the instruction pointers are offsets into the bytecode of encoding 2
+	constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+	// writes the core's snapshot to the out buffer, the buffer is reused so taking snapshots
+	// repeatedly doesn't allocate, a core waiting on a pending host call or I/O request can't
+	// be snapshotted and the function returns false
+	VM_EXPORT bool
+	core_snapshot(const Core& self, mn::Buf<uint8_t>& out);
+
+	inline static mn::Buf<uint8_t>
+	core_snapshot(const Core& self)
+	{
+		auto out = mn::buf_new<uint8_t>();
+		core_snapshot(self, out);
+		return out;
+	}
+
+	// restores the snapshot into the core, the snapshot's memory is copied into the core's
+	// attached memory which should be at least as big as the snapshotted one, returns false
+	// if the snapshot is invalid, has a different version or doesn't fit, the restored IPs aren't
+	// checked against any code so the verified runs check them on entry and run the core with
+	// the checks if any of them isn't at the start of an instruction
+	VM_EXPORT bool
+	core_restore(Core& self, const mn::Buf<uint8_t>& snapshot);
+}
@@ -3,10 +3,14 @@
 #include <mn/Buf.h>
 
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 
 namespace vm
 {
+	// atomics written by different threads go on their own cache lines so they don't false share
+	constexpr size_t CACHE_LINE_SIZE = 64;
+
 	inline static uint8_t
 	pop8(const mn::Buf<uint8_t>& bytes, uint64_t& ix)
 	{
@@ -42,6 +46,19 @@ namespace vm
 		return r;
 	}
 
+	// reads a signed offset of the given size in bytes
+	inline static int64_t
+	pop_offset(const mn::Buf<uint8_t>& bytes, uint64_t& ix, uint64_t size)
+	{
+		switch(size)
+		{
+		case 1: return int8_t(pop8(bytes, ix));
+		case 2: return int16_t(pop16(bytes, ix));
+		case 4: return int32_t(pop32(bytes, ix));
+		default: return int64_t(pop64(bytes, ix));
+		}
+	}
+
 	inline static void
 	push8(mn::Buf<uint8_t>& bytes, uint8_t v)
 	{
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "vm/Exports.h"
+#include "vm/Op.h"
+#include "vm/Reg.h"
+
+#include <mn/Buf.h>
+
+#include <stdint.h>
+
+namespace vm
+{
+	// the verifier proves once per proc that its bytecode is well formed, every instruction
+	// decodes within the code, every register operand is a register, every jump and spawn lands
+	// at the start of an instruction, and the code doesn't run off its end, the core runs verified
+	// code without checking any of that again
+	enum VERIFY_ERR
+	{
+		VERIFY_OK,
+		// the instruction runs past the end of the code
+		VERIFY_ERR_TRUNCATED,
+		VERIFY_ERR_OPCODE,
+		VERIFY_ERR_REGISTER,
+		// the instruction reads or writes IP, it could jump anywhere so it can't be verified
+		VERIFY_ERR_IP_OPERAND,
+		// the jump or spawn doesn't land at the start of an instruction
+		VERIFY_ERR_TARGET,
+		// the last instruction isn't a halt or an unconditional jump so the code runs off its end
+		VERIFY_ERR_FALLTHROUGH
+	};
+
+	struct Verify_Result
+	{
+		VERIFY_ERR err;
+		// offset of the instruction which failed
+		uint64_t offset;
+	};
+
+	// checks that the instruction at the offset decodes within the code and that its registers are
+	// registers, it's what the core checks before every instruction of code which isn't verified
+	inline static VERIFY_ERR
+	ins_verify(const uint8_t* code, uint64_t count, uint64_t offset)
+	{
+		if (offset >= count)
+			return VERIFY_ERR_TRUNCATED;
+
+		auto op = Op(code[offset]);
+		if (op_valid(op) == false)
+			return VERIFY_ERR_OPCODE;
+		if (op_size(op) > count - offset)
+			return VERIFY_ERR_TRUNCATED;
+
+		if (auto index = op_reg_index(op))
+			if (code[offset + index] >= Reg_COUNT)
+				return VERIFY_ERR_REGISTER;
+
+		if (auto index = op_reg_pair_index(op))
+		{
+			uint8_t packed = code[offset + index];
+			if ((packed & 0xF) >= Reg_COUNT || (packed >> 4) >= Reg_COUNT)
+				return VERIFY_ERR_REGISTER;
+		}
+		return VERIFY_OK;
+	}
+
+	// verifies the whole code and returns the first failure
+	VM_EXPORT Verify_Result
+	code_verify(const mn::Buf<uint8_t>& code);
+
+	VM_EXPORT const char*
+	verify_err_str(VERIFY_ERR err);
+}
\ No newline at end of file
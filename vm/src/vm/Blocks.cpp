@@ -0,0 +1,83 @@
+#include "vm/Blocks.h"
+#include "vm/Op.h"
+#include "vm/Util.h"
+
+#include <string.h>
+
+namespace vm
+{
+	// API
+	Blocks
+	blocks_build(const mn::Buf<uint8_t>& code)
+	{
+		Blocks self{};
+		self.len = mn::buf_with_count<uint32_t>(code.count);
+		self.last = mn::buf_with_count<uint64_t>(code.count);
+		self.starts = mn::buf_with_count<uint64_t>((code.count + 63) / 64);
+		if (code.count == 0)
+			return self;
+		::memset(self.len.ptr, 0, self.len.count * sizeof(*self.len.ptr));
+		::memset(self.starts.ptr, 0, self.starts.count * sizeof(*self.starts.ptr));
+
+		// first pass: mark the block leaders, we use 1 as a marker here
+		self.len[0] = 1;
+		uint64_t ix = 0;
+		while (ix < code.count)
+		{
+			auto op = Op(code[ix]);
+			uint64_t next = ix + op_size(op);
+			if (next > code.count)
+				break;
+
+			if (op_is_retried(op))
+				self.len[ix] = 1;
+
+			if (op_has_target(op))
+			{
+				uint64_t offset_ix = next - op_target_size(op);
+				int64_t offset = pop_offset(code, offset_ix, op_target_size(op));
+				uint64_t target = next + offset;
+				if (target < code.count)
+					self.len[target] = 1;
+			}
+
+			if (op_is_block_end(op) && next < code.count)
+				self.len[next] = 1;
+
+			ix = next;
+		}
+
+		// second pass: count the instructions of each block
+		uint64_t leader = 0;
+		uint32_t count = 0;
+		ix = 0;
+		while (ix < code.count)
+		{
+			if (self.len[ix] != 0 && ix != leader)
+			{
+				self.len[leader] = count;
+				leader = ix;
+				count = 0;
+			}
+
+			self.last[leader] = ix;
+			self.starts[ix / 64] |= uint64_t(1) << (ix % 64);
+			++count;
+			uint64_t next = ix + op_size(Op(code[ix]));
+			if (next > code.count)
+				break;
+			ix = next;
+		}
+		self.len[leader] = count;
+
+		return self;
+	}
+
+	void
+	blocks_free(Blocks& self)
+	{
+		mn::buf_free(self.len);
+		mn::buf_free(self.last);
+		mn::buf_free(self.starts);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,261 @@
+#include "vm/Chan.h"
+#include "vm/Util.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace vm
+{
+	struct Cell
+	{
+		// the mpmc queue uses the sequence to tell whether the cell is ready for a producer or a consumer
+		std::atomic<size_t> seq;
+		uint64_t value;
+	};
+
+	struct IChan
+	{
+		CHAN_KIND kind;
+		size_t mask;
+		Cell* cells;
+
+		// producers and consumers live on different cache lines so they don't false share
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+
+		// waiters parked on the channel, the count is all the producers and consumers check so
+		// the lock is only taken when someone is parked
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> waiters_count;
+		std::mutex waiters_mtx;
+		Chan_Waiter* senders;
+		Chan_Waiter* receivers;
+	};
+
+	inline static size_t
+	next_pow2(size_t v)
+	{
+		size_t res = 1;
+		while (res < v)
+			res <<= 1;
+		return res;
+	}
+
+	// single producer single consumer, the producer is the only one writing the tail and
+	// the consumer is the only one writing the head
+	inline static bool
+	spsc_send(IChan* self, uint64_t value)
+	{
+		size_t tail = self->tail.load(std::memory_order_relaxed);
+		if (tail - self->head.load(std::memory_order_acquire) > self->mask)
+			return false;
+
+		self->cells[tail & self->mask].value = value;
+		self->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	inline static bool
+	spsc_recv(IChan* self, uint64_t& value)
+	{
+		size_t head = self->head.load(std::memory_order_relaxed);
+		if (head == self->tail.load(std::memory_order_acquire))
+			return false;
+
+		value = self->cells[head & self->mask].value;
+		self->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// multiple producers multiple consumers, it's dmitry vyukov's bounded mpmc queue
+	inline static bool
+	mpmc_send(IChan* self, uint64_t value)
+	{
+		size_t pos = self->tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = self->cells[pos & self->mask];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0)
+			{
+				if (self->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				// full
+				return false;
+			}
+			else
+			{
+				pos = self->tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	inline static bool
+	mpmc_recv(IChan* self, uint64_t& value)
+	{
+		size_t pos = self->head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = self->cells[pos & self->mask];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0)
+			{
+				if (self->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.seq.store(pos + self->mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				// empty
+				return false;
+			}
+			else
+			{
+				pos = self->head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// returns whether a send, or a receive, would succeed right now
+	inline static bool
+	chan_ready(IChan* self, bool send)
+	{
+		if (self->kind == CHAN_KIND_SPSC)
+		{
+			size_t tail = self->tail.load(std::memory_order_seq_cst);
+			size_t head = self->head.load(std::memory_order_seq_cst);
+			return send ? tail - head <= self->mask : head != tail;
+		}
+
+		if (send)
+		{
+			size_t pos = self->tail.load(std::memory_order_seq_cst);
+			return self->cells[pos & self->mask].seq.load(std::memory_order_seq_cst) == pos;
+		}
+		size_t pos = self->head.load(std::memory_order_seq_cst);
+		return self->cells[pos & self->mask].seq.load(std::memory_order_seq_cst) == pos + 1;
+	}
+
+	// wakes the waiters after a send or a receive went through, the fence pairs with the one in
+	// chan_park so either we see the waiter or it sees what we did
+	inline static void
+	chan_wake(IChan* self, bool sent)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (self->waiters_count.load(std::memory_order_relaxed) == 0)
+			return;
+
+		Chan_Waiter* waiters = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(self->waiters_mtx);
+			auto& list = sent ? self->receivers : self->senders;
+			waiters = list;
+			list = nullptr;
+			for (auto it = waiters; it != nullptr; it = it->next)
+				self->waiters_count.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// the waiter can be parked again as soon as it's woken so we read its next first
+		while (waiters != nullptr)
+		{
+			auto next = waiters->next;
+			waiters->wake(waiters->user);
+			waiters = next;
+		}
+	}
+
+	// API
+	Chan
+	chan_new(size_t capacity, CHAN_KIND kind)
+	{
+		if (capacity < 2)
+			capacity = 2;
+		capacity = next_pow2(capacity);
+
+		auto self = new IChan;
+		self->kind = kind;
+		self->mask = capacity - 1;
+		self->cells = new Cell[capacity];
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			self->cells[i].seq.store(i, std::memory_order_relaxed);
+			self->cells[i].value = 0;
+		}
+		self->tail.store(0, std::memory_order_relaxed);
+		self->head.store(0, std::memory_order_relaxed);
+		self->waiters_count.store(0, std::memory_order_relaxed);
+		self->senders = nullptr;
+		self->receivers = nullptr;
+		return self;
+	}
+
+	void
+	chan_free(Chan self)
+	{
+		delete[] self->cells;
+		delete self;
+	}
+
+	size_t
+	chan_capacity(Chan self)
+	{
+		return self->mask + 1;
+	}
+
+	bool
+	chan_try_send(Chan self, uint64_t value)
+	{
+		bool sent = self->kind == CHAN_KIND_SPSC ? spsc_send(self, value) : mpmc_send(self, value);
+		if (sent)
+			chan_wake(self, true);
+		return sent;
+	}
+
+	bool
+	chan_try_recv(Chan self, uint64_t& value)
+	{
+		bool received = self->kind == CHAN_KIND_SPSC ? spsc_recv(self, value) : mpmc_recv(self, value);
+		if (received)
+			chan_wake(self, false);
+		return received;
+	}
+
+	bool
+	chan_park(Chan self, Chan_Waiter* waiter, bool send)
+	{
+		{
+			std::lock_guard<std::mutex> lock(self->waiters_mtx);
+			auto& list = send ? self->senders : self->receivers;
+			waiter->next = list;
+			list = waiter;
+			self->waiters_count.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		// a send or a receive which went through before it saw us would leave us parked forever
+		// so we check again, and take the waiter back unless it was woken in the meantime
+		if (chan_ready(self, send) == false)
+			return true;
+
+		std::lock_guard<std::mutex> lock(self->waiters_mtx);
+		auto it = send ? &self->senders : &self->receivers;
+		while (*it != nullptr && *it != waiter)
+			it = &(*it)->next;
+		if (*it == nullptr)
+			return true;
+
+		*it = waiter->next;
+		self->waiters_count.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+}
\ No newline at end of file
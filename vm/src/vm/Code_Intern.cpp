@@ -0,0 +1,109 @@
+#include "vm/Code_Intern.h"
+#include "vm/Verify.h"
+
+#include <mn/Map.h>
+
+#include <mutex>
+
+namespace vm
+{
+	struct Interned_Body
+	{
+		Sha256 digest;
+		Code_Body body;
+		// next body whose digest starts with the same 8 bytes
+		Interned_Body* next;
+	};
+
+	struct ICode_Intern
+	{
+		std::mutex mtx;
+		// bodies by the prefix of their digest, the bodies are allocated one by one so the
+		// pointers we hand out stay put as the table grows
+		mn::Map<uint64_t, Interned_Body*> bodies;
+		size_t count;
+	};
+
+	inline static Interned_Body*
+	intern_find(Code_Intern self, uint64_t prefix, const Sha256& digest)
+	{
+		auto it = mn::map_lookup(self->bodies, prefix);
+		for (auto body = it ? it->value : nullptr; body != nullptr; body = body->next)
+			if (body->digest == digest)
+				return body;
+		return nullptr;
+	}
+
+	// API
+	Code_Intern
+	code_intern_new()
+	{
+		auto self = new ICode_Intern;
+		self->bodies = mn::map_new<uint64_t, Interned_Body*>();
+		self->count = 0;
+		return self;
+	}
+
+	void
+	code_intern_free(Code_Intern self)
+	{
+		for(auto it = mn::map_begin(self->bodies);
+			it != mn::map_end(self->bodies);
+			it = mn::map_next(self->bodies, it))
+		{
+			auto body = it->value;
+			while (body != nullptr)
+			{
+				auto next = body->next;
+				mn::buf_free(body->body.code);
+				blocks_free(body->body.blocks);
+				delete body;
+				body = next;
+			}
+		}
+		mn::map_free(self->bodies);
+		delete self;
+	}
+
+	const Code_Body*
+	code_intern_get(Code_Intern self, const Sha256& digest, const mn::Buf<uint8_t>& code)
+	{
+		auto prefix = sha256_prefix(digest);
+		{
+			std::lock_guard<std::mutex> lock(self->mtx);
+			if (auto body = intern_find(self, prefix, digest))
+				return &body->body;
+		}
+
+		// the digest comes from the package file, so the code is hashed before it's shared with
+		// every other package, it's done outside the lock since it reads the whole body
+		if ((sha256(code.ptr, code.count) == digest) == false)
+			return nullptr;
+
+		std::lock_guard<std::mutex> lock(self->mtx);
+		if (auto body = intern_find(self, prefix, digest))
+			return &body->body;
+
+		auto it = mn::map_lookup(self->bodies, prefix);
+		Interned_Body* head = it ? it->value : nullptr;
+		auto body = new Interned_Body;
+		body->digest = digest;
+		body->body.code = mn::buf_clone(code);
+		body->body.blocks = blocks_build(body->body.code);
+		body->body.verified = code_verify(body->body.code).err == VERIFY_OK;
+		body->next = head;
+		if (it)
+			it->value = body;
+		else
+			mn::map_insert(self->bodies, prefix, body);
+		++self->count;
+		return &body->body;
+	}
+
+	size_t
+	code_intern_count(Code_Intern self)
+	{
+		std::lock_guard<std::mutex> lock(self->mtx);
+		return self->count;
+	}
+}
\ No newline at end of file
@@ -1,6 +1,14 @@
 #include "vm/Core.h"
 #include "vm/Op.h"
 #include "vm/Util.h"
+#include "vm/Verify.h"
+
+#include <string.h>
+#include <atomic>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace vm
 {
@@ -24,9 +32,291 @@ namespace vm
 		return self.r[i];
 	}
 
+	struct Reg_Pair
+	{
+		Reg_Val& a;
+		Reg_Val& b;
+	};
+
+	// loads the two registers packed in a byte, a is the low nibble and b is the high nibble
+	inline static Reg_Pair
+	load_reg_pair(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		uint8_t packed = pop8(code, self.r[Reg_IP].u64);
+		Reg a = Reg(packed & 0xF);
+		Reg b = Reg(packed >> 4);
+		assert(a < Reg_COUNT && b < Reg_COUNT);
+		return Reg_Pair{self.r[a], self.r[b]};
+	}
+
+	inline static bool
+	fiber_runnable(const Core& self, const Core::Fiber& fiber)
+	{
+		if (fiber.state == Core::Fiber::STATE_READY)
+			return true;
+		if (fiber.state == Core::Fiber::STATE_JOIN)
+			return self.fibers[fiber.join].state == Core::Fiber::STATE_DONE;
+		return false;
+	}
+
+	// saves the running fiber and switches to the next runnable one, returns false if there's
+	// no runnable fiber left
+	inline static bool
+	fiber_switch(Core& self, bool others_only = false)
+	{
+		auto& current = self.fibers[self.fiber];
+		::memcpy(current.r, self.r, sizeof(self.r));
+		current.cmp = self.cmp;
+
+		size_t count = self.fibers.count;
+		for (size_t i = 1; i <= count; ++i)
+		{
+			size_t ix = (self.fiber + i) % count;
+			auto& next = self.fibers[ix];
+			if (fiber_runnable(self, next) == false)
+				continue;
+			if (others_only && ix == self.fiber)
+				continue;
+
+			next.state = Core::Fiber::STATE_READY;
+			if (ix != self.fiber)
+			{
+				::memcpy(self.r, next.r, sizeof(self.r));
+				self.cmp = next.cmp;
+				self.fiber = ix;
+			}
+			return true;
+		}
+		return false;
+	}
+
+	inline static Chan
+	load_chan(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		uint8_t i = pop8(code, self.r[Reg_IP].u64);
+		if (i >= self.chans.count)
+			return nullptr;
+		return self.chans[i];
+	}
+
+	// the instruction can't make progress on the channel, so we rewind the IP to execute it
+	// again later, and if there's another fiber which can run we switch to it instead of
+	// parking the whole core
+	inline static void
+	core_block(Core& self, Op op, Chan chan)
+	{
+		self.r[Reg_IP].u64 -= op_size(op);
+		if (self.fibers.count > 0 && fiber_switch(self, true))
+			return;
+		self.state = Core::STATE_BLOCK;
+		self.blocked_chan = chan;
+		self.blocked_send = op == Op_SEND;
+	}
+
+	inline static void
+	core_unpark(Core& self)
+	{
+		if (self.state == Core::STATE_YIELD || self.state == Core::STATE_BLOCK)
+			self.state = Core::STATE_OK;
+	}
+
+	// returns the memory at the address or nullptr if it's out of bounds or not naturally aligned
+	template<typename T>
+	inline static T*
+	load_mem(Core& self, const Reg_Val& addr)
+	{
+		if (self.mem_size < sizeof(T) || addr.u64 > self.mem_size - sizeof(T))
+			return nullptr;
+		if (addr.u64 % sizeof(T) != 0)
+			return nullptr;
+		return (T*)(self.mem + addr.u64);
+	}
+
+	// returns the memory buffer at the address or nullptr if it's out of bounds
+	inline static uint8_t*
+	load_buf(Core& self, const Reg_Val& addr, uint64_t size)
+	{
+		if (addr.u64 > self.mem_size || size > self.mem_size - addr.u64)
+			return nullptr;
+		return self.mem + addr.u64;
+	}
+
+	// returns the element at the index of the table at the offset of the read only data or
+	// nullptr if it's out of bounds
+	inline static const uint8_t*
+	load_rodata(Core& self, uint64_t offset, uint64_t index, uint64_t size)
+	{
+		if (offset > self.rodata_size || index >= (self.rodata_size - offset) / size)
+			return nullptr;
+		return self.rodata + offset + index * size;
+	}
+
+	// returns the null terminated string at the address or nullptr if it's out of bounds
+	inline static const char*
+	load_cstr(Core& self, const Reg_Val& addr)
+	{
+		if (addr.u64 >= self.mem_size)
+			return nullptr;
+		auto ptr = self.mem + addr.u64;
+		if (::memchr(ptr, 0, size_t(self.mem_size - addr.u64)) == nullptr)
+			return nullptr;
+		return (const char*)ptr;
+	}
+
+	inline static void
+	core_io_done(void* user, int64_t result)
+	{
+		Reg_Val res{};
+		res.i64 = result;
+		core_resume(*(Core*)user, res);
+	}
+
+	// atomic helpers, all of them are sequentially consistent and return the old value
+#if defined(_MSC_VER)
+	inline static uint8_t atomic_cas(uint8_t* p, uint8_t e, uint8_t d) { return uint8_t(_InterlockedCompareExchange8((volatile char*)p, char(d), char(e))); }
+	inline static uint16_t atomic_cas(uint16_t* p, uint16_t e, uint16_t d) { return uint16_t(_InterlockedCompareExchange16((volatile short*)p, short(d), short(e))); }
+	inline static uint32_t atomic_cas(uint32_t* p, uint32_t e, uint32_t d) { return uint32_t(_InterlockedCompareExchange((volatile long*)p, long(d), long(e))); }
+	inline static uint64_t atomic_cas(uint64_t* p, uint64_t e, uint64_t d) { return uint64_t(_InterlockedCompareExchange64((volatile __int64*)p, __int64(d), __int64(e))); }
+
+	inline static uint8_t atomic_xchg(uint8_t* p, uint8_t v) { return uint8_t(_InterlockedExchange8((volatile char*)p, char(v))); }
+	inline static uint16_t atomic_xchg(uint16_t* p, uint16_t v) { return uint16_t(_InterlockedExchange16((volatile short*)p, short(v))); }
+	inline static uint32_t atomic_xchg(uint32_t* p, uint32_t v) { return uint32_t(_InterlockedExchange((volatile long*)p, long(v))); }
+	inline static uint64_t atomic_xchg(uint64_t* p, uint64_t v) { return uint64_t(_InterlockedExchange64((volatile __int64*)p, __int64(v))); }
+
+	inline static uint8_t atomic_fetch_add(uint8_t* p, uint8_t v) { return uint8_t(_InterlockedExchangeAdd8((volatile char*)p, char(v))); }
+	inline static uint16_t atomic_fetch_add(uint16_t* p, uint16_t v) { return uint16_t(_InterlockedExchangeAdd16((volatile short*)p, short(v))); }
+	inline static uint32_t atomic_fetch_add(uint32_t* p, uint32_t v) { return uint32_t(_InterlockedExchangeAdd((volatile long*)p, long(v))); }
+	inline static uint64_t atomic_fetch_add(uint64_t* p, uint64_t v) { return uint64_t(_InterlockedExchangeAdd64((volatile __int64*)p, __int64(v))); }
+
+	inline static uint8_t atomic_fetch_or(uint8_t* p, uint8_t v) { return uint8_t(_InterlockedOr8((volatile char*)p, char(v))); }
+	inline static uint16_t atomic_fetch_or(uint16_t* p, uint16_t v) { return uint16_t(_InterlockedOr16((volatile short*)p, short(v))); }
+	inline static uint32_t atomic_fetch_or(uint32_t* p, uint32_t v) { return uint32_t(_InterlockedOr((volatile long*)p, long(v))); }
+	inline static uint64_t atomic_fetch_or(uint64_t* p, uint64_t v) { return uint64_t(_InterlockedOr64((volatile __int64*)p, __int64(v))); }
+#else
+	template<typename T>
+	inline static T
+	atomic_cas(T* ptr, T expected, T desired)
+	{
+		__atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		return expected;
+	}
+
+	template<typename T>
+	inline static T
+	atomic_xchg(T* ptr, T value)
+	{
+		return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+	}
+
+	template<typename T>
+	inline static T
+	atomic_fetch_add(T* ptr, T value)
+	{
+		return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+	}
+
+	template<typename T>
+	inline static T
+	atomic_fetch_or(T* ptr, T value)
+	{
+		return __atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST);
+	}
+#endif
+
 	// API
 	void
-	core_ins_execute(Core& self, const mn::Buf<uint8_t>& code)
+	core_free(Core& self)
+	{
+		mn::buf_free(self.fibers);
+		mn::buf_free(self.chans);
+		if (self.mem_owned)
+			mem_free(self.mem_region);
+	}
+
+	Core
+	core_fork(const Core& parent)
+	{
+		assert(parent.state != Core::STATE_PENDING);
+
+		Core self = parent;
+		self.fibers = mn::buf_clone(parent.fibers);
+		self.chans = mn::buf_clone(parent.chans);
+		if (parent.mem_region)
+		{
+			self.mem_region = mem_fork(parent.mem_region);
+			self.mem_owned = true;
+			self.mem = mem_ptr(self.mem_region);
+		}
+		return self;
+	}
+
+	uint8_t
+	core_chan_attach(Core& self, Chan chan)
+	{
+		assert(self.chans.count < 256);
+		mn::buf_push(self.chans, chan);
+		return uint8_t(self.chans.count - 1);
+	}
+
+	void
+	core_mem_attach(Core& self, void* ptr, uint64_t size)
+	{
+		self.mem = (uint8_t*)ptr;
+		self.mem_size = size;
+		self.mem_region = nullptr;
+		self.mem_owned = false;
+	}
+
+	void
+	core_mem_attach(Core& self, Mem mem)
+	{
+		self.mem = mem_ptr(mem);
+		self.mem_size = mem_size(mem);
+		self.mem_region = mem;
+		self.mem_owned = false;
+	}
+
+	void
+	core_host_call_set(Core& self, Host_Call_Fn fn, void* user)
+	{
+		self.host_call = fn;
+		self.host_call_user = user;
+	}
+
+	void
+	core_resume(Core& self, Reg_Val result)
+	{
+		assert(self.state == Core::STATE_PENDING);
+		self.r[Reg_R0] = result;
+		self.state = Core::STATE_OK;
+		self.io.op = IO_OP_NONE;
+	}
+
+	void
+	core_natives_attach(Core& self, const mn::Buf<Host_Fn>& table)
+	{
+		self.natives = table.ptr;
+		self.natives_count = table.count;
+	}
+
+	void
+	core_rodata_attach(Core& self, const mn::Buf<uint8_t>& rodata)
+	{
+		self.rodata = rodata.ptr;
+		self.rodata_size = rodata.count;
+	}
+
+	void
+	core_io_submit(Core& self, Io io)
+	{
+		assert(self.state == Core::STATE_PENDING && self.io.op != IO_OP_NONE);
+		io_submit(io, self.io, core_io_done, &self);
+	}
+
+	// executes the instruction without checking it decodes, the code should be verified or the
+	// instruction checked already
+	inline static void
+	ins_execute(Core& self, const mn::Buf<uint8_t>& code)
 	{
 		auto op = pop_op(self, code);
 		switch(op)
@@ -57,176 +347,151 @@ namespace vm
 		}
 		case Op_ADD8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u8 += src.u8;
 			break;
 		}
 		case Op_ADD16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u16 += src.u16;
 			break;
 		}
 		case Op_ADD32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u32 += src.u32;
 			break;
 		}
 		case Op_ADD64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u64 += src.u64;
 			break;
 		}
 		case Op_SUB8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u8 -= src.u8;
 			break;
 		}
 		case Op_SUB16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u16 -= src.u16;
 			break;
 		}
 		case Op_SUB32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u32 -= src.u32;
 			break;
 		}
 		case Op_SUB64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u64 -= src.u64;
 			break;
 		}
 		case Op_MUL8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u8 *= src.u8;
 			break;
 		}
 		case Op_MUL16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u16 *= src.u16;
 			break;
 		}
 		case Op_MUL32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u32 *= src.u32;
 			break;
 		}
 		case Op_MUL64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u64 *= src.u64;
 			break;
 		}
 		case Op_IMUL8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i8 *= src.i8;
 			break;
 		}
 		case Op_IMUL16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i16 *= src.i16;
 			break;
 		}
 		case Op_IMUL32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i32 *= src.i32;
 			break;
 		}
 		case Op_IMUL64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i64 *= src.i64;
 			break;
 		}
 		case Op_DIV8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u8 /= src.u8;
 			break;
 		}
 		case Op_DIV16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u16 /= src.u16;
 			break;
 		}
 		case Op_DIV32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u32 /= src.u32;
 			break;
 		}
 		case Op_DIV64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.u64 /= src.u64;
 			break;
 		}
 		case Op_IDIV8:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i8 /= src.i8;
 			break;
 		}
 		case Op_IDIV16:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i16 /= src.i16;
 			break;
 		}
 		case Op_IDIV32:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i32 /= src.i32;
 			break;
 		}
 		case Op_IDIV64:
 		{
-			auto& dst = load_reg(self, code);
-			auto& src = load_reg(self, code);
+			auto [dst, src] = load_reg_pair(self, code);
 			dst.i64 /= src.i64;
 			break;
 		}
 		case Op_CMP8:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.u8 > op2.u8)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.u8 < op2.u8)
@@ -237,8 +502,7 @@ namespace vm
 		}
 		case Op_CMP16:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.u16 > op2.u16)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.u16 < op2.u16)
@@ -249,8 +513,7 @@ namespace vm
 		}
 		case Op_CMP32:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.u32 > op2.u32)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.u32 < op2.u32)
@@ -261,8 +524,7 @@ namespace vm
 		}
 		case Op_CMP64:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.u64 > op2.u64)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.u64 < op2.u64)
@@ -273,8 +535,7 @@ namespace vm
 		}
 		case Op_ICMP8:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.i8 > op2.i8)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.i8 < op2.i8)
@@ -285,8 +546,7 @@ namespace vm
 		}
 		case Op_ICMP16:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.i16 > op2.i16)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.i16 < op2.i16)
@@ -297,8 +557,7 @@ namespace vm
 		}
 		case Op_ICMP32:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.i32 > op2.i32)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.i32 < op2.i32)
@@ -309,8 +568,7 @@ namespace vm
 		}
 		case Op_ICMP64:
 		{
-			auto& op1 = load_reg(self, code);
-			auto& op2 = load_reg(self, code);
+			auto [op1, op2] = load_reg_pair(self, code);
 			if (op1.i64 > op2.i64)
 				self.cmp = Core::CMP_GREATER;
 			else if (op1.i64 < op2.i64)
@@ -319,60 +577,74 @@ namespace vm
 				self.cmp = Core::CMP_EQUAL;
 			break;
 		}
+		case Op_JMP8:
+		case Op_JMP16:
 		case Op_JMP:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			self.r[Reg_IP].u64 += offset;
 			break;
 		}
+		case Op_JE8:
+		case Op_JE16:
 		case Op_JE:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp == Core::CMP_EQUAL)
 			{
 				self.r[Reg_IP].u64 += offset;
 			}
 			break;
 		}
+		case Op_JNE8:
+		case Op_JNE16:
 		case Op_JNE:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp != Core::CMP_EQUAL)
 			{
 				self.r[Reg_IP].u64 += offset;
 			}
 			break;
 		}
+		case Op_JL8:
+		case Op_JL16:
 		case Op_JL:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp == Core::CMP_LESS)
 			{
 				self.r[Reg_IP].u64 += offset;
 			}
 			break;
 		}
+		case Op_JLE8:
+		case Op_JLE16:
 		case Op_JLE:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp == Core::CMP_LESS || self.cmp == Core::CMP_EQUAL)
 			{
 				self.r[Reg_IP].u64 += offset;
 			}
 			break;
 		}
+		case Op_JG8:
+		case Op_JG16:
 		case Op_JG:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp == Core::CMP_GREATER)
 			{
 				self.r[Reg_IP].u64 += offset;
 			}
 			break;
 		}
+		case Op_JGE8:
+		case Op_JGE16:
 		case Op_JGE:
 		{
-			int64_t offset = int64_t(pop64(code, self.r[Reg_IP].u64));
+			int64_t offset = pop_offset(code, self.r[Reg_IP].u64, op_target_size(op));
 			if (self.cmp == Core::CMP_GREATER || self.cmp == Core::CMP_EQUAL)
 			{
 				self.r[Reg_IP].u64 += offset;
@@ -380,12 +652,694 @@ namespace vm
 			break;
 		}
 		case Op_HALT:
-			self.state = Core::STATE_HALT;
+		{
+			// the core halts when its root fiber halts
+			if (self.fibers.count == 0 || self.fiber == 0)
+			{
+				self.state = Core::STATE_HALT;
+				break;
+			}
+
+			self.fibers[self.fiber].state = Core::Fiber::STATE_DONE;
+			if (fiber_switch(self) == false)
+				self.state = Core::STATE_ERR;
+			break;
+		}
+		case Op_SPAWN:
+		{
+			auto& dst = load_reg(self, code);
+			int64_t offset = int32_t(pop32(code, self.r[Reg_IP].u64));
+
+			// first spawn, so the running code becomes the root fiber
+			if (self.fibers.count == 0)
+			{
+				Core::Fiber root{};
+				mn::buf_push(self.fibers, root);
+				self.fiber = 0;
+			}
+
+			Core::Fiber fiber{};
+			fiber.state = Core::Fiber::STATE_READY;
+			fiber.cmp = self.cmp;
+			::memcpy(fiber.r, self.r, sizeof(self.r));
+			fiber.r[Reg_IP].u64 += offset;
+			mn::buf_push(self.fibers, fiber);
+
+			dst.u64 = self.fibers.count - 1;
+			break;
+		}
+		case Op_YIELD:
+		{
+			if (self.fibers.count > 0)
+				fiber_switch(self);
+			break;
+		}
+		case Op_JOIN:
+		{
+			auto& op1 = load_reg(self, code);
+			uint64_t id = op1.u64;
+			if (id >= self.fibers.count || id == self.fiber)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			if (self.fibers[id].state == Core::Fiber::STATE_DONE)
+			{
+				op1 = self.fibers[id].r[Reg_R0];
+				break;
+			}
+
+			// rewind to the join instruction so we execute it again once the fiber is done
+			self.r[Reg_IP].u64 -= op_size(Op_JOIN);
+			auto& current = self.fibers[self.fiber];
+			current.state = Core::Fiber::STATE_JOIN;
+			current.join = id;
+			// every fiber is waiting on another, that's a deadlock
+			if (fiber_switch(self) == false)
+				self.state = Core::STATE_ERR;
+			break;
+		}
+		case Op_SEND:
+		{
+			auto chan = load_chan(self, code);
+			auto& op1 = load_reg(self, code);
+			if (chan == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			if (chan_try_send(chan, op1.u64) == false)
+				core_block(self, op, chan);
+			break;
+		}
+		case Op_RECV:
+		{
+			auto chan = load_chan(self, code);
+			auto& dst = load_reg(self, code);
+			if (chan == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			if (chan_try_recv(chan, dst.u64) == false)
+				core_block(self, op, chan);
+			break;
+		}
+		case Op_TRY_SEND:
+		{
+			auto chan = load_chan(self, code);
+			auto [op1, ok] = load_reg_pair(self, code);
+			if (chan == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			ok.u64 = chan_try_send(chan, op1.u64) ? 1 : 0;
+			break;
+		}
+		case Op_TRY_RECV:
+		{
+			auto chan = load_chan(self, code);
+			auto [dst, ok] = load_reg_pair(self, code);
+			if (chan == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			// don't clobber the destination if there's nothing to receive
+			uint64_t value = 0;
+			if (chan_try_recv(chan, value))
+			{
+				dst.u64 = value;
+				ok.u64 = 1;
+			}
+			else
+			{
+				ok.u64 = 0;
+			}
+			break;
+		}
+		case Op_CAS8:
+		{
+			auto [addr, expected] = load_reg_pair(self, code);
+			auto& desired = load_reg(self, code);
+			auto ptr = load_mem<uint8_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			expected.u8 = atomic_cas(ptr, expected.u8, desired.u8);
+			break;
+		}
+		case Op_CAS16:
+		{
+			auto [addr, expected] = load_reg_pair(self, code);
+			auto& desired = load_reg(self, code);
+			auto ptr = load_mem<uint16_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			expected.u16 = atomic_cas(ptr, expected.u16, desired.u16);
+			break;
+		}
+		case Op_CAS32:
+		{
+			auto [addr, expected] = load_reg_pair(self, code);
+			auto& desired = load_reg(self, code);
+			auto ptr = load_mem<uint32_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			expected.u32 = atomic_cas(ptr, expected.u32, desired.u32);
+			break;
+		}
+		case Op_CAS64:
+		{
+			auto [addr, expected] = load_reg_pair(self, code);
+			auto& desired = load_reg(self, code);
+			auto ptr = load_mem<uint64_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			expected.u64 = atomic_cas(ptr, expected.u64, desired.u64);
+			break;
+		}
+		case Op_XCHG8:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint8_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u8 = atomic_xchg(ptr, op1.u8);
+			break;
+		}
+		case Op_XCHG16:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint16_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u16 = atomic_xchg(ptr, op1.u16);
+			break;
+		}
+		case Op_XCHG32:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint32_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u32 = atomic_xchg(ptr, op1.u32);
+			break;
+		}
+		case Op_XCHG64:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint64_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u64 = atomic_xchg(ptr, op1.u64);
+			break;
+		}
+		case Op_FETCH_ADD8:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint8_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u8 = atomic_fetch_add(ptr, op1.u8);
+			break;
+		}
+		case Op_FETCH_ADD16:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint16_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u16 = atomic_fetch_add(ptr, op1.u16);
+			break;
+		}
+		case Op_FETCH_ADD32:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint32_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u32 = atomic_fetch_add(ptr, op1.u32);
+			break;
+		}
+		case Op_FETCH_ADD64:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint64_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u64 = atomic_fetch_add(ptr, op1.u64);
+			break;
+		}
+		case Op_FETCH_OR8:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint8_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u8 = atomic_fetch_or(ptr, op1.u8);
+			break;
+		}
+		case Op_FETCH_OR16:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint16_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u16 = atomic_fetch_or(ptr, op1.u16);
+			break;
+		}
+		case Op_FETCH_OR32:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint32_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u32 = atomic_fetch_or(ptr, op1.u32);
+			break;
+		}
+		case Op_FETCH_OR64:
+		{
+			auto [addr, op1] = load_reg_pair(self, code);
+			auto ptr = load_mem<uint64_t>(self, addr);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			op1.u64 = atomic_fetch_or(ptr, op1.u64);
+			break;
+		}
+		case Op_FENCE:
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			break;
+		case Op_HCALL:
+		{
+			uint32_t id = pop32(code, self.r[Reg_IP].u64);
+			if (self.host_call == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+
+			// the whole core is suspended even if it has other fibers, since the result goes
+			// to the calling fiber's R0
+			if (self.host_call(self, id, self.host_call_user) == HOST_CALL_PENDING)
+				self.state = Core::STATE_PENDING;
+			break;
+		}
+		case Op_NCALL:
+		{
+			uint32_t index = pop32(code, self.r[Reg_IP].u64);
+			if (index >= self.natives_count || self.natives[index] == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			// natives can't move the IP, the interpreter relies on it staying on instruction starts
+			uint64_t ip = self.r[Reg_IP].u64;
+			self.natives[index](self);
+			self.r[Reg_IP].u64 = ip;
+			break;
+		}
+		case Op_IO_OPEN:
+		{
+			auto [path, flags] = load_reg_pair(self, code);
+			auto ptr = load_cstr(self, path);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			self.io = Io_Req{};
+			self.io.op = IO_OP_OPEN;
+			self.io.ptr = (void*)ptr;
+			self.io.flags = flags.u64;
+			self.state = Core::STATE_PENDING;
+			break;
+		}
+		case Op_IO_READ:
+		case Op_IO_WRITE:
+		{
+			auto [fd, addr] = load_reg_pair(self, code);
+			auto& size = load_reg(self, code);
+			auto ptr = load_buf(self, addr, size.u64);
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			self.io = Io_Req{};
+			self.io.op = op == Op_IO_READ ? IO_OP_READ : IO_OP_WRITE;
+			self.io.fd = fd.i64;
+			self.io.ptr = ptr;
+			self.io.size = size.u64;
+			self.state = Core::STATE_PENDING;
+			break;
+		}
+		case Op_IO_CLOSE:
+		{
+			auto& fd = load_reg(self, code);
+			self.io = Io_Req{};
+			self.io.op = IO_OP_CLOSE;
+			self.io.fd = fd.i64;
+			self.state = Core::STATE_PENDING;
+			break;
+		}
+		case Op_KLOAD8:
+		{
+			auto& dst = load_reg(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), 0, sizeof(dst.u8));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u8, ptr, sizeof(dst.u8));
+			break;
+		}
+		case Op_KLOAD16:
+		{
+			auto& dst = load_reg(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), 0, sizeof(dst.u16));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u16, ptr, sizeof(dst.u16));
+			break;
+		}
+		case Op_KLOAD32:
+		{
+			auto& dst = load_reg(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), 0, sizeof(dst.u32));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u32, ptr, sizeof(dst.u32));
+			break;
+		}
+		case Op_KLOAD64:
+		{
+			auto& dst = load_reg(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), 0, sizeof(dst.u64));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u64, ptr, sizeof(dst.u64));
 			break;
+		}
+		case Op_KLOADX8:
+		{
+			auto [dst, index] = load_reg_pair(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), index.u64, sizeof(dst.u8));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u8, ptr, sizeof(dst.u8));
+			break;
+		}
+		case Op_KLOADX16:
+		{
+			auto [dst, index] = load_reg_pair(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), index.u64, sizeof(dst.u16));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u16, ptr, sizeof(dst.u16));
+			break;
+		}
+		case Op_KLOADX32:
+		{
+			auto [dst, index] = load_reg_pair(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), index.u64, sizeof(dst.u32));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u32, ptr, sizeof(dst.u32));
+			break;
+		}
+		case Op_KLOADX64:
+		{
+			auto [dst, index] = load_reg_pair(self, code);
+			auto ptr = load_rodata(self, pop32(code, self.r[Reg_IP].u64), index.u64, sizeof(dst.u64));
+			if (ptr == nullptr)
+			{
+				self.state = Core::STATE_ERR;
+				break;
+			}
+			::memcpy(&dst.u64, ptr, sizeof(dst.u64));
+			break;
+		}
 		case Op_IGL:
 		default:
 			self.state = Core::STATE_ERR;
 			break;
 		}
 	}
+
+	// code which isn't verified has every instruction checked before it's executed, a malformed
+	// one stops the core with STATE_ERR
+	template<bool VERIFIED>
+	inline static void
+	ins_step(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		if constexpr (VERIFIED == false)
+		{
+			if (ins_verify(code.ptr, code.count, self.r[Reg_IP].u64) != VERIFY_OK)
+			{
+				self.state = Core::STATE_ERR;
+				return;
+			}
+		}
+		ins_execute(self, code);
+	}
+
+	// returns whether an instruction of the verified code starts at the offset, without blocks
+	// the code is decoded up to it
+	inline static bool
+	ins_is_start(const mn::Buf<uint8_t>& code, const Blocks* blocks, uint64_t offset)
+	{
+		if (offset >= code.count)
+			return false;
+		if (blocks != nullptr)
+			return blocks_is_start(*blocks, offset);
+
+		uint64_t ix = 0;
+		while (ix < offset)
+			ix += op_size(Op(code[ix]));
+		return ix == offset;
+	}
+
+	// the IPs of the core and its fibers come from whoever set up the core (a snapshot, the host
+	// or a native) so they're checked before the verified code runs unchecked, the jumps inside the
+	// code are verified already so they can't leave the instruction starts
+	inline static bool
+	core_ips_valid(const Core& self, const mn::Buf<uint8_t>& code, const Blocks* blocks)
+	{
+		if (ins_is_start(code, blocks, self.r[Reg_IP].u64) == false)
+			return false;
+		for (size_t i = 0; i < self.fibers.count; ++i)
+		{
+			const auto& fiber = self.fibers[i];
+			if (i != self.fiber && fiber.state != Core::Fiber::STATE_DONE &&
+				ins_is_start(code, blocks, fiber.r[Reg_IP].u64) == false)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<bool VERIFIED>
+	inline static Core::STATE
+	run(Core& self, const mn::Buf<uint8_t>& code, const Blocks* blocks)
+	{
+		core_unpark(self);
+		// a core which doesn't start at an instruction of the verified code runs with the checks
+		if (VERIFIED && self.state == Core::STATE_OK && core_ips_valid(self, code, blocks) == false)
+			return run<false>(self, code, blocks);
+		while (self.state == Core::STATE_OK)
+			ins_step<VERIFIED>(self, code);
+		return self.state;
+	}
+
+	// returns the count of instructions after the one at the offset up to the last one of its block
+	inline static uint64_t
+	block_rest(const mn::Buf<uint8_t>& code, uint64_t offset, uint64_t last)
+	{
+		uint64_t count = 0;
+		while (offset < last)
+		{
+			offset += op_size(Op(code[offset]));
+			++count;
+		}
+		return count;
+	}
+
+	template<bool VERIFIED>
+	inline static Core::STATE
+	run_for(Core& self, const mn::Buf<uint8_t>& code, const Blocks& blocks, uint64_t& budget)
+	{
+		assert(blocks.len.count == code.count && blocks.last.count == code.count);
+		core_unpark(self);
+		if (VERIFIED && self.state == Core::STATE_OK && core_ips_valid(self, code, &blocks) == false)
+			return run_for<false>(self, code, blocks, budget);
+		while (self.state == Core::STATE_OK)
+		{
+			uint64_t ip = self.r[Reg_IP].u64;
+			uint64_t cost = ip < blocks.len.count ? blocks.len[ip] : 0;
+
+			if (cost != 0 && cost <= budget)
+			{
+				// the whole block is paid for up front and run without counting, only its last
+				// instruction can leave it so we run up to it and then execute it
+				budget -= cost;
+				uint64_t last = blocks.last[ip];
+				while (ip < last)
+				{
+					ins_step<VERIFIED>(self, code);
+					if (self.state != Core::STATE_OK)
+						break;
+					ip = self.r[Reg_IP].u64;
+				}
+
+				if (self.state == Core::STATE_OK)
+					ins_step<VERIFIED>(self, code);
+				else
+					// the core stopped in the middle of the block, give back what we didn't execute
+					budget += block_rest(code, ip, last);
+				continue;
+			}
+
+			// we're not at a block leader (we yielded in the middle of a block or someone moved
+			// the IP) or there's not enough budget for the whole block, so we go one instruction
+			// at a time until we reach one
+			if (budget == 0)
+			{
+				self.state = Core::STATE_YIELD;
+				break;
+			}
+
+			--budget;
+			ins_step<VERIFIED>(self, code);
+		}
+		return self.state;
+	}
+
+	void
+	core_ins_execute(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		ins_step<false>(self, code);
+	}
+
+	Core::STATE
+	core_run(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		return run<false>(self, code, nullptr);
+	}
+
+	Core::STATE
+	core_run_for(Core& self, const mn::Buf<uint8_t>& code, const Blocks& blocks, uint64_t& budget)
+	{
+		return run_for<false>(self, code, blocks, budget);
+	}
+
+	Core::STATE
+	core_run_verified(Core& self, const mn::Buf<uint8_t>& code)
+	{
+		return run<true>(self, code, nullptr);
+	}
+
+	Core::STATE
+	core_run_for_verified(Core& self, const mn::Buf<uint8_t>& code, const Blocks& blocks, uint64_t& budget)
+	{
+		return run_for<true>(self, code, blocks, budget);
+	}
+
+	void
+	core_ins_execute(Core& self, Proc proc)
+	{
+		if (proc_verified(proc))
+			ins_step<true>(self, proc_code(proc));
+		else
+			ins_step<false>(self, proc_code(proc));
+	}
+
+	Core::STATE
+	core_run(Core& self, Proc proc)
+	{
+		if (proc_verified(proc))
+			return run<true>(self, proc_code(proc), &proc_blocks(proc));
+		return run<false>(self, proc_code(proc), &proc_blocks(proc));
+	}
+
+	Core::STATE
+	core_run_for(Core& self, Proc proc, uint64_t& budget)
+	{
+		if (proc_verified(proc))
+			return run_for<true>(self, proc_code(proc), proc_blocks(proc), budget);
+		return run_for<false>(self, proc_code(proc), proc_blocks(proc), budget);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "vm/Core_Pool.h"
+#include "vm/Util.h"
+
+#include <mn/Buf.h>
+
+#include <mutex>
+#include <new>
+
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace vm
+{
+	constexpr size_t MAX_NODES = 64;
+
+	// the slot is padded to whole cache lines so no two cores share one
+	struct alignas(CACHE_LINE_SIZE) Slot
+	{
+		Core core;
+		Slot* next;
+		// the node the slot is allocated on, it's where the slot goes back when it's freed
+		size_t node;
+	};
+
+	struct Chunk
+	{
+		void* ptr;
+		size_t size;
+	};
+
+	struct alignas(CACHE_LINE_SIZE) Node
+	{
+		std::mutex mtx;
+		Slot* free_list;
+		mn::Buf<Chunk> chunks;
+	};
+
+	struct ICore_Pool
+	{
+		size_t chunk_count;
+		Node nodes[MAX_NODES];
+	};
+
+	inline static size_t
+	current_node()
+	{
+	#if defined(__linux__)
+		unsigned cpu = 0, node = 0;
+		if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 && node < MAX_NODES)
+			return node;
+	#endif
+		return 0;
+	}
+
+	// allocates a chunk of slots bound to the node, if binding is not possible we rely on first
+	// touch since the calling thread is the one which initializes the slots
+	inline static Chunk
+	chunk_alloc(size_t size, size_t node)
+	{
+		Chunk self{};
+		self.size = size;
+	#if defined(__linux__)
+		void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr != MAP_FAILED)
+		{
+			// MPOL_PREFERRED is 1, we use the raw syscall so we don't depend on libnuma
+			constexpr int MPOL_PREFERRED_MODE = 1;
+			unsigned long mask = 1UL << node;
+			::syscall(SYS_mbind, ptr, size, MPOL_PREFERRED_MODE, &mask, sizeof(mask) * 8, 0);
+			self.ptr = ptr;
+			return self;
+		}
+	#else
+		(void)node;
+	#endif
+		self.ptr = ::operator new(size, std::align_val_t(CACHE_LINE_SIZE));
+		self.size = 0;
+		return self;
+	}
+
+	inline static void
+	chunk_free(Chunk& self)
+	{
+	#if defined(__linux__)
+		if (self.size > 0)
+		{
+			::munmap(self.ptr, self.size);
+			return;
+		}
+	#endif
+		::operator delete(self.ptr, std::align_val_t(CACHE_LINE_SIZE));
+	}
+
+	// API
+	Core_Pool
+	core_pool_new(size_t chunk_count)
+	{
+		auto self = new ICore_Pool;
+		self->chunk_count = chunk_count > 0 ? chunk_count : 1;
+		for (auto& node: self->nodes)
+		{
+			node.free_list = nullptr;
+			node.chunks = mn::buf_new<Chunk>();
+		}
+		return self;
+	}
+
+	void
+	core_pool_free(Core_Pool self)
+	{
+		for (auto& node: self->nodes)
+		{
+			for (auto& chunk: node.chunks)
+				chunk_free(chunk);
+			mn::buf_free(node.chunks);
+		}
+		delete self;
+	}
+
+	Core*
+	core_pool_get(Core_Pool self)
+	{
+		auto& node = self->nodes[current_node()];
+		std::lock_guard<std::mutex> lock(node.mtx);
+
+		if (node.free_list == nullptr)
+		{
+			size_t node_index = size_t(&node - self->nodes);
+			auto chunk = chunk_alloc(self->chunk_count * sizeof(Slot), node_index);
+			mn::buf_push(node.chunks, chunk);
+
+			auto slots = (Slot*)chunk.ptr;
+			for (size_t i = 0; i < self->chunk_count; ++i)
+			{
+				slots[i].node = node_index;
+				slots[i].next = node.free_list;
+				node.free_list = slots + i;
+			}
+		}
+
+		auto slot = node.free_list;
+		node.free_list = slot->next;
+		return new (&slot->core) Core{};
+	}
+
+	void
+	core_pool_put(Core_Pool self, Core* core)
+	{
+		core_free(*core);
+
+		// the core is the first member of the slot
+		auto slot = (Slot*)core;
+		auto& node = self->nodes[slot->node];
+		std::lock_guard<std::mutex> lock(node.mtx);
+		slot->next = node.free_list;
+		node.free_list = slot;
+	}
+}
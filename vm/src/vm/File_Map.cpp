@@ -0,0 +1,156 @@
+#include "vm/File_Map.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vm
+{
+	constexpr intptr_t INVALID_HANDLE = -1;
+
+#if defined(_WIN32)
+	inline static File_Map
+	file_map_open(const char* path, bool write, size_t size)
+	{
+		auto self = file_map_invalid();
+
+		HANDLE file = CreateFileA(
+			path,
+			write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+			FILE_SHARE_READ,
+			NULL,
+			write ? CREATE_ALWAYS : OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			NULL
+		);
+		if (file == INVALID_HANDLE_VALUE)
+			return self;
+
+		if (write == false)
+		{
+			LARGE_INTEGER file_size{};
+			GetFileSizeEx(file, &file_size);
+			size = size_t(file_size.QuadPart);
+		}
+		self.handle = intptr_t(file);
+		self.size = size;
+
+		// windows can't map empty files
+		if (size == 0)
+			return self;
+
+		HANDLE mapping = CreateFileMappingA(
+			file,
+			NULL,
+			write ? PAGE_READWRITE : PAGE_READONLY,
+			DWORD(uint64_t(size) >> 32),
+			DWORD(size & 0xFFFFFFFF),
+			NULL
+		);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			return file_map_invalid();
+		}
+
+		self.mapping = intptr_t(mapping);
+		self.ptr = (uint8_t*)MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+		if (self.ptr == nullptr)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return file_map_invalid();
+		}
+		return self;
+	}
+#else
+	inline static File_Map
+	file_map_open(const char* path, bool write, size_t size)
+	{
+		auto self = file_map_invalid();
+
+		int fd = write ? ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return self;
+
+		if (write)
+		{
+			if (::ftruncate(fd, off_t(size)) != 0)
+			{
+				::close(fd);
+				return self;
+			}
+		}
+		else
+		{
+			struct stat st{};
+			if (::fstat(fd, &st) != 0)
+			{
+				::close(fd);
+				return self;
+			}
+			size = size_t(st.st_size);
+		}
+		self.handle = fd;
+		self.size = size;
+
+		// mmap doesn't accept empty ranges
+		if (size == 0)
+			return self;
+
+		void* ptr = ::mmap(nullptr, size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			::close(fd);
+			return file_map_invalid();
+		}
+		self.ptr = (uint8_t*)ptr;
+		return self;
+	}
+#endif
+
+	// API
+	File_Map
+	file_map_read(const char* path)
+	{
+		return file_map_open(path, false, 0);
+	}
+
+	File_Map
+	file_map_write(const char* path, size_t size)
+	{
+		return file_map_open(path, true, size);
+	}
+
+	bool
+	file_map_valid(const File_Map& self)
+	{
+		return self.handle != INVALID_HANDLE;
+	}
+
+	void
+	file_map_close(File_Map& self)
+	{
+		if (file_map_valid(self) == false)
+			return;
+
+	#if defined(_WIN32)
+		if (self.ptr)
+			UnmapViewOfFile(self.ptr);
+		if (self.mapping != INVALID_HANDLE)
+			CloseHandle(HANDLE(self.mapping));
+		CloseHandle(HANDLE(self.handle));
+	#else
+		if (self.ptr)
+			::munmap(self.ptr, self.size);
+		::close(int(self.handle));
+	#endif
+		self = file_map_invalid();
+	}
+}
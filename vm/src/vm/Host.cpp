@@ -0,0 +1,41 @@
+#include "vm/Host.h"
+
+namespace vm
+{
+	// API
+	Host_Registry
+	host_registry_new()
+	{
+		Host_Registry self{};
+		self.fns = mn::map_new<mn::Str, Host_Fn>();
+		return self;
+	}
+
+	void
+	host_registry_free(Host_Registry& self)
+	{
+		destruct(self.fns);
+	}
+
+	bool
+	host_registry_add(Host_Registry& self, const mn::Str& name, Host_Fn fn)
+	{
+		if (mn::map_lookup(self.fns, name) != nullptr)
+			return false;
+
+		mn::map_insert(self.fns, mn::str_clone(name), fn);
+		return true;
+	}
+
+	mn::Buf<Host_Fn>
+	host_registry_bind(const Host_Registry& self, const Pkg& pkg)
+	{
+		auto table = mn::buf_with_capacity<Host_Fn>(pkg.imports.count);
+		for (const auto& name: pkg.imports)
+		{
+			auto it = mn::map_lookup(self.fns, name);
+			mn::buf_push(table, it ? it->value : nullptr);
+		}
+		return table;
+	}
+}
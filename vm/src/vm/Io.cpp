@@ -0,0 +1,573 @@
+#include "vm/Io.h"
+
+#include <mn/Buf.h>
+
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <stdlib.h>
+#endif
+
+namespace vm
+{
+	// count of staged requests which triggers a flush
+	constexpr size_t IO_BATCH = 32;
+	// count of threads of the fallback backend
+	constexpr size_t IO_THREADS = 4;
+
+	struct Io_Entry
+	{
+		Io_Req req;
+		Io_Done_Fn done;
+		void* user;
+		int64_t result;
+	};
+
+	// executes the request with the blocking calls, it's what the thread pool does
+	inline static int64_t
+	io_execute(const Io_Req& req)
+	{
+		int64_t res = 0;
+		switch (req.op)
+		{
+		case IO_OP_OPEN:
+		{
+		#if defined(_WIN32)
+			int flags = req.flags == IO_OPEN_WRITE ? (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY) : (_O_RDONLY | _O_BINARY);
+			res = ::_open((const char*)req.ptr, flags, _S_IREAD | _S_IWRITE);
+		#else
+			int flags = req.flags == IO_OPEN_WRITE ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+			res = ::open((const char*)req.ptr, flags | O_CLOEXEC, 0644);
+		#endif
+			break;
+		}
+		case IO_OP_READ:
+		#if defined(_WIN32)
+			res = ::_read(int(req.fd), req.ptr, unsigned(req.size > 0x7FFFF000 ? 0x7FFFF000 : req.size));
+		#else
+			res = ::read(int(req.fd), req.ptr, size_t(req.size));
+		#endif
+			break;
+		case IO_OP_WRITE:
+		#if defined(_WIN32)
+			res = ::_write(int(req.fd), req.ptr, unsigned(req.size > 0x7FFFF000 ? 0x7FFFF000 : req.size));
+		#else
+			res = ::write(int(req.fd), req.ptr, size_t(req.size));
+		#endif
+			break;
+		case IO_OP_CLOSE:
+		#if defined(_WIN32)
+			res = ::_close(int(req.fd));
+		#else
+			res = ::close(int(req.fd));
+		#endif
+			break;
+		case IO_OP_NONE:
+		default:
+			return -EINVAL;
+		}
+		return res < 0 ? -int64_t(errno) : res;
+	}
+
+
+	// fallback backend, a small thread pool doing the blocking calls, the threads are started
+	// with the first flush so an io which is never used doesn't cost any threads
+	struct Pool
+	{
+		std::mutex mtx;
+		std::condition_variable work_cv;
+		std::condition_variable done_cv;
+		mn::Buf<Io_Entry> todo;
+		mn::Buf<Io_Entry> done;
+		bool running;
+		std::thread* threads;
+	};
+
+	inline static void
+	pool_main(Pool* self)
+	{
+		std::unique_lock<std::mutex> lock(self->mtx);
+		while (true)
+		{
+			self->work_cv.wait(lock, [self]{ return self->todo.count > 0 || self->running == false; });
+			if (self->todo.count == 0)
+				break;
+
+			auto entry = mn::buf_top(self->todo);
+			mn::buf_pop(self->todo);
+
+			lock.unlock();
+			entry.result = io_execute(entry.req);
+			lock.lock();
+
+			mn::buf_push(self->done, entry);
+			self->done_cv.notify_one();
+		}
+	}
+
+
+#if defined(__linux__)
+	// io_uring backend, we talk to the kernel directly using the raw syscalls
+	struct Uring
+	{
+		int fd;
+		uint32_t sq_entries;
+		uint32_t cq_entries;
+
+		void* ring;
+		size_t ring_size;
+		io_uring_sqe* sqes;
+		size_t sqes_size;
+
+		uint32_t* sq_head;
+		uint32_t* sq_tail;
+		uint32_t* sq_mask;
+		uint32_t* sq_array;
+		uint32_t* cq_head;
+		uint32_t* cq_tail;
+		uint32_t* cq_mask;
+		io_uring_cqe* cqes;
+
+		// the sqes written to the ring but not sent to the kernel yet
+		uint32_t unsubmitted;
+		// requests in flight are kept here, and the index is the sqe's user data
+		mn::Buf<Io_Entry> entries;
+		mn::Buf<uint32_t> free_entries;
+	};
+
+	inline static int
+	uring_enter(Uring& self, uint32_t to_submit, uint32_t min_complete)
+	{
+		uint32_t flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+		while (true)
+		{
+			int res = int(::syscall(__NR_io_uring_enter, self.fd, to_submit, min_complete, flags, nullptr, 0));
+			if (res < 0 && errno == EINTR)
+				continue;
+			return res;
+		}
+	}
+
+	inline static bool
+	uring_supports(int fd)
+	{
+		constexpr size_t OPS_COUNT = 256;
+		size_t size = sizeof(io_uring_probe) + OPS_COUNT * sizeof(io_uring_probe_op);
+		auto probe = (io_uring_probe*)::calloc(1, size);
+		int res = int(::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OPS_COUNT));
+
+		bool supported = res >= 0;
+		for (auto op: {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE})
+		{
+			if (supported == false)
+				break;
+			supported = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+		}
+		::free(probe);
+		return supported;
+	}
+
+	inline static bool
+	uring_init(Uring& self, uint32_t entries)
+	{
+		io_uring_params params{};
+		int fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0)
+			return false;
+
+		// we need the rings to be mapped at once and the kernel to never drop completions
+		if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+			(params.features & IORING_FEAT_NODROP) == 0 ||
+			uring_supports(fd) == false)
+		{
+			::close(fd);
+			return false;
+		}
+
+		size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+		void* ring = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (ring == MAP_FAILED)
+		{
+			::close(fd);
+			return false;
+		}
+
+		size_t sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			::munmap(ring, ring_size);
+			::close(fd);
+			return false;
+		}
+
+		auto base = (uint8_t*)ring;
+		self.fd = fd;
+		self.sq_entries = params.sq_entries;
+		self.cq_entries = params.cq_entries;
+		self.ring = ring;
+		self.ring_size = ring_size;
+		self.sqes = (io_uring_sqe*)sqes;
+		self.sqes_size = sqes_size;
+		self.sq_head = (uint32_t*)(base + params.sq_off.head);
+		self.sq_tail = (uint32_t*)(base + params.sq_off.tail);
+		self.sq_mask = (uint32_t*)(base + params.sq_off.ring_mask);
+		self.sq_array = (uint32_t*)(base + params.sq_off.array);
+		self.cq_head = (uint32_t*)(base + params.cq_off.head);
+		self.cq_tail = (uint32_t*)(base + params.cq_off.tail);
+		self.cq_mask = (uint32_t*)(base + params.cq_off.ring_mask);
+		self.cqes = (io_uring_cqe*)(base + params.cq_off.cqes);
+		self.unsubmitted = 0;
+		self.entries = mn::buf_new<Io_Entry>();
+		self.free_entries = mn::buf_new<uint32_t>();
+		return true;
+	}
+
+	inline static void
+	uring_dispose(Uring& self)
+	{
+		::munmap(self.sqes, self.sqes_size);
+		::munmap(self.ring, self.ring_size);
+		::close(self.fd);
+		mn::buf_free(self.entries);
+		mn::buf_free(self.free_entries);
+	}
+
+	inline static void
+	uring_flush(Uring& self)
+	{
+		if (self.unsubmitted == 0)
+			return;
+
+		int res = uring_enter(self, self.unsubmitted, 0);
+		// the kernel may be out of resources, we'll try again with the next flush
+		if (res > 0)
+			self.unsubmitted -= uint32_t(res);
+	}
+
+	// returns false if the submission queue is full and the kernel didn't take any of it
+	inline static bool
+	uring_push(Uring& self, Io_Entry entry)
+	{
+		uint32_t tail = *self.sq_tail;
+		if (tail - __atomic_load_n(self.sq_head, __ATOMIC_ACQUIRE) == self.sq_entries)
+		{
+			uring_flush(self);
+			tail = *self.sq_tail;
+			if (tail - __atomic_load_n(self.sq_head, __ATOMIC_ACQUIRE) == self.sq_entries)
+				return false;
+		}
+
+		uint32_t index = 0;
+		if (self.free_entries.count > 0)
+		{
+			index = mn::buf_top(self.free_entries);
+			mn::buf_pop(self.free_entries);
+			self.entries[index] = entry;
+		}
+		else
+		{
+			index = uint32_t(self.entries.count);
+			mn::buf_push(self.entries, entry);
+		}
+
+		uint32_t slot = tail & *self.sq_mask;
+		auto sqe = self.sqes + slot;
+		::memset(sqe, 0, sizeof(*sqe));
+		sqe->user_data = index;
+
+		const auto& req = entry.req;
+		switch (req.op)
+		{
+		case IO_OP_OPEN:
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = uint64_t(req.ptr);
+			sqe->len = 0644;
+			sqe->open_flags = (req.flags == IO_OPEN_WRITE ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY) | O_CLOEXEC;
+			break;
+		case IO_OP_READ:
+		case IO_OP_WRITE:
+			sqe->opcode = req.op == IO_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+			sqe->fd = int(req.fd);
+			sqe->addr = uint64_t(req.ptr);
+			// same cap as read and write syscalls
+			sqe->len = uint32_t(req.size > 0x7FFFF000 ? 0x7FFFF000 : req.size);
+			// use the file position like read and write do
+			sqe->off = uint64_t(-1);
+			break;
+		case IO_OP_CLOSE:
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = int(req.fd);
+			break;
+		case IO_OP_NONE:
+		default:
+			sqe->opcode = IORING_OP_NOP;
+			break;
+		}
+
+		self.sq_array[slot] = slot;
+		__atomic_store_n(self.sq_tail, tail + 1, __ATOMIC_RELEASE);
+		++self.unsubmitted;
+		return true;
+	}
+
+	// returns the count of requests in the ring which haven't been reaped
+	inline static size_t
+	uring_pending(const Uring& self)
+	{
+		return self.entries.count - self.free_entries.count;
+	}
+
+	inline static size_t
+	uring_reap(Uring& self)
+	{
+		size_t count = 0;
+		uint32_t head = *self.cq_head;
+		uint32_t tail = __atomic_load_n(self.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			const auto& cqe = self.cqes[head & *self.cq_mask];
+			auto index = uint32_t(cqe.user_data);
+			auto entry = self.entries[index];
+			mn::buf_push(self.free_entries, index);
+
+			// let the kernel reuse the slot before we call back since it may submit again
+			__atomic_store_n(self.cq_head, head + 1, __ATOMIC_RELEASE);
+
+			// requests without an op are sent as nops, they fail like they do with the threads
+			entry.done(entry.user, entry.req.op == IO_OP_NONE ? -EINVAL : int64_t(cqe.res));
+			++count;
+		}
+		return count;
+	}
+#endif
+
+
+	struct IIo
+	{
+		IO_BACKEND backend;
+		size_t inflight;
+	#if defined(__linux__)
+		Uring uring;
+	#endif
+		// the requests waiting for the next flush of the threads backend
+		mn::Buf<Io_Entry> staged;
+		// the finished requests we took from the pool and are calling back
+		mn::Buf<Io_Entry> reaped;
+		Pool* pool;
+	};
+
+	inline static void
+	io_pool_start(IIo* self)
+	{
+		self->pool = new Pool;
+		self->pool->todo = mn::buf_new<Io_Entry>();
+		self->pool->done = mn::buf_new<Io_Entry>();
+		self->pool->running = true;
+		self->pool->threads = new std::thread[IO_THREADS];
+		for (size_t i = 0; i < IO_THREADS; ++i)
+			self->pool->threads[i] = std::thread(pool_main, self->pool);
+	}
+
+	inline static void
+	io_pool_stop(IIo* self)
+	{
+		{
+			std::lock_guard<std::mutex> lock(self->pool->mtx);
+			self->pool->running = false;
+			self->pool->work_cv.notify_all();
+		}
+		for (size_t i = 0; i < IO_THREADS; ++i)
+			self->pool->threads[i].join();
+		delete[] self->pool->threads;
+		mn::buf_free(self->pool->todo);
+		mn::buf_free(self->pool->done);
+		delete self->pool;
+		self->pool = nullptr;
+	}
+
+	// calls back the requests the pool finished, and waits for one if there's none
+	inline static size_t
+	io_pool_reap(IIo* self, bool wait)
+	{
+		if (self->pool == nullptr)
+			return 0;
+
+		{
+			std::unique_lock<std::mutex> lock(self->pool->mtx);
+			if (wait)
+				self->pool->done_cv.wait(lock, [self]{ return self->pool->done.count > 0; });
+			std::swap(self->reaped, self->pool->done);
+		}
+
+		for (const auto& entry: self->reaped)
+			entry.done(entry.user, entry.result);
+		size_t count = self->reaped.count;
+		mn::buf_clear(self->reaped);
+		return count;
+	}
+
+	// API
+	Io
+	io_new(size_t entries, IO_BACKEND backend)
+	{
+		auto self = new IIo;
+		self->backend = IO_BACKEND_THREADS;
+		self->inflight = 0;
+		self->staged = mn::buf_new<Io_Entry>();
+		self->reaped = mn::buf_new<Io_Entry>();
+		self->pool = nullptr;
+
+		if (backend != IO_BACKEND_THREADS)
+		{
+		#if defined(__linux__)
+			if (uring_init(self->uring, uint32_t(entries)))
+				self->backend = IO_BACKEND_URING;
+		#endif
+			if (backend == IO_BACKEND_URING && self->backend != IO_BACKEND_URING)
+			{
+				mn::buf_free(self->staged);
+				mn::buf_free(self->reaped);
+				delete self;
+				return nullptr;
+			}
+		}
+		return self;
+	}
+
+	void
+	io_free(Io self)
+	{
+		io_flush(self);
+		while (self->inflight > 0)
+			io_reap(self, true);
+
+	#if defined(__linux__)
+		if (self->backend == IO_BACKEND_URING)
+			uring_dispose(self->uring);
+	#endif
+		if (self->pool)
+			io_pool_stop(self);
+		mn::buf_free(self->staged);
+		mn::buf_free(self->reaped);
+		delete self;
+	}
+
+	IO_BACKEND
+	io_backend(Io self)
+	{
+		return self->backend;
+	}
+
+	void
+	io_submit(Io self, const Io_Req& req, Io_Done_Fn done, void* user)
+	{
+		++self->inflight;
+		Io_Entry entry{req, done, user, 0};
+
+	#if defined(__linux__)
+		if (self->backend == IO_BACKEND_URING)
+		{
+			// when the ring is full and the kernel won't take any more the request goes to the
+			// threads instead of waiting on it
+			if (uring_push(self->uring, entry))
+			{
+				if (self->uring.unsubmitted >= IO_BATCH)
+					uring_flush(self->uring);
+				return;
+			}
+		}
+	#endif
+
+		mn::buf_push(self->staged, entry);
+		if (self->staged.count >= IO_BATCH)
+			io_flush(self);
+	}
+
+	void
+	io_flush(Io self)
+	{
+	#if defined(__linux__)
+		if (self->backend == IO_BACKEND_URING)
+			uring_flush(self->uring);
+	#endif
+
+		if (self->staged.count == 0)
+			return;
+
+		if (self->pool == nullptr)
+			io_pool_start(self);
+
+		std::lock_guard<std::mutex> lock(self->pool->mtx);
+		for (const auto& entry: self->staged)
+			mn::buf_push(self->pool->todo, entry);
+		mn::buf_clear(self->staged);
+		self->pool->work_cv.notify_all();
+	}
+
+	size_t
+	io_reap(Io self, bool wait)
+	{
+		if (self->inflight == 0)
+			return 0;
+
+		size_t count = 0;
+	#if defined(__linux__)
+		if (self->backend == IO_BACKEND_URING)
+		{
+			// the requests which didn't fit in the ring are on the threads
+			count = uring_reap(self->uring) + io_pool_reap(self, false);
+			if (count == 0 && wait)
+			{
+				if (uring_pending(self->uring) > 0)
+				{
+					int res = uring_enter(self->uring, self->uring.unsubmitted, 1);
+					if (res > 0)
+						self->uring.unsubmitted -= uint32_t(res);
+					count = uring_reap(self->uring);
+				}
+				else
+				{
+					io_flush(self);
+					count = io_pool_reap(self, true);
+				}
+			}
+			self->inflight -= count;
+			return count;
+		}
+	#endif
+
+		// the staged requests won't finish unless we send them
+		if (wait)
+			io_flush(self);
+		count = io_pool_reap(self, wait);
+
+		self->inflight -= count;
+		return count;
+	}
+
+	size_t
+	io_inflight(Io self)
+	{
+		return self->inflight;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "vm/Lz.h"
+
+#include <string.h>
+
+namespace vm
+{
+	constexpr size_t LZ_MIN_MATCH = 4;
+	constexpr size_t LZ_MAX_OFFSET = 65535;
+	// the last 5 bytes are always literals and the last match starts 12 bytes before the end at
+	// most, just like lz4, so the decoder's last sequence never has a match
+	constexpr size_t LZ_LAST_LITERALS = 5;
+	constexpr size_t LZ_MATCH_LIMIT = 12;
+	constexpr int LZ_HASH_BITS = 12;
+
+	inline static uint32_t
+	read32(const uint8_t* ptr)
+	{
+		uint32_t v = 0;
+		::memcpy(&v, ptr, sizeof(v));
+		return v;
+	}
+
+	inline static uint32_t
+	lz_hash(uint32_t seq)
+	{
+		return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+	}
+
+	// writes the rest of a length which didn't fit in its 4 bits of the token
+	inline static bool
+	lz_length_write(uint8_t* dst, size_t dst_size, size_t& op, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+		{
+			if (op >= dst_size)
+				return false;
+			dst[op++] = 255;
+		}
+		if (op >= dst_size)
+			return false;
+		dst[op++] = uint8_t(length);
+		return true;
+	}
+
+	inline static bool
+	lz_length_read(const uint8_t* src, size_t src_size, size_t& ip, size_t& length)
+	{
+		uint8_t b = 0;
+		do
+		{
+			if (ip >= src_size)
+				return false;
+			b = src[ip++];
+			length += b;
+		} while (b == 255);
+		return true;
+	}
+
+	// writes the literals then the match, a match length of 0 means there's no match
+	inline static bool
+	lz_sequence_write(uint8_t* dst, size_t dst_size, size_t& op, const uint8_t* literals, size_t literals_size, size_t offset, size_t match_size)
+	{
+		if (op >= dst_size)
+			return false;
+
+		size_t match_code = match_size > 0 ? match_size - LZ_MIN_MATCH : 0;
+		auto& token = dst[op++];
+		token = uint8_t((literals_size < 15 ? literals_size : 15) << 4);
+		if (literals_size >= 15 && lz_length_write(dst, dst_size, op, literals_size - 15) == false)
+			return false;
+
+		if (literals_size > dst_size - op)
+			return false;
+		if (literals_size > 0)
+			::memcpy(dst + op, literals, literals_size);
+		op += literals_size;
+
+		if (match_size == 0)
+			return true;
+
+		if (dst_size - op < 2)
+			return false;
+		dst[op++] = uint8_t(offset);
+		dst[op++] = uint8_t(offset >> 8);
+
+		token |= uint8_t(match_code < 15 ? match_code : 15);
+		if (match_code >= 15 && lz_length_write(dst, dst_size, op, match_code - 15) == false)
+			return false;
+		return true;
+	}
+
+	// API
+	size_t
+	lz_compress_bound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	size_t
+	lz_compress(const void* src_ptr, size_t src_size, void* dst_ptr, size_t dst_size)
+	{
+		auto src = (const uint8_t*)src_ptr;
+		auto dst = (uint8_t*)dst_ptr;
+
+		// positions plus 1 of the last time each hashed 4 bytes were seen
+		uint32_t table[1 << LZ_HASH_BITS] = {};
+
+		size_t ip = 0, anchor = 0, op = 0;
+		if (src_size > LZ_MATCH_LIMIT)
+		{
+			size_t limit = src_size - LZ_MATCH_LIMIT;
+			while (ip < limit)
+			{
+				uint32_t seq = read32(src + ip);
+				auto& slot = table[lz_hash(seq)];
+				size_t ref = slot;
+				slot = uint32_t(ip + 1);
+				if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || read32(src + ref - 1) != seq)
+				{
+					++ip;
+					continue;
+				}
+				ref -= 1;
+
+				size_t match_end = ip + LZ_MIN_MATCH;
+				size_t match_limit = src_size - LZ_LAST_LITERALS;
+				while (match_end < match_limit && src[match_end] == src[ref + (match_end - ip)])
+					++match_end;
+
+				if (lz_sequence_write(dst, dst_size, op, src + anchor, ip - anchor, ip - ref, match_end - ip) == false)
+					return 0;
+				ip = match_end;
+				anchor = ip;
+			}
+		}
+
+		if (lz_sequence_write(dst, dst_size, op, src + anchor, src_size - anchor, 0, 0) == false)
+			return 0;
+		return op;
+	}
+
+	bool
+	lz_decompress(const void* src_ptr, size_t src_size, void* dst_ptr, size_t raw_size)
+	{
+		auto src = (const uint8_t*)src_ptr;
+		auto dst = (uint8_t*)dst_ptr;
+
+		size_t ip = 0, op = 0;
+		while (true)
+		{
+			if (ip >= src_size)
+				return false;
+			uint8_t token = src[ip++];
+
+			size_t literals_size = token >> 4;
+			if (literals_size == 15 && lz_length_read(src, src_size, ip, literals_size) == false)
+				return false;
+			if (literals_size > src_size - ip || literals_size > raw_size - op)
+				return false;
+			if (literals_size > 0)
+				::memcpy(dst + op, src + ip, literals_size);
+			ip += literals_size;
+			op += literals_size;
+
+			// the last sequence has no match
+			if (ip == src_size)
+				return op == raw_size;
+
+			if (src_size - ip < 2)
+				return false;
+			size_t offset = size_t(src[ip]) | (size_t(src[ip + 1]) << 8);
+			ip += 2;
+			if (offset == 0 || offset > op)
+				return false;
+
+			size_t match_size = token & 15;
+			if (match_size == 15 && lz_length_read(src, src_size, ip, match_size) == false)
+				return false;
+			match_size += LZ_MIN_MATCH;
+			if (match_size > raw_size - op)
+				return false;
+
+			// the match can overlap the bytes it writes, which is how runs are encoded
+			if (offset >= match_size)
+			{
+				::memcpy(dst + op, dst + op - offset, match_size);
+				op += match_size;
+			}
+			else
+			{
+				for (size_t i = 0; i < match_size; ++i, ++op)
+					dst[op] = dst[op - offset];
+			}
+		}
+	}
+}
\ No newline at end of file
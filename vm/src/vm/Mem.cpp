@@ -0,0 +1,292 @@
+#include "vm/Mem.h"
+
+#include <atomic>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace vm
+{
+	// the memfd holding the frozen image of a region, it's shared by the region and its forks
+	struct Image
+	{
+		int fd;
+		std::atomic<int> ref_count;
+	};
+
+	struct IMem
+	{
+		uint8_t* ptr;
+		size_t size;
+		// null when the region is a plain allocation
+		Image* image;
+		// whether the region is mapped privately, the original region is shared until it's forked
+		bool frozen;
+	};
+
+	inline static size_t
+	page_size()
+	{
+	#if defined(__linux__)
+		return size_t(::sysconf(_SC_PAGESIZE));
+	#else
+		return 4096;
+	#endif
+	}
+
+	inline static void
+	image_unref(Image* self)
+	{
+		if (self->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+		#if defined(__linux__)
+			::close(self->fd);
+		#endif
+			delete self;
+		}
+	}
+
+	inline static bool
+	page_is_zero(const uint8_t* ptr, size_t size)
+	{
+		for (size_t i = 0; i < size; i += sizeof(uint64_t))
+		{
+			uint64_t v = 0;
+			::memcpy(&v, ptr + i, sizeof(v));
+			if (v != 0)
+				return false;
+		}
+		return true;
+	}
+
+	// returns whether the frozen region wrote any of its pages since it was mapped over its
+	// image, the written pages are private anonymous pages while the rest are still the image's
+	// file pages, so only the page map entries are read, if they can't be the region is dirty
+	inline static bool
+	mem_dirty(IMem* self)
+	{
+	#if defined(__linux__)
+		int fd = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return true;
+
+		size_t page = page_size();
+		size_t pages = self->size / page;
+		off_t first = off_t(uintptr_t(self->ptr) / page * sizeof(uint64_t));
+		bool dirty = false;
+		uint64_t entries[512];
+		for (size_t i = 0; i < pages && dirty == false;)
+		{
+			size_t count = pages - i < 512 ? pages - i : 512;
+			auto res = ::pread(fd, entries, count * sizeof(uint64_t), first + off_t(i * sizeof(uint64_t)));
+			if (res != ssize_t(count * sizeof(uint64_t)))
+			{
+				dirty = true;
+				break;
+			}
+
+			for (size_t j = 0; j < count; ++j)
+			{
+				// bit 63 is present, 62 is swapped, and 61 is a file page
+				bool mapped = (entries[j] >> 63) & 1 || (entries[j] >> 62) & 1;
+				if (mapped && ((entries[j] >> 61) & 1) == 0)
+				{
+					dirty = true;
+					break;
+				}
+			}
+			i += count;
+		}
+		::close(fd);
+		return dirty;
+	#else
+		(void)self;
+		return true;
+	#endif
+	}
+
+	// writes the frozen region's current content into a new memfd and maps the region privately
+	// over it, it's the image the next forks start from, its zero pages are left as holes
+	inline static bool
+	mem_reimage(IMem* self)
+	{
+	#if defined(__linux__)
+		int fd = ::memfd_create("tethys_mem", MFD_CLOEXEC);
+		if (fd < 0)
+			return false;
+		if (::ftruncate(fd, off_t(self->size)) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		size_t page = page_size();
+		for (size_t offset = 0; offset < self->size; offset += page)
+		{
+			if (page_is_zero(self->ptr + offset, page))
+				continue;
+
+			size_t written = 0;
+			while (written < page)
+			{
+				auto res = ::pwrite(fd, self->ptr + offset + written, page - written, off_t(offset + written));
+				if (res <= 0)
+				{
+					::close(fd);
+					return false;
+				}
+				written += size_t(res);
+			}
+		}
+
+		void* ptr = ::mmap(self->ptr, self->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			::close(fd);
+			return false;
+		}
+
+		image_unref(self->image);
+		self->image = new Image;
+		self->image->fd = fd;
+		self->image->ref_count.store(1, std::memory_order_relaxed);
+		return true;
+	#else
+		(void)self;
+		return false;
+	#endif
+	}
+
+	inline static IMem*
+	mem_alloc_fallback(size_t size)
+	{
+		auto self = new IMem;
+		self->ptr = (uint8_t*)::calloc(1, size);
+		self->size = size;
+		self->image = nullptr;
+		self->frozen = false;
+		return self;
+	}
+
+	// API
+	Mem
+	mem_new(size_t size)
+	{
+		size_t page = page_size();
+		size = (size + page - 1) / page * page;
+		if (size == 0)
+			size = page;
+
+	#if defined(__linux__)
+		int fd = ::memfd_create("tethys_mem", MFD_CLOEXEC);
+		if (fd >= 0 && ::ftruncate(fd, off_t(size)) == 0)
+		{
+			void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (ptr != MAP_FAILED)
+			{
+				auto self = new IMem;
+				self->ptr = (uint8_t*)ptr;
+				self->size = size;
+				self->image = new Image;
+				self->image->fd = fd;
+				self->image->ref_count.store(1, std::memory_order_relaxed);
+				self->frozen = false;
+				return self;
+			}
+		}
+		if (fd >= 0)
+			::close(fd);
+	#endif
+
+		return mem_alloc_fallback(size);
+	}
+
+	void
+	mem_free(Mem self)
+	{
+		if (self->image)
+		{
+		#if defined(__linux__)
+			::munmap(self->ptr, self->size);
+		#endif
+			image_unref(self->image);
+		}
+		else
+		{
+			::free(self->ptr);
+		}
+		delete self;
+	}
+
+	uint8_t*
+	mem_ptr(Mem self)
+	{
+		return self->ptr;
+	}
+
+	size_t
+	mem_size(Mem self)
+	{
+		return self->size;
+	}
+
+	Mem
+	mem_fork(Mem self)
+	{
+	#if defined(__linux__)
+		if (self->image)
+		{
+			// freeze the original by mapping it privately over its own pages, its content is
+			// already in the memfd since the shared mapping writes through to it, a frozen region
+			// which wrote its private pages since goes into a new image first, one which didn't
+			// is still its image and forks right away
+			bool imaged = false;
+			if (self->frozen == false)
+			{
+				void* ptr = ::mmap(self->ptr, self->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, self->image->fd, 0);
+				if (ptr != MAP_FAILED)
+					self->frozen = imaged = true;
+			}
+			else if (mem_dirty(self))
+			{
+				imaged = mem_reimage(self);
+			}
+			else
+			{
+				imaged = true;
+			}
+
+			if (imaged)
+			{
+				void* ptr = ::mmap(nullptr, self->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, self->image->fd, 0);
+				if (ptr != MAP_FAILED)
+				{
+					auto fork = new IMem;
+					fork->ptr = (uint8_t*)ptr;
+					fork->size = self->size;
+					fork->image = self->image;
+					fork->image->ref_count.fetch_add(1, std::memory_order_relaxed);
+					fork->frozen = true;
+					return fork;
+				}
+			}
+		}
+	#endif
+
+		auto fork = mem_alloc_fallback(self->size);
+		::memcpy(fork->ptr, self->ptr, self->size);
+		return fork;
+	}
+
+	bool
+	mem_image_shared(Mem self, Mem other)
+	{
+		return self->image != nullptr && self->image == other->image;
+	}
+}
\ No newline at end of file
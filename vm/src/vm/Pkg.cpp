@@ -1,27 +1,22 @@
 #include "vm/Pkg.h"
+#include "vm/Op.h"
+#include "vm/Util.h"
+#include "vm/Sha256.h"
+#include "vm/Lz.h"
+#include "vm/Verify.h"
 
 #include <mn/File.h>
 #include <mn/Path.h>
 #include <mn/Defer.h>
 
-namespace vm
-{
-	inline static void
-	write_string(mn::File f, const mn::Str& str)
-	{
-		uint32_t len = uint32_t(str.count);
-		mn::stream_write(f, mn::block_from(len));
-		mn::stream_write(f, mn::block_from(str));
-	}
+#include <string.h>
+#include <stddef.h>
 
-	inline static void
-	write_bytes(mn::File f, const mn::Buf<uint8_t>& bytes)
-	{
-		uint32_t len = uint32_t(bytes.count);
-		mn::stream_write(f, mn::block_from(len));
-		mn::stream_write(f, mn::block_from(bytes));
-	}
+#include <atomic>
+#include <thread>
 
+namespace vm
+{
 	inline static mn::Str
 	read_string(mn::File f)
 	{
@@ -47,12 +42,837 @@ namespace vm
 		return v;
 	}
 
+	struct Pkg_Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t procs_count;
+		uint32_t imports_count;
+		// count of the directory slots, it's a power of 2
+		uint32_t slots_count;
+		// BYTECODE_VERSION of the procs, packages which predate it have 0 here and encoding 1
+		uint8_t encoding;
+		uint8_t reserved[3];
+		// read only data, version 2 packages end their header before it and have none
+		uint64_t rodata_offset;
+		uint64_t rodata_size;
+	};
+
+	struct Pkg_Slot
+	{
+		uint64_t hash;
+		// index of the proc's entry plus 1, 0 marks an empty slot
+		uint32_t entry;
+		uint32_t reserved;
+	};
+
+	struct Pkg_Entry
+	{
+		uint32_t name_offset;
+		uint32_t name_size;
+		// offset of the body from the start of the image, a bundle keeps the bodies after all of
+		// its images so it can point past the image's end
+		uint64_t code_offset;
+		uint64_t code_size;
+		// sha-256 of the body, packages before version 4 end their entries before it
+		Sha256 digest;
+	};
+
+	struct Pkg_Name
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	// a proc of the package to save, it's either added to the package or in its file
+	struct Pkg_Proc
+	{
+		const char* name;
+		size_t name_size;
+		const uint8_t* code;
+		size_t code_size;
+	};
+
+	// a body to save, procs with the same body share it
+	struct Pkg_Body
+	{
+		Sha256 digest;
+		const uint8_t* code;
+		size_t code_size;
+		// offset of the body in the file
+		uint64_t offset;
+	};
+
+	struct Body_Table
+	{
+		mn::Buf<Pkg_Body> bodies;
+		// bodies by the prefix of their digest
+		mn::Map<uint64_t, size_t> index;
+	};
+
+	// a package image to save, it's the package's tables, names and read only data, its bodies
+	// are in the body table
+	struct Pkg_Image
+	{
+		const Pkg* pkg;
+		mn::Buf<Pkg_Proc> procs;
+		// index of each proc's body in the body table
+		mn::Buf<size_t> bodies;
+		Pkg_Header header;
+		// offset of the image in the file and its size, it's page aligned
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct Bundle_Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t pkgs_count;
+		uint32_t reserved;
+	};
+
+	struct Bundle_Entry
+	{
+		uint32_t name_offset;
+		uint32_t name_size;
+		uint64_t image_offset;
+	};
+
+	inline static uint64_t
+	align_up(uint64_t v, uint64_t alignment)
+	{
+		return (v + alignment - 1) & ~(alignment - 1);
+	}
+
+	// fnv-1a, names are short so anything fancier doesn't pay off
+	inline static uint64_t
+	name_hash(const char* ptr, size_t size)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= uint8_t(ptr[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// a buf which points into memory it doesn't own, it must never be freed or grown
+	inline static mn::Buf<uint8_t>
+	code_view(const uint8_t* ptr, size_t size)
+	{
+		mn::Buf<uint8_t> self{};
+		if (size > 0)
+		{
+			self.ptr = (uint8_t*)ptr;
+			self.count = size;
+			self.cap = size;
+		}
+		return self;
+	}
+
+	inline static bool
+	range_valid(uint64_t offset, uint64_t size, uint64_t limit)
+	{
+		return offset <= limit && size <= limit - offset;
+	}
+
+	// returns the size of an encoding 1 instruction, it has the same opcodes as the current
+	// encoding up to Op_IO_CLOSE but a byte per register and 64-bit offsets
+	inline static uint64_t
+	v1_op_size(Op op)
+	{
+		if (op > Op_IO_CLOSE)
+			return 1;
+		uint64_t size = op_size(op);
+		if (op_reg_pair_index(op) != 0)
+			size += 1;
+		if (op_has_target(op))
+			size += sizeof(int64_t) - op_target_size(op);
+		return size;
+	}
+
+	// rewrites encoding 1 bytecode in the current encoding, jumps keep 32-bit offsets since
+	// there's no point in relaxing code which is loaded once
+	inline static mn::Buf<uint8_t>
+	code_upgrade(const uint8_t* ptr, size_t size)
+	{
+		// first pass: find where each instruction lands in the new code
+		auto starts = mn::buf_with_count<uint64_t>(size + 1);
+		mn_defer(mn::buf_free(starts));
+		::memset(starts.ptr, 0xFF, starts.count * sizeof(uint64_t));
+
+		uint64_t new_size = 0;
+		for (uint64_t ix = 0; ix < size;)
+		{
+			auto op = Op(ptr[ix]);
+			starts[ix] = new_size;
+			if (op > Op_IO_CLOSE || ix + v1_op_size(op) > size)
+			{
+				new_size += 1;
+				ix += 1;
+				continue;
+			}
+			new_size += op_size(op);
+			ix += v1_op_size(op);
+		}
+		starts[size] = new_size;
+
+		// second pass: write the instructions, unknown opcodes and truncated instructions become
+		// illegal instructions and jumps to the middle of an instruction jump to the end
+		auto res = mn::buf_new<uint8_t>();
+		mn::buf_reserve(res, new_size);
+		for (uint64_t ix = 0; ix < size;)
+		{
+			auto op = Op(ptr[ix]);
+			if (op > Op_IO_CLOSE || ix + v1_op_size(op) > size)
+			{
+				push8(res, uint8_t(Op_IGL));
+				ix += 1;
+				continue;
+			}
+
+			push8(res, uint8_t(op));
+			uint64_t operand = 1;
+			uint64_t end = v1_op_size(op);
+			if (op_has_target(op))
+				end -= sizeof(int64_t);
+
+			if (auto pair = op_reg_pair_index(op))
+			{
+				for (; operand < pair; ++operand)
+					push8(res, ptr[ix + operand]);
+				push8(res, uint8_t((ptr[ix + operand] & 0xF) | (ptr[ix + operand + 1] << 4)));
+				operand += 2;
+			}
+			for (; operand < end; ++operand)
+				push8(res, ptr[ix + operand]);
+
+			if (op_has_target(op))
+			{
+				int64_t offset = 0;
+				::memcpy(&offset, ptr + ix + end, sizeof(offset));
+				uint64_t target = ix + v1_op_size(op) + uint64_t(offset);
+				uint64_t new_target = target <= size && starts[target] != UINT64_MAX ? starts[target] : new_size;
+				push32(res, uint32_t(int32_t(int64_t(new_target) - int64_t(res.count + sizeof(int32_t)))));
+			}
+			ix += v1_op_size(op);
+		}
+		return res;
+	}
+
+	inline static uint64_t
+	image_header_size(uint32_t version)
+	{
+		if (version < 3)
+			return offsetof(Pkg_Header, rodata_offset);
+		return sizeof(Pkg_Header);
+	}
+
+	inline static uint64_t
+	image_slots_offset(const Pkg_Header& header)
+	{
+		return image_header_size(header.version);
+	}
+
+	inline static uint64_t
+	image_entries_offset(const Pkg_Header& header)
+	{
+		return image_slots_offset(header) + uint64_t(header.slots_count) * sizeof(Pkg_Slot);
+	}
+
+	inline static uint64_t
+	image_entry_size(uint32_t version)
+	{
+		if (version < 4)
+			return offsetof(Pkg_Entry, digest);
+		return sizeof(Pkg_Entry);
+	}
+
+	inline static uint64_t
+	image_names_offset(const Pkg_Header& header)
+	{
+		return image_entries_offset(header) + uint64_t(header.procs_count) * image_entry_size(header.version);
+	}
+
+	inline static uint64_t
+	image_strings_offset(const Pkg_Header& header)
+	{
+		return image_names_offset(header) + uint64_t(header.imports_count) * sizeof(Pkg_Name);
+	}
+
+	inline static Pkg_Header
+	image_header(const Pkg& self)
+	{
+		// the version says how big the header is
+		Pkg_Header header{};
+		if (self.file.size >= image_header_size(0))
+			::memcpy(&header, self.file.ptr, image_header_size(0));
+		if (self.file.size >= image_header_size(header.version))
+			::memcpy(&header, self.file.ptr, image_header_size(header.version));
+		return header;
+	}
+
+	inline static bool
+	image_entry(const Pkg& self, const Pkg_Header& header, uint32_t index, Pkg_Entry& entry)
+	{
+		if (index >= header.procs_count)
+			return false;
+		auto entry_size = image_entry_size(header.version);
+		entry = Pkg_Entry{};
+		::memcpy(&entry, self.file.ptr + image_entries_offset(header) + uint64_t(index) * entry_size, entry_size);
+		return range_valid(entry.name_offset, entry.name_size, self.file.size) &&
+			range_valid(entry.code_offset, entry.code_size, self.file.size);
+	}
+
+	// probes the directory of the mapped package, only the probed slots and the found entry
+	// and name are touched, the names are compared in place
+	inline static bool
+	image_find(const Pkg& self, const char* name, size_t name_size, Pkg_Entry& entry, uint32_t& index)
+	{
+		auto header = image_header(self);
+		if (header.slots_count == 0)
+			return false;
+
+		auto hash = name_hash(name, name_size);
+		auto mask = header.slots_count - 1;
+		for (uint32_t i = 0; i < header.slots_count; ++i)
+		{
+			Pkg_Slot slot{};
+			uint64_t slot_index = (hash + i) & mask;
+			::memcpy(&slot, self.file.ptr + image_slots_offset(header) + slot_index * sizeof(slot), sizeof(slot));
+			if (slot.entry == 0)
+				return false;
+			if (slot.hash != hash)
+				continue;
+
+			if (image_entry(self, header, slot.entry - 1, entry) == false)
+				return false;
+			if (entry.name_size == name_size && ::memcmp(self.file.ptr + entry.name_offset, name, name_size) == 0)
+			{
+				index = slot.entry - 1;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// adds the proc to the package's procs, the code is verified once here
+	inline static void
+	procs_add(Pkg& self, const mn::Str& name, const mn::Buf<uint8_t>& code)
+	{
+		if (code_verify(code).err != VERIFY_OK)
+			mn::buf_push(self.unverified, mn::str_clone(name));
+		mn::map_insert(self.procs, name, code);
+	}
+
+	// returns whether the added proc passed code_verify
+	inline static bool
+	procs_verified(const Pkg& self, const mn::Str& name)
+	{
+		for (const auto& unverified: self.unverified)
+			if (unverified == name)
+				return false;
+		return true;
+	}
+
+	// returns whether the proc in the file passed code_verify, it's verified the first time it's
+	// looked up, two threads may race to do it which is fine since they'd get the same answer
+	inline static bool
+	image_verified(const Pkg& self, uint32_t index, const mn::Buf<uint8_t>& code)
+	{
+		auto& verified = self.verified[index];
+		auto state = verified.load(std::memory_order_relaxed);
+		if (state == 0)
+		{
+			state = code_verify(code).err == VERIFY_OK ? 1 : 2;
+			verified.store(state, std::memory_order_relaxed);
+		}
+		return state == 1;
+	}
+
+	// marks the procs whose body doesn't match its digest, they're run from the file
+	static const Code_Body BODY_UNMATCHED{};
+
+	// returns the interned body of the proc in the file or nullptr if it doesn't match its
+	// digest, the intern is asked the first time and its answer is kept in the entry
+	inline static const Code_Body*
+	image_body(const Pkg& self, uint32_t index, const Pkg_Entry& entry, const mn::Buf<uint8_t>& code)
+	{
+		auto& cached = self.bodies[index];
+		auto body = cached.load(std::memory_order_acquire);
+		if (body == nullptr)
+		{
+			body = code_intern_get(self.intern, entry.digest, code);
+			if (body == nullptr)
+				body = &BODY_UNMATCHED;
+			cached.store(body, std::memory_order_release);
+		}
+		return body == &BODY_UNMATCHED ? nullptr : body;
+	}
+
+	// checks the mapped image's header and tables and loads its imports, the procs are left
+	// in place until they're looked up
+	inline static bool
+	image_load(Pkg& self)
+	{
+		auto header = image_header(self);
+		if (header.magic != PKG_MAGIC || header.version < 2 || header.version > PKG_VERSION)
+			return false;
+		if (header.slots_count & (header.slots_count - 1))
+			return false;
+		if (header.slots_count < header.procs_count)
+			return false;
+		if (image_strings_offset(header) > self.file.size)
+			return false;
+		if (header.encoding > BYTECODE_VERSION)
+			return false;
+		if (range_valid(header.rodata_offset, header.rodata_size, self.file.size) == false)
+			return false;
+
+		mn::buf_reserve(self.imports, header.imports_count);
+		for (size_t i = 0; i < header.imports_count; ++i)
+		{
+			Pkg_Name name{};
+			::memcpy(&name, self.file.ptr + image_names_offset(header) + i * sizeof(name), sizeof(name));
+			if (range_valid(name.offset, name.size, self.file.size) == false)
+				return false;
+
+			auto ptr = (const char*)self.file.ptr + name.offset;
+			mn::buf_push(self.imports, mn::str_from_substr(ptr, ptr + name.size));
+		}
+
+		// procs of an older encoding are upgraded right away and the file isn't needed anymore
+		if (header.encoding < BYTECODE_VERSION)
+		{
+			mn::buf_resize(self.rodata, header.rodata_size);
+			if (header.rodata_size > 0)
+				::memcpy(self.rodata.ptr, self.file.ptr + header.rodata_offset, header.rodata_size);
+
+			for (uint32_t i = 0; i < header.procs_count; ++i)
+			{
+				Pkg_Entry entry{};
+				if (image_entry(self, header, i, entry) == false)
+					return false;
+
+				auto name = (const char*)self.file.ptr + entry.name_offset;
+				procs_add(self, mn::str_from_substr(name, name + entry.name_size), code_upgrade(self.file.ptr + entry.code_offset, entry.code_size));
+			}
+			file_map_close(self.file);
+			self.file = file_map_invalid();
+			return true;
+		}
+
+		// the procs in the file are verified lazily the first time they're looked up
+		self.verified = new std::atomic<uint8_t>[header.procs_count]{};
+		self.bodies = new std::atomic<const Code_Body*>[header.procs_count]{};
+		return true;
+	}
+
+	// collects the procs added to the package and the ones in its file
+	inline static mn::Buf<Pkg_Proc>
+	pkg_procs(const Pkg& self)
+	{
+		auto procs = mn::buf_new<Pkg_Proc>();
+		for(auto it = mn::map_begin(self.procs);
+			it != mn::map_end(self.procs);
+			it = mn::map_next(self.procs, it))
+			mn::buf_push(procs, Pkg_Proc{it->key.ptr, it->key.count, it->value.ptr, it->value.count});
+
+		auto header = image_header(self);
+		for (uint32_t i = 0; i < header.procs_count; ++i)
+		{
+			Pkg_Entry entry{};
+			if (image_entry(self, header, i, entry))
+				mn::buf_push(procs, Pkg_Proc{(const char*)self.file.ptr + entry.name_offset, entry.name_size, self.file.ptr + entry.code_offset, entry.code_size});
+		}
+		return procs;
+	}
+
+	// loads packages saved before the header existed
+	inline static void
+	pkg_legacy_load(Pkg& self, const mn::Str& filename)
+	{
+		auto f = mn::file_open(filename, mn::IO_MODE::READ, mn::OPEN_MODE::OPEN_ONLY);
+		assert(f != nullptr);
+		mn_defer(mn::file_close(f));
+
+		// read procs count
+		uint32_t len = 0;
+		mn::stream_read(f, mn::block_from(len));
+		mn::map_reserve(self.procs, len);
+
+		// read each proc
+		for(size_t i = 0; i < len; ++i)
+		{
+			auto name = read_string(f);
+			auto bytes = read_bytes(f);
+			pkg_proc_add(self, name, code_upgrade(bytes.ptr, bytes.count));
+			mn::buf_free(bytes);
+		}
+
+		// read the imports if the package has them
+		len = 0;
+		if (mn::stream_read(f, mn::block_from(len)) == sizeof(len))
+		{
+			mn::buf_reserve(self.imports, len);
+			for (size_t i = 0; i < len; ++i)
+				mn::buf_push(self.imports, read_string(f));
+		}
+	}
+
+	inline static Body_Table
+	body_table_new()
+	{
+		Body_Table self{};
+		self.bodies = mn::buf_new<Pkg_Body>();
+		self.index = mn::map_new<uint64_t, size_t>();
+		return self;
+	}
+
+	inline static void
+	body_table_free(Body_Table& self)
+	{
+		mn::buf_free(self.bodies);
+		mn::map_free(self.index);
+	}
+
+	// returns the index of the body with the same digest as the code, adding it if it's new
+	inline static size_t
+	body_table_add(Body_Table& self, const uint8_t* code, size_t code_size)
+	{
+		auto digest = sha256(code, code_size);
+		auto it = mn::map_lookup(self.index, sha256_prefix(digest));
+		if (it != nullptr && self.bodies[it->value].digest == digest)
+			return it->value;
+
+		// two digests with the same prefix just don't share, which is fine since it won't happen
+		mn::buf_push(self.bodies, Pkg_Body{digest, code, code_size, 0});
+		if (it == nullptr)
+			mn::map_insert(self.index, sha256_prefix(digest), self.bodies.count - 1);
+		return self.bodies.count - 1;
+	}
+
+	inline static void
+	pkg_image_free(Pkg_Image& self)
+	{
+		mn::buf_free(self.procs);
+		mn::buf_free(self.bodies);
+	}
+
+	inline static void
+	destruct(Pkg_Image& self)
+	{
+		pkg_image_free(self);
+	}
+
+	// lays out the package's image and adds its bodies to the body table, the data and the end
+	// of the image are aligned to the alignment
+	inline static Pkg_Image
+	image_plan(const Pkg& pkg, Body_Table& bodies, uint64_t alignment)
+	{
+		Pkg_Image self{};
+		self.pkg = &pkg;
+		self.procs = pkg_procs(pkg);
+		self.bodies = mn::buf_with_count<size_t>(self.procs.count);
+		for (size_t i = 0; i < self.procs.count; ++i)
+			self.bodies[i] = body_table_add(bodies, self.procs[i].code, self.procs[i].code_size);
+
+		auto& header = self.header;
+		header.magic = PKG_MAGIC;
+		header.version = PKG_VERSION;
+		header.procs_count = uint32_t(self.procs.count);
+		header.imports_count = uint32_t(pkg.imports.count);
+		header.encoding = BYTECODE_VERSION;
+		// keep the directory at most half full so probes stay short
+		while (header.slots_count < self.procs.count * 2)
+			header.slots_count = header.slots_count ? header.slots_count * 2 : 1;
+
+		// the tables then the names then the page aligned read only data
+		uint64_t strings_size = 0;
+		for (const auto& proc: self.procs)
+			strings_size += proc.name_size;
+		for (const auto& name: pkg.imports)
+			strings_size += name.count;
+
+		header.rodata_offset = align_up(image_strings_offset(header) + strings_size, alignment);
+		header.rodata_size = pkg_rodata(pkg).count;
+		self.size = align_up(header.rodata_offset + header.rodata_size, alignment);
+		return self;
+	}
+
+	// writes the image at its offset in the out buffer, the bodies should be placed already
+	inline static void
+	image_write(const Pkg_Image& self, const Body_Table& bodies, mn::Buf<uint8_t>& out)
+	{
+		const auto& header = self.header;
+		auto image = out.ptr + self.offset;
+		::memcpy(image, &header, sizeof(header));
+
+		auto rodata = pkg_rodata(*self.pkg);
+		if (rodata.count > 0)
+			::memcpy(image + header.rodata_offset, rodata.ptr, rodata.count);
+
+		uint64_t string_it = image_strings_offset(header);
+		for (size_t i = 0; i < self.procs.count; ++i)
+		{
+			const auto& proc = self.procs[i];
+			const auto& body = bodies.bodies[self.bodies[i]];
+
+			Pkg_Entry entry{};
+			entry.name_offset = uint32_t(string_it);
+			entry.name_size = uint32_t(proc.name_size);
+			entry.code_offset = body.offset - self.offset;
+			entry.code_size = body.code_size;
+			entry.digest = body.digest;
+			::memcpy(image + image_entries_offset(header) + i * sizeof(entry), &entry, sizeof(entry));
+
+			// linear probing for a free slot
+			auto hash = name_hash(proc.name, proc.name_size);
+			auto slot_index = hash & (header.slots_count - 1);
+			while (true)
+			{
+				auto slot_ptr = image + image_slots_offset(header) + slot_index * sizeof(Pkg_Slot);
+				Pkg_Slot slot{};
+				::memcpy(&slot, slot_ptr, sizeof(slot));
+				if (slot.entry == 0)
+				{
+					slot.hash = hash;
+					slot.entry = uint32_t(i + 1);
+					::memcpy(slot_ptr, &slot, sizeof(slot));
+					break;
+				}
+				slot_index = (slot_index + 1) & (header.slots_count - 1);
+			}
+
+			::memcpy(image + string_it, proc.name, proc.name_size);
+			string_it += proc.name_size;
+		}
+
+		const auto& imports = self.pkg->imports;
+		for (size_t i = 0; i < imports.count; ++i)
+		{
+			Pkg_Name name{};
+			name.offset = uint32_t(string_it);
+			name.size = uint32_t(imports[i].count);
+			::memcpy(image + image_names_offset(header) + i * sizeof(name), &name, sizeof(name));
+
+			::memcpy(image + string_it, imports[i].ptr, imports[i].count);
+			string_it += imports[i].count;
+		}
+	}
+
+	// lays out the images one after the other starting at the offset then all of their bodies,
+	// each one starting at an aligned offset, and writes them into the out buffer
+	inline static void
+	images_write(mn::Buf<Pkg_Image>& images, Body_Table& bodies, uint64_t offset, uint64_t alignment, mn::Buf<uint8_t>& out)
+	{
+		uint64_t size = offset;
+		for (auto& image: images)
+		{
+			image.offset = size;
+			size += image.size;
+		}
+		for (auto& body: bodies.bodies)
+		{
+			body.offset = size;
+			size = align_up(size + body.code_size, alignment);
+		}
+
+		auto begin = out.count;
+		mn::buf_resize(out, size);
+		::memset(out.ptr + begin, 0, out.count - begin);
+
+		for (const auto& image: images)
+			image_write(image, bodies, out);
+		for (const auto& body: bodies.bodies)
+			if (body.code_size > 0)
+				::memcpy(out.ptr + body.offset, body.code, body.code_size);
+	}
+
+	// compressed packages are a header, a table of blocks, then the blocks, the image they make
+	// is a package image with its data and bodies aligned to 16 bytes instead of pages since it's
+	// not mapped, its tables and names and data are one block and every body is a block of its own
+	constexpr uint64_t PKG_Z_ALIGNMENT = 16;
+	// smaller images are decompressed by the loading thread alone
+	constexpr uint64_t PKG_Z_PARALLEL_SIZE = 256 * 1024;
+	constexpr size_t PKG_Z_THREADS_MAX = 16;
+
+	struct Pkg_Z_Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		// size of the decompressed image, it's allocated once up front
+		uint64_t image_size;
+		uint32_t blocks_count;
+		uint32_t reserved;
+	};
+
+	struct Pkg_Z_Block
+	{
+		// where the block goes in the image
+		uint64_t raw_offset;
+		uint64_t raw_size;
+		// where the block is in the file, a block which doesn't get any smaller is stored as is
+		// and its size is the raw size
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct Pkg_Z_Decoder
+	{
+		const uint8_t* file;
+		uint8_t* image;
+		const Pkg_Z_Block* blocks;
+		size_t blocks_count;
+		std::atomic<size_t> next;
+		std::atomic<bool> ok;
+	};
+
+	// decodes blocks until there are none left, every thread decoding the package runs it
+	inline static void
+	pkg_z_decode(Pkg_Z_Decoder* self)
+	{
+		for (size_t i = self->next.fetch_add(1); i < self->blocks_count; i = self->next.fetch_add(1))
+		{
+			const auto& block = self->blocks[i];
+			if (block.size == block.raw_size)
+			{
+				if (block.size > 0)
+					::memcpy(self->image + block.raw_offset, self->file + block.offset, block.size);
+			}
+			else if (lz_decompress(self->file + block.offset, block.size, self->image + block.raw_offset, block.raw_size) == false)
+			{
+				self->ok = false;
+			}
+		}
+	}
+
+	// decompresses the file into the package's image, the file is a view of the image after that,
+	// the table is checked up front so decoders only have the blocks' bytes to worry about
+	inline static bool
+	pkg_z_unpack(Pkg& self)
+	{
+		Pkg_Z_Header header{};
+		if (self.file.size < sizeof(header))
+			return false;
+		::memcpy(&header, self.file.ptr, sizeof(header));
+		if (header.magic != PKG_Z_MAGIC || header.version != PKG_Z_VERSION)
+			return false;
+		if (range_valid(sizeof(header), uint64_t(header.blocks_count) * sizeof(Pkg_Z_Block), self.file.size) == false)
+			return false;
+		// a block can't grow more than 255 times, which bounds the image allocation
+		if (header.image_size / 255 > self.file.size)
+			return false;
+
+		auto blocks = mn::buf_with_count<Pkg_Z_Block>(header.blocks_count);
+		mn_defer(mn::buf_free(blocks));
+		if (blocks.count > 0)
+			::memcpy(blocks.ptr, self.file.ptr + sizeof(header), blocks.count * sizeof(Pkg_Z_Block));
+
+		uint64_t raw_end = 0;
+		for (const auto& block: blocks)
+		{
+			if (block.raw_offset < raw_end || block.size > block.raw_size)
+				return false;
+			if (range_valid(block.raw_offset, block.raw_size, header.image_size) == false ||
+				range_valid(block.offset, block.size, self.file.size) == false)
+				return false;
+			raw_end = block.raw_offset + block.raw_size;
+		}
+
+		// the gaps between the blocks are padding
+		self.image = mn::buf_with_count<uint8_t>(header.image_size);
+		if (self.image.count > 0)
+			::memset(self.image.ptr, 0, self.image.count);
+
+		Pkg_Z_Decoder decoder{};
+		decoder.file = self.file.ptr;
+		decoder.image = self.image.ptr;
+		decoder.blocks = blocks.ptr;
+		decoder.blocks_count = blocks.count;
+		decoder.next = 0;
+		decoder.ok = true;
+
+		size_t threads_count = 0;
+		if (header.image_size >= PKG_Z_PARALLEL_SIZE)
+		{
+			threads_count = std::thread::hardware_concurrency();
+			if (threads_count > blocks.count)
+				threads_count = blocks.count;
+			if (threads_count > PKG_Z_THREADS_MAX)
+				threads_count = PKG_Z_THREADS_MAX;
+			if (threads_count > 0)
+				--threads_count;
+		}
+
+		std::thread threads[PKG_Z_THREADS_MAX];
+		for (size_t i = 0; i < threads_count; ++i)
+			threads[i] = std::thread(pkg_z_decode, &decoder);
+		pkg_z_decode(&decoder);
+		for (size_t i = 0; i < threads_count; ++i)
+			threads[i].join();
+
+		if (decoder.ok == false)
+			return false;
+
+		file_map_close(self.file);
+		self.file = file_map_view(self.image.ptr, self.image.count);
+		return true;
+	}
+
+	inline static void
+	file_write(const mn::Str& filename, const mn::Buf<uint8_t>& bytes)
+	{
+		auto f = mn::file_open(filename, mn::IO_MODE::WRITE, mn::OPEN_MODE::CREATE_OVERWRITE);
+		assert(f != nullptr);
+		mn_defer(mn::file_close(f));
+		mn::stream_write(f, mn::block_from(bytes));
+	}
+
+	inline static uint32_t
+	file_magic(const File_Map& file)
+	{
+		uint32_t magic = 0;
+		if (file.size >= sizeof(magic))
+			::memcpy(&magic, file.ptr, sizeof(magic));
+		return magic;
+	}
+
+	// loads the package from its file, which is mapped or a view already, a broken package or one
+	// from an unsupported version loads empty
+	inline static Pkg
+	pkg_open(Pkg& self)
+	{
+		bool loaded = false;
+		if (file_magic(self.file) == PKG_Z_MAGIC)
+			loaded = pkg_z_unpack(self) && image_load(self);
+		else
+			loaded = image_load(self);
+
+		if (loaded == false)
+		{
+			pkg_free(self);
+			return pkg_new();
+		}
+		return self;
+	}
+
 	// API
 	Pkg
 	pkg_new()
 	{
 		Pkg self{};
 		self.procs = mn::map_new<mn::Str, mn::Buf<uint8_t>>();
+		self.imports = mn::buf_new<mn::Str>();
+		self.rodata = mn::buf_new<uint8_t>();
+		self.file = file_map_invalid();
+		self.intern = nullptr;
+		self.image = mn::buf_new<uint8_t>();
+		self.verified = nullptr;
+		self.bodies = nullptr;
+		self.unverified = mn::buf_new<mn::Str>();
 		return self;
 	}
 
@@ -60,37 +880,153 @@ namespace vm
 	pkg_free(Pkg& self)
 	{
 		destruct(self.procs);
+		destruct(self.imports);
+		mn::buf_free(self.rodata);
+		file_map_close(self.file);
+		mn::buf_free(self.image);
+		delete[] self.verified;
+		delete[] self.bodies;
+		destruct(self.unverified);
 	}
 
 	bool
 	pkg_proc_add(Pkg& self, const mn::Str& name, const mn::Buf<uint8_t>& bytes)
 	{
-		if (mn::map_lookup(self.procs, name) != nullptr)
+		Pkg_Entry entry{};
+		uint32_t index = 0;
+		if (mn::map_lookup(self.procs, name) != nullptr || image_find(self, name.ptr, name.count, entry, index))
 			return false;
 
-		mn::map_insert(self.procs, name, bytes);
+		procs_add(self, name, bytes);
 		return true;
 	}
 
+	void
+	pkg_code_intern_attach(Pkg& self, Code_Intern intern)
+	{
+		if (self.bodies != nullptr && self.intern != intern)
+			for (uint32_t i = 0; i < image_header(self).procs_count; ++i)
+				self.bodies[i].store(nullptr, std::memory_order_relaxed);
+		self.intern = intern;
+	}
+
+	uint32_t
+	pkg_import(Pkg& self, const mn::Str& name)
+	{
+		for (size_t i = 0; i < self.imports.count; ++i)
+			if (self.imports[i] == name)
+				return uint32_t(i);
+
+		mn::buf_push(self.imports, mn::str_clone(name));
+		return uint32_t(self.imports.count - 1);
+	}
+
+	uint32_t
+	pkg_data_add(Pkg& self, const void* ptr, size_t size, size_t alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+		// the data in the file is copied out the first time more data is added after it
+		if (self.rodata.count == 0)
+		{
+			auto loaded = pkg_rodata(self);
+			mn::buf_resize(self.rodata, loaded.count);
+			if (loaded.count > 0)
+				::memcpy(self.rodata.ptr, loaded.ptr, loaded.count);
+		}
+
+		// a linear scan is fine for the few kilobytes of constants a package usually has, and
+		// it catches blocks which are a part of a bigger one as well
+		for (uint64_t offset = 0; offset + size <= self.rodata.count; offset += alignment)
+			if (::memcmp(self.rodata.ptr + offset, ptr, size) == 0)
+				return uint32_t(offset);
+
+		uint64_t offset = align_up(self.rodata.count, alignment);
+		assert(offset + size <= UINT32_MAX);
+		auto end = self.rodata.count;
+		mn::buf_resize(self.rodata, offset + size);
+		::memset(self.rodata.ptr + end, 0, offset - end);
+		if (size > 0)
+			::memcpy(self.rodata.ptr + offset, ptr, size);
+		return uint32_t(offset);
+	}
+
+	mn::Buf<uint8_t>
+	pkg_rodata(const Pkg& self)
+	{
+		if (self.rodata.count > 0)
+			return code_view(self.rodata.ptr, self.rodata.count);
+
+		auto header = image_header(self);
+		if (header.rodata_size == 0)
+			return mn::Buf<uint8_t>{};
+		return code_view(self.file.ptr + header.rodata_offset, header.rodata_size);
+	}
+
 	void
 	pkg_save(const Pkg& self, const mn::Str& filename)
 	{
-		auto f = mn::file_open(filename, mn::IO_MODE::WRITE, mn::OPEN_MODE::CREATE_OVERWRITE);
-		assert(f != nullptr);
-		mn_defer(mn::file_close(f));
+		auto bodies = body_table_new();
+		mn_defer(body_table_free(bodies));
 
-		// write procs count
-		uint32_t len = uint32_t(self.procs.count);
-		mn::stream_write(f, mn::block_from(len));
+		auto images = mn::buf_new<Pkg_Image>();
+		mn_defer(destruct(images));
+		mn::buf_push(images, image_plan(self, bodies, PKG_PAGE_SIZE));
 
-		// write each proc
-		for(auto it = mn::map_begin(self.procs);
-			it != mn::map_end(self.procs);
-			it = mn::map_next(self.procs, it))
+		auto out = mn::buf_new<uint8_t>();
+		mn_defer(mn::buf_free(out));
+		images_write(images, bodies, 0, PKG_PAGE_SIZE, out);
+
+		file_write(filename, out);
+	}
+
+	void
+	pkg_save_compressed(const Pkg& self, const mn::Str& filename)
+	{
+		auto bodies = body_table_new();
+		mn_defer(body_table_free(bodies));
+
+		auto images = mn::buf_new<Pkg_Image>();
+		mn_defer(destruct(images));
+		mn::buf_push(images, image_plan(self, bodies, PKG_Z_ALIGNMENT));
+
+		auto image = mn::buf_new<uint8_t>();
+		mn_defer(mn::buf_free(image));
+		images_write(images, bodies, 0, PKG_Z_ALIGNMENT, image);
+
+		auto blocks = mn::buf_new<Pkg_Z_Block>();
+		mn_defer(mn::buf_free(blocks));
+		mn::buf_push(blocks, Pkg_Z_Block{0, images[0].size, 0, 0});
+		for (const auto& body: bodies.bodies)
+			if (body.code_size > 0)
+				mn::buf_push(blocks, Pkg_Z_Block{body.offset, body.code_size, 0, 0});
+
+		Pkg_Z_Header header{};
+		header.magic = PKG_Z_MAGIC;
+		header.version = PKG_Z_VERSION;
+		header.image_size = image.count;
+		header.blocks_count = uint32_t(blocks.count);
+
+		auto out = mn::buf_with_count<uint8_t>(sizeof(header) + blocks.count * sizeof(Pkg_Z_Block));
+		mn_defer(mn::buf_free(out));
+		for (auto& block: blocks)
 		{
-			write_string(f, it->key);
-			write_bytes(f, it->value);
+			auto begin = out.count;
+			mn::buf_resize(out, begin + lz_compress_bound(block.raw_size));
+			block.offset = begin;
+			block.size = lz_compress(image.ptr + block.raw_offset, block.raw_size, out.ptr + begin, out.count - begin);
+			if (block.size == 0 || block.size >= block.raw_size)
+			{
+				block.size = block.raw_size;
+				if (block.size > 0)
+					::memcpy(out.ptr + begin, image.ptr + block.raw_offset, block.size);
+			}
+			mn::buf_resize(out, begin + block.size);
 		}
+		::memcpy(out.ptr, &header, sizeof(header));
+		::memcpy(out.ptr + sizeof(header), blocks.ptr, blocks.count * sizeof(Pkg_Z_Block));
+
+		file_write(filename, out);
 	}
 
 	Pkg
@@ -98,37 +1034,219 @@ namespace vm
 	{
 		auto self = pkg_new();
 
-		auto f = mn::file_open(filename, mn::IO_MODE::READ, mn::OPEN_MODE::OPEN_ONLY);
-		assert(f != nullptr);
-		mn_defer(mn::file_close(f));
+		self.file = file_map_read(filename.ptr);
+		assert(file_map_valid(self.file));
 
-		// read procs count
-		uint32_t len = 0;
-		mn::stream_read(f, mn::block_from(len));
-		mn::map_reserve(self.procs, len);
+		auto magic = file_magic(self.file);
+		if (magic == PKG_MAGIC || magic == PKG_Z_MAGIC)
+			return pkg_open(self);
 
-		// read each proc
-		for(size_t i = 0; i < len; ++i)
+		// an older package, read it the old way
+		file_map_close(self.file);
+		pkg_legacy_load(self, filename);
+		return self;
+	}
+
+	Pkg
+	pkg_from_memory(const void* ptr, size_t size)
+	{
+		auto self = pkg_new();
+		self.file = file_map_view((uint8_t*)ptr, size);
+		return pkg_open(self);
+	}
+
+	mn::Buf<mn::Str>
+	pkg_proc_names(const Pkg& self)
+	{
+		auto procs = pkg_procs(self);
+		mn_defer(mn::buf_free(procs));
+
+		auto names = mn::buf_with_capacity<mn::Str>(procs.count);
+		for (const auto& proc: procs)
+			mn::buf_push(names, mn::str_from_substr(proc.name, proc.name + proc.name_size));
+		return names;
+	}
+
+	Proc_Handle
+	proc_handle_get(const Pkg& self, const mn::Str& name)
+	{
+		Proc_Handle handle{};
+		Pkg_Entry entry{};
+		uint32_t index = 0;
+		if (auto it = mn::map_lookup(self.procs, name))
 		{
-			auto name = read_string(f);
-			auto bytes = read_bytes(f);
-			pkg_proc_add(self, name, bytes);
+			handle.code = code_view(it->value.ptr, it->value.count);
+			handle.verified = procs_verified(self, name);
 		}
+		else if (image_find(self, name.ptr, name.count, entry, index))
+		{
+			handle.code = code_view(self.file.ptr + entry.code_offset, entry.code_size);
+			// packages before version 4 have no digests to intern their bodies by
+			if (self.intern != nullptr && image_header(self).version >= 4)
+			{
+				// a body which doesn't match its digest is run from the file without being shared
+				if (auto body = image_body(self, index, entry, handle.code))
+				{
+					handle.code = code_view(body->code.ptr, body->code.count);
+					handle.blocks = &body->blocks;
+					handle.verified = body->verified;
+				}
+			}
 
-		return self;
+			if (handle.blocks == nullptr)
+				handle.verified = image_verified(self, index, handle.code);
+		}
+
+		if (proc_handle_valid(handle))
+			handle.rodata = pkg_rodata(self);
+		return handle;
+	}
+
+	Proc
+	pkg_proc_new(const Pkg& self, const mn::Str& name)
+	{
+		auto handle = proc_handle_get(self, name);
+		if (proc_handle_valid(handle) == false)
+			return nullptr;
+		return proc_new(handle.code, handle.rodata);
 	}
 
 	mn::Buf<uint8_t>
 	pkg_load_proc(const Pkg& self, const mn::Str& name)
 	{
-		// this function could do other stuff but for now we just search the procs for main proc
-		for(auto it = mn::map_begin(self.procs);
-			it != mn::map_end(self.procs);
-			it = mn::map_next(self.procs, it))
+		// this function could do other stuff but for now we just copy the proc's bytecode
+		return mn::buf_clone(proc_handle_get(self, name).code);
+	}
+
+	Bundle
+	bundle_new()
+	{
+		Bundle self{};
+		self.pkgs = mn::map_new<mn::Str, Pkg>();
+		self.file = file_map_invalid();
+		return self;
+	}
+
+	void
+	bundle_free(Bundle& self)
+	{
+		destruct(self.pkgs);
+		file_map_close(self.file);
+	}
+
+	bool
+	bundle_pkg_add(Bundle& self, const mn::Str& name, const Pkg& pkg)
+	{
+		if (mn::map_lookup(self.pkgs, name) != nullptr)
+			return false;
+
+		mn::map_insert(self.pkgs, name, pkg);
+		return true;
+	}
+
+	Pkg*
+	bundle_pkg(Bundle& self, const mn::Str& name)
+	{
+		if (auto it = mn::map_lookup(self.pkgs, name))
+			return &it->value;
+		return nullptr;
+	}
+
+	void
+	bundle_save(const Bundle& self, const mn::Str& filename)
+	{
+		auto bodies = body_table_new();
+		mn_defer(body_table_free(bodies));
+
+		auto images = mn::buf_new<Pkg_Image>();
+		mn_defer(destruct(images));
+
+		Bundle_Header header{};
+		header.magic = BUNDLE_MAGIC;
+		header.version = BUNDLE_VERSION;
+		header.pkgs_count = uint32_t(self.pkgs.count);
+
+		// the header then the table of packages and their names then the page aligned images
+		uint64_t strings_offset = sizeof(header) + uint64_t(header.pkgs_count) * sizeof(Bundle_Entry);
+		uint64_t strings_size = 0;
+		for(auto it = mn::map_begin(self.pkgs);
+			it != mn::map_end(self.pkgs);
+			it = mn::map_next(self.pkgs, it))
+		{
+			strings_size += it->key.count;
+			mn::buf_push(images, image_plan(it->value, bodies, PKG_PAGE_SIZE));
+		}
+
+		auto out = mn::buf_with_count<uint8_t>(align_up(strings_offset + strings_size, PKG_PAGE_SIZE));
+		mn_defer(mn::buf_free(out));
+		::memset(out.ptr, 0, out.count);
+		images_write(images, bodies, out.count, PKG_PAGE_SIZE, out);
+		::memcpy(out.ptr, &header, sizeof(header));
+
+		uint64_t string_it = strings_offset;
+		size_t i = 0;
+		for(auto it = mn::map_begin(self.pkgs);
+			it != mn::map_end(self.pkgs);
+			it = mn::map_next(self.pkgs, it), ++i)
+		{
+			Bundle_Entry entry{};
+			entry.name_offset = uint32_t(string_it);
+			entry.name_size = uint32_t(it->key.count);
+			entry.image_offset = images[i].offset;
+			::memcpy(out.ptr + sizeof(header) + i * sizeof(entry), &entry, sizeof(entry));
+
+			::memcpy(out.ptr + string_it, it->key.ptr, it->key.count);
+			string_it += it->key.count;
+		}
+
+		file_write(filename, out);
+	}
+
+	Bundle
+	bundle_load(const mn::Str& filename)
+	{
+		auto self = bundle_new();
+
+		self.file = file_map_read(filename.ptr);
+		assert(file_map_valid(self.file));
+
+		Bundle_Header header{};
+		if (self.file.size >= sizeof(header))
+			::memcpy(&header, self.file.ptr, sizeof(header));
+
+		// a broken bundle or one from an unsupported version loads empty
+		bool valid = header.magic == BUNDLE_MAGIC &&
+			header.version == BUNDLE_VERSION &&
+			range_valid(sizeof(header), uint64_t(header.pkgs_count) * sizeof(Bundle_Entry), self.file.size);
+		for (uint32_t i = 0; valid && i < header.pkgs_count; ++i)
+		{
+			Bundle_Entry entry{};
+			::memcpy(&entry, self.file.ptr + sizeof(header) + i * sizeof(entry), sizeof(entry));
+			if (range_valid(entry.name_offset, entry.name_size, self.file.size) == false ||
+				entry.image_offset > self.file.size)
+			{
+				valid = false;
+				break;
+			}
+
+			// the package's image runs to the end of the file since that's where the bodies are
+			auto pkg = pkg_new();
+			pkg.file = file_map_view(self.file.ptr + entry.image_offset, self.file.size - entry.image_offset);
+			auto name_ptr = (const char*)self.file.ptr + entry.name_offset;
+			auto name = mn::str_from_substr(name_ptr, name_ptr + entry.name_size);
+			if (image_load(pkg) == false || bundle_pkg_add(self, name, pkg) == false)
+			{
+				mn::str_free(name);
+				pkg_free(pkg);
+				valid = false;
+			}
+		}
+
+		if (valid == false)
 		{
-			if (it->key == name)
-				return mn::buf_clone(it->value);
+			bundle_free(self);
+			self = bundle_new();
 		}
-		return mn::buf_new<uint8_t>();
+		return self;
 	}
-}
+}
\ No newline at end of file
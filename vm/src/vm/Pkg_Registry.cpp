@@ -0,0 +1,166 @@
+#include "vm/Pkg_Registry.h"
+#include "vm/Util.h"
+
+#include <mn/Buf.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace vm
+{
+	// pins are on their own cache lines so threads pinning and releasing don't false share
+	struct alignas(CACHE_LINE_SIZE) Pin
+	{
+		// epoch the pin is taken in, 0 if it's free
+		std::atomic<uint64_t> epoch;
+	};
+
+	struct Retired
+	{
+		Pkg* pkg;
+		// epoch the package is swapped out in, pins from it or before might still be using it
+		uint64_t epoch;
+	};
+
+	struct IPkg_Registry
+	{
+		alignas(CACHE_LINE_SIZE) std::atomic<Pkg*> current;
+		alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> epoch;
+		Pin* pins;
+		size_t pins_count;
+		// swaps and reclaims take turns on it, calls never take it
+		std::mutex mtx;
+		mn::Buf<Retired> retired;
+	};
+
+	// threads start looking for a free pin at different places so they don't fight over the first ones
+	inline static size_t
+	pin_hint()
+	{
+		static std::atomic<size_t> threads_count{0};
+		thread_local size_t hint = threads_count.fetch_add(1, std::memory_order_relaxed);
+		return hint;
+	}
+
+	inline static void
+	pkg_delete(Pkg* pkg)
+	{
+		pkg_free(*pkg);
+		delete pkg;
+	}
+
+	// frees the retired versions older than every pin, the mutex should be held
+	inline static size_t
+	registry_reclaim(Pkg_Registry self)
+	{
+		uint64_t min_epoch = UINT64_MAX;
+		for (size_t i = 0; i < self->pins_count; ++i)
+		{
+			auto epoch = self->pins[i].epoch.load();
+			if (epoch != 0 && epoch < min_epoch)
+				min_epoch = epoch;
+		}
+
+		size_t freed = 0;
+		for (size_t i = 0; i < self->retired.count;)
+		{
+			if (self->retired[i].epoch < min_epoch)
+			{
+				pkg_delete(self->retired[i].pkg);
+				mn::buf_remove(self->retired, i);
+				++freed;
+			}
+			else
+			{
+				++i;
+			}
+		}
+		return freed;
+	}
+
+	// API
+	Pkg_Registry
+	pkg_registry_new(const Pkg& pkg, size_t pins_count)
+	{
+		if (pins_count == 0)
+			pins_count = std::thread::hardware_concurrency() * 4;
+		if (pins_count == 0)
+			pins_count = 4;
+
+		auto self = new IPkg_Registry;
+		self->current = new Pkg{pkg};
+		// 0 marks the free pins so the epochs start at 1
+		self->epoch = 1;
+		self->pins = new Pin[pins_count];
+		self->pins_count = pins_count;
+		for (size_t i = 0; i < pins_count; ++i)
+			self->pins[i].epoch = 0;
+		self->retired = mn::buf_new<Retired>();
+		return self;
+	}
+
+	void
+	pkg_registry_free(Pkg_Registry self)
+	{
+		for (auto& retired: self->retired)
+			pkg_delete(retired.pkg);
+		mn::buf_free(self->retired);
+		pkg_delete(self->current.load());
+		delete[] self->pins;
+		delete self;
+	}
+
+	Pkg_Ref
+	pkg_registry_acquire(Pkg_Registry self)
+	{
+		// the epoch is read before the pin is taken and the pin is taken before the current version
+		// is read, so a pin which could see the old version has the epoch it's retired with or
+		// an older one, and the swap which retires it sees the pin
+		auto epoch = self->epoch.load();
+		auto start = pin_hint() % self->pins_count;
+		for (size_t i = start;;)
+		{
+			uint64_t free = 0;
+			auto& pin = self->pins[i];
+			if (pin.epoch.load(std::memory_order_relaxed) == 0 && pin.epoch.compare_exchange_strong(free, epoch))
+				return Pkg_Ref{self->current.load(), i};
+
+			i = (i + 1) % self->pins_count;
+			if (i == start)
+				std::this_thread::yield();
+		}
+	}
+
+	void
+	pkg_registry_release(Pkg_Registry self, const Pkg_Ref& ref)
+	{
+		self->pins[ref.pin].epoch.store(0, std::memory_order_release);
+	}
+
+	void
+	pkg_registry_swap(Pkg_Registry self, const Pkg& pkg)
+	{
+		auto next = new Pkg{pkg};
+
+		std::lock_guard<std::mutex> lock(self->mtx);
+		auto prev = self->current.exchange(next);
+		auto epoch = self->epoch.fetch_add(1);
+		mn::buf_push(self->retired, Retired{prev, epoch});
+		registry_reclaim(self);
+	}
+
+	size_t
+	pkg_registry_reclaim(Pkg_Registry self)
+	{
+		std::lock_guard<std::mutex> lock(self->mtx);
+		return registry_reclaim(self);
+	}
+
+	size_t
+	pkg_registry_retired_count(Pkg_Registry self)
+	{
+		std::lock_guard<std::mutex> lock(self->mtx);
+		return self->retired.count;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "vm/Proc.h"
+#include "vm/Verify.h"
+
+#include <atomic>
+
+namespace vm
+{
+	struct IProc
+	{
+		std::atomic<size_t> ref_count;
+		mn::Buf<uint8_t> code;
+		mn::Buf<uint8_t> rodata;
+		Blocks blocks;
+		bool verified;
+	};
+
+	// API
+	Proc
+	proc_new(const mn::Buf<uint8_t>& code, const mn::Buf<uint8_t>& rodata)
+	{
+		auto self = new IProc;
+		self->ref_count.store(1, std::memory_order_relaxed);
+		self->code = mn::buf_clone(code);
+		self->rodata = mn::buf_clone(rodata);
+		self->blocks = blocks_build(self->code);
+		self->verified = code_verify(self->code).err == VERIFY_OK;
+		return self;
+	}
+
+	Proc
+	proc_ref(Proc self)
+	{
+		self->ref_count.fetch_add(1, std::memory_order_relaxed);
+		return self;
+	}
+
+	void
+	proc_unref(Proc self)
+	{
+		if (self->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			mn::buf_free(self->code);
+			mn::buf_free(self->rodata);
+			blocks_free(self->blocks);
+			delete self;
+		}
+	}
+
+	const mn::Buf<uint8_t>&
+	proc_code(Proc self)
+	{
+		return self->code;
+	}
+
+	const mn::Buf<uint8_t>&
+	proc_rodata(Proc self)
+	{
+		return self->rodata;
+	}
+
+	const Blocks&
+	proc_blocks(Proc self)
+	{
+		return self->blocks;
+	}
+
+	bool
+	proc_verified(Proc self)
+	{
+		return self->verified;
+	}
+}
\ No newline at end of file
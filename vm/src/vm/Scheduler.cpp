@@ -0,0 +1,724 @@
+#include "vm/Scheduler.h"
+
+#include <mn/Memory.h>
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace vm
+{
+	// parking protocol of a job waiting on a host call, the worker and the resuming thread both
+	// exchange the state and whoever comes second puts the job back into the scheduler
+	enum PARK
+	{
+		PARK_RUNNING,
+		PARK_PARKED,
+		PARK_RESUMED
+	};
+
+	struct IJob
+	{
+		Core core;
+		const mn::Buf<uint8_t>* code;
+		// only metered jobs have blocks
+		const Blocks* blocks;
+		// the proc the code and blocks are from, if the job holds a reference to one
+		Proc proc;
+		// whether the code passed code_verify so it runs without checks
+		bool verified;
+		uint64_t ins_count;
+		IScheduler* scheduler;
+		// intrusive link used by the worker's inbox queue
+		std::atomic<IJob*> next;
+		// one reference for the submitter's handle and one for the scheduler
+		std::atomic<int> ref_count;
+		std::atomic<bool> done;
+		std::atomic<int> park;
+		// result of the pending host call, it's handed to the core when the job runs again
+		Reg_Val result;
+		// parks the job on the channel it's blocked on
+		Chan_Waiter waiter;
+	};
+
+	inline static void
+	job_chan_wake(void* user);
+
+	inline static IJob*
+	job_new(IScheduler* scheduler, const mn::Buf<uint8_t>* code, const Blocks* blocks, const Core& core)
+	{
+		auto self = new IJob;
+		self->core = core;
+		self->code = code;
+		self->blocks = blocks;
+		self->proc = nullptr;
+		self->verified = false;
+		self->ins_count = 0;
+		self->scheduler = scheduler;
+		self->next.store(nullptr, std::memory_order_relaxed);
+		self->ref_count.store(2, std::memory_order_relaxed);
+		self->done.store(false, std::memory_order_relaxed);
+		self->park.store(PARK_RUNNING, std::memory_order_relaxed);
+		self->result.u64 = 0;
+		self->waiter = Chan_Waiter{job_chan_wake, self, nullptr};
+		return self;
+	}
+
+	inline static void
+	job_unref(IJob* self)
+	{
+		if (self->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			core_free(self->core);
+			if (self->proc != nullptr)
+				proc_unref(self->proc);
+			delete self;
+		}
+	}
+
+
+	// chase-lev work stealing deque, based on "Correct and Efficient Work-Stealing for
+	// Weak Memory Models" by Lê et al. only the owner pushes and takes from the bottom
+	// other workers steal from the top
+	struct Ring
+	{
+		int64_t cap;
+		std::atomic<IJob*>* items;
+	};
+
+	inline static Ring*
+	ring_new(int64_t cap)
+	{
+		auto self = new Ring;
+		self->cap = cap;
+		self->items = new std::atomic<IJob*>[size_t(cap)];
+		return self;
+	}
+
+	inline static void
+	ring_free(Ring* self)
+	{
+		delete[] self->items;
+		delete self;
+	}
+
+	inline static IJob*
+	ring_get(Ring* self, int64_t i)
+	{
+		return self->items[i & (self->cap - 1)].load(std::memory_order_relaxed);
+	}
+
+	inline static void
+	ring_put(Ring* self, int64_t i, IJob* job)
+	{
+		self->items[i & (self->cap - 1)].store(job, std::memory_order_relaxed);
+	}
+
+	struct Deque
+	{
+		std::atomic<int64_t> top;
+		std::atomic<int64_t> bottom;
+		std::atomic<Ring*> ring;
+		// old rings can still be read by a concurrent steal so we keep them until the end
+		mn::Buf<Ring*> retired;
+	};
+
+	inline static void
+	deque_init(Deque& self)
+	{
+		self.top.store(0, std::memory_order_relaxed);
+		self.bottom.store(0, std::memory_order_relaxed);
+		self.ring.store(ring_new(256), std::memory_order_relaxed);
+		self.retired = mn::buf_new<Ring*>();
+	}
+
+	inline static void
+	deque_dispose(Deque& self)
+	{
+		ring_free(self.ring.load(std::memory_order_relaxed));
+		for (auto ring: self.retired)
+			ring_free(ring);
+		mn::buf_free(self.retired);
+	}
+
+	inline static void
+	deque_push(Deque& self, IJob* job)
+	{
+		int64_t b = self.bottom.load(std::memory_order_relaxed);
+		int64_t t = self.top.load(std::memory_order_acquire);
+		Ring* ring = self.ring.load(std::memory_order_relaxed);
+		if (b - t > ring->cap - 1)
+		{
+			auto bigger = ring_new(ring->cap * 2);
+			for (int64_t i = t; i < b; ++i)
+				ring_put(bigger, i, ring_get(ring, i));
+			mn::buf_push(self.retired, ring);
+			self.ring.store(bigger, std::memory_order_release);
+			ring = bigger;
+		}
+		ring_put(ring, b, job);
+		std::atomic_thread_fence(std::memory_order_release);
+		self.bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	inline static IJob*
+	deque_take(Deque& self)
+	{
+		int64_t b = self.bottom.load(std::memory_order_relaxed) - 1;
+		Ring* ring = self.ring.load(std::memory_order_relaxed);
+		self.bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = self.top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			// deque is empty
+			self.bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		IJob* job = ring_get(ring, b);
+		if (t == b)
+		{
+			// last item, race against the thieves for it
+			if (self.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) == false)
+				job = nullptr;
+			self.bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	inline static IJob*
+	deque_steal(Deque& self)
+	{
+		int64_t t = self.top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = self.bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+
+		Ring* ring = self.ring.load(std::memory_order_acquire);
+		IJob* job = ring_get(ring, t);
+		if (self.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) == false)
+			return nullptr;
+		return job;
+	}
+
+
+	// inbox is an intrusive multi-producer single-consumer queue (vyukov's), it's how
+	// other threads hand jobs to a worker since they can't push into its deque
+	struct Inbox
+	{
+		std::atomic<IJob*> head;
+		IJob* tail;
+		IJob* stub;
+	};
+
+	inline static void
+	inbox_init(Inbox& self)
+	{
+		self.stub = new IJob;
+		self.stub->next.store(nullptr, std::memory_order_relaxed);
+		self.head.store(self.stub, std::memory_order_relaxed);
+		self.tail = self.stub;
+	}
+
+	inline static void
+	inbox_dispose(Inbox& self)
+	{
+		delete self.stub;
+	}
+
+	inline static void
+	inbox_push(Inbox& self, IJob* job)
+	{
+		job->next.store(nullptr, std::memory_order_relaxed);
+		IJob* prev = self.head.exchange(job, std::memory_order_acq_rel);
+		prev->next.store(job, std::memory_order_release);
+	}
+
+	inline static IJob*
+	inbox_pop(Inbox& self)
+	{
+		IJob* tail = self.tail;
+		IJob* next = tail->next.load(std::memory_order_acquire);
+		if (tail == self.stub)
+		{
+			if (next == nullptr)
+				return nullptr;
+			self.tail = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next)
+		{
+			self.tail = next;
+			return tail;
+		}
+
+		// a producer is in the middle of a push, try again later
+		if (tail != self.head.load(std::memory_order_acquire))
+			return nullptr;
+
+		inbox_push(self, self.stub);
+		next = tail->next.load(std::memory_order_acquire);
+		if (next)
+		{
+			self.tail = next;
+			return tail;
+		}
+		return nullptr;
+	}
+
+
+	struct Worker
+	{
+		IScheduler* scheduler;
+		size_t index;
+		Deque deque;
+		Inbox inbox;
+		uint64_t rand_state;
+		// the job the worker is running right now
+		IJob* job;
+		// I/O requests of the worker's jobs go to its own io
+		Io io;
+		size_t jobs_since_flush;
+		std::thread thread;
+	};
+
+	struct IScheduler
+	{
+		mn::Buf<Worker*> workers;
+		uint64_t slice;
+		std::atomic<bool> running;
+		std::atomic<size_t> next_worker;
+		// submitted jobs which are not done yet
+		std::atomic<size_t> pending;
+		// jobs sitting in a deque or an inbox waiting for a worker to pick them up
+		std::atomic<size_t> queued;
+
+		// sleeping workers wait on this, it's only touched when a worker runs out of work
+		std::atomic<size_t> sleeping;
+		std::mutex sleep_mtx;
+		std::condition_variable sleep_cv;
+
+		// threads blocked in job_wait/scheduler_wait wait on this
+		std::atomic<size_t> waiters;
+		std::mutex done_mtx;
+		std::condition_variable done_cv;
+	};
+
+	// count of jobs a worker runs before it flushes its staged I/O requests
+	constexpr size_t WORKER_FLUSH_JOBS = 16;
+
+	static thread_local Worker* CURRENT_WORKER = nullptr;
+
+	inline static uint64_t
+	worker_rand(Worker* self)
+	{
+		// xorshift64
+		uint64_t x = self->rand_state;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		self->rand_state = x;
+		return x;
+	}
+
+	inline static IJob*
+	worker_next_job(Worker* self)
+	{
+		if (auto job = deque_take(self->deque))
+			return job;
+
+		if (auto job = inbox_pop(self->inbox))
+			return job;
+
+		auto scheduler = self->scheduler;
+		size_t count = scheduler->workers.count;
+		if (count < 2)
+			return nullptr;
+
+		// start from a random victim to spread the thieves out
+		size_t start = size_t(worker_rand(self) % count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto victim = scheduler->workers[(start + i) % count];
+			if (victim == self)
+				continue;
+			if (auto job = deque_steal(victim->deque))
+				return job;
+		}
+		return nullptr;
+	}
+
+	inline static IJob*
+	worker_find_job(Worker* self)
+	{
+		auto job = worker_next_job(self);
+		if (job)
+			self->scheduler->queued.fetch_sub(1, std::memory_order_seq_cst);
+		return job;
+	}
+
+	inline static void
+	scheduler_wake(IScheduler* self)
+	{
+		if (self->sleeping.load(std::memory_order_seq_cst) == 0)
+			return;
+
+		// taking the lock ensures the sleeping worker is either before its last work check
+		// or already waiting on the condition variable, so the notification won't be lost
+		std::lock_guard<std::mutex> lock(self->sleep_mtx);
+		self->sleep_cv.notify_one();
+	}
+
+	inline static void
+	scheduler_notify_done(IScheduler* self)
+	{
+		if (self->waiters.load(std::memory_order_seq_cst) == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(self->done_mtx);
+		self->done_cv.notify_all();
+	}
+
+	// puts a runnable job in the queues, jobs coming from a worker go to its own deque, otherwise
+	// we round robin them over the workers' inboxes
+	inline static void
+	scheduler_enqueue(IScheduler* self, IJob* job)
+	{
+		self->queued.fetch_add(1, std::memory_order_seq_cst);
+
+		auto worker = CURRENT_WORKER;
+		if (worker && worker->scheduler == self)
+		{
+			deque_push(worker->deque, job);
+		}
+		else
+		{
+			size_t ix = self->next_worker.fetch_add(1, std::memory_order_relaxed) % self->workers.count;
+			inbox_push(self->workers[ix]->inbox, job);
+		}
+
+		scheduler_wake(self);
+	}
+
+	inline static Job
+	scheduler_push(IScheduler* self, IJob* job)
+	{
+		self->pending.fetch_add(1, std::memory_order_seq_cst);
+		scheduler_enqueue(self, job);
+		return job;
+	}
+
+	inline static void
+	job_chan_wake(void* user)
+	{
+		auto job = (IJob*)user;
+		scheduler_enqueue(job->scheduler, job);
+	}
+
+	inline static void
+	job_io_done(void* user, int64_t result)
+	{
+		Reg_Val res{};
+		res.i64 = result;
+		job_resume((IJob*)user, res);
+	}
+
+	inline static void
+	worker_run_job(Worker* self, IJob* job)
+	{
+		auto scheduler = job->scheduler;
+
+		if (job->core.state == Core::STATE_PENDING)
+		{
+			core_resume(job->core, job->result);
+			job->park.store(PARK_RUNNING, std::memory_order_relaxed);
+		}
+
+		self->job = job;
+		Core::STATE state = Core::STATE_OK;
+		if (job->blocks)
+		{
+			uint64_t budget = scheduler->slice;
+			if (job->verified)
+				state = core_run_for_verified(job->core, *job->code, *job->blocks, budget);
+			else
+				state = core_run_for(job->core, *job->code, *job->blocks, budget);
+			job->ins_count += scheduler->slice - budget;
+		}
+		else
+		{
+			state = core_run(job->core, *job->code);
+		}
+		self->job = nullptr;
+
+		// the job is waiting on a host call or an I/O request, we don't hold on to it, unless
+		// it was resumed before we got the chance to park it
+		if (state == Core::STATE_PENDING)
+		{
+			if (job->core.io.op != IO_OP_NONE)
+				io_submit(self->io, job->core.io, job_io_done, job);
+
+			if (job->park.exchange(PARK_PARKED, std::memory_order_acq_rel) == PARK_RESUMED)
+				scheduler_enqueue(scheduler, job);
+			return;
+		}
+
+		// the job is blocked on a full or an empty channel, it's parked there and the channel
+		// puts it back into the scheduler once someone receives or sends, unless it's ready
+		// already in which case it's retried like a yielded job
+		if (state == Core::STATE_BLOCK &&
+			chan_park(job->core.blocked_chan, &job->waiter, job->core.blocked_send))
+		{
+			return;
+		}
+
+		// the job used up its slice, put it at the back of our inbox so that the other jobs get
+		// their turn
+		if (state == Core::STATE_YIELD || state == Core::STATE_BLOCK)
+		{
+			scheduler->queued.fetch_add(1, std::memory_order_seq_cst);
+			inbox_push(self->inbox, job);
+			return;
+		}
+
+		job->done.store(true, std::memory_order_seq_cst);
+		scheduler->pending.fetch_sub(1, std::memory_order_seq_cst);
+		scheduler_notify_done(scheduler);
+		job_unref(job);
+	}
+
+	inline static void
+	worker_main(Worker* self)
+	{
+		CURRENT_WORKER = self;
+		auto scheduler = self->scheduler;
+
+		size_t idle_rounds = 0;
+		while (true)
+		{
+			if (auto job = worker_find_job(self))
+			{
+				idle_rounds = 0;
+				worker_run_job(self, job);
+
+				// reaping is cheap, and the staged I/O requests are flushed every few jobs so
+				// they don't wait for the worker to run out of work
+				if (io_inflight(self->io) > 0)
+				{
+					if (++self->jobs_since_flush >= WORKER_FLUSH_JOBS)
+					{
+						io_flush(self->io);
+						self->jobs_since_flush = 0;
+					}
+					io_reap(self->io, false);
+				}
+				continue;
+			}
+
+			// we ran out of work, send the staged I/O requests in one batch and wait for them
+			// once we're done spinning
+			if (io_inflight(self->io) > 0)
+			{
+				io_flush(self->io);
+				self->jobs_since_flush = 0;
+				if (io_reap(self->io, idle_rounds >= 64) > 0)
+				{
+					idle_rounds = 0;
+				}
+				else
+				{
+					++idle_rounds;
+					std::this_thread::yield();
+				}
+				continue;
+			}
+
+			if (scheduler->running.load(std::memory_order_acquire) == false)
+				break;
+
+			// spin a little before going to sleep, jobs tend to come in bursts
+			if (++idle_rounds < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(scheduler->sleep_mtx);
+			scheduler->sleeping.fetch_add(1, std::memory_order_seq_cst);
+			if (scheduler->queued.load(std::memory_order_seq_cst) == 0 &&
+				scheduler->running.load(std::memory_order_acquire))
+			{
+				scheduler->sleep_cv.wait_for(lock, std::chrono::milliseconds(50));
+			}
+			scheduler->sleeping.fetch_sub(1, std::memory_order_seq_cst);
+			idle_rounds = 0;
+		}
+
+		CURRENT_WORKER = nullptr;
+	}
+
+
+	// API
+	Scheduler
+	scheduler_new(size_t workers_count, uint64_t slice)
+	{
+		if (workers_count == 0)
+			workers_count = std::thread::hardware_concurrency();
+		if (workers_count == 0)
+			workers_count = 1;
+
+		auto self = new IScheduler;
+		self->workers = mn::buf_new<Worker*>();
+		self->slice = slice;
+		self->running.store(true, std::memory_order_relaxed);
+		self->next_worker.store(0, std::memory_order_relaxed);
+		self->pending.store(0, std::memory_order_relaxed);
+		self->queued.store(0, std::memory_order_relaxed);
+		self->sleeping.store(0, std::memory_order_relaxed);
+		self->waiters.store(0, std::memory_order_relaxed);
+
+		for (size_t i = 0; i < workers_count; ++i)
+		{
+			auto worker = new Worker;
+			worker->scheduler = self;
+			worker->index = i;
+			worker->rand_state = 0x9E3779B97F4A7C15ULL * (i + 1);
+			worker->job = nullptr;
+			worker->io = io_new();
+			worker->jobs_since_flush = 0;
+			deque_init(worker->deque);
+			inbox_init(worker->inbox);
+			mn::buf_push(self->workers, worker);
+		}
+
+		// start the threads after all the workers exist since they steal from each other
+		for (auto worker: self->workers)
+			worker->thread = std::thread(worker_main, worker);
+
+		return self;
+	}
+
+	void
+	scheduler_free(Scheduler self)
+	{
+		scheduler_wait(self);
+
+		self->running.store(false, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(self->sleep_mtx);
+			self->sleep_cv.notify_all();
+		}
+
+		for (auto worker: self->workers)
+			worker->thread.join();
+
+		for (auto worker: self->workers)
+		{
+			deque_dispose(worker->deque);
+			inbox_dispose(worker->inbox);
+			io_free(worker->io);
+			delete worker;
+		}
+		mn::buf_free(self->workers);
+		delete self;
+	}
+
+	size_t
+	scheduler_workers_count(Scheduler self)
+	{
+		return self->workers.count;
+	}
+
+	Job
+	scheduler_submit(Scheduler self, const mn::Buf<uint8_t>& code, const Core& core)
+	{
+		return scheduler_push(self, job_new(self, &code, nullptr, core));
+	}
+
+	Job
+	scheduler_submit(Scheduler self, const mn::Buf<uint8_t>& code, const Blocks& blocks, const Core& core)
+	{
+		return scheduler_push(self, job_new(self, &code, &blocks, core));
+	}
+
+	Job
+	scheduler_submit(Scheduler self, Proc proc, const Core& core)
+	{
+		auto job = job_new(self, &proc_code(proc), &proc_blocks(proc), core);
+		job->proc = proc_ref(proc);
+		job->verified = proc_verified(proc);
+		core_rodata_attach(job->core, proc_rodata(proc));
+		return scheduler_push(self, job);
+	}
+
+	void
+	scheduler_wait(Scheduler self)
+	{
+		if (self->pending.load(std::memory_order_seq_cst) == 0)
+			return;
+
+		self->waiters.fetch_add(1, std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock(self->done_mtx);
+			self->done_cv.wait(lock, [self]{ return self->pending.load(std::memory_order_seq_cst) == 0; });
+		}
+		self->waiters.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	bool
+	job_done(Job self)
+	{
+		return self->done.load(std::memory_order_acquire);
+	}
+
+	const Core&
+	job_wait(Job self)
+	{
+		if (self->done.load(std::memory_order_acquire))
+			return self->core;
+
+		auto scheduler = self->scheduler;
+		scheduler->waiters.fetch_add(1, std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock(scheduler->done_mtx);
+			scheduler->done_cv.wait(lock, [self]{ return self->done.load(std::memory_order_acquire); });
+		}
+		scheduler->waiters.fetch_sub(1, std::memory_order_seq_cst);
+		return self->core;
+	}
+
+	uint64_t
+	job_ins_count(Job self)
+	{
+		return self->ins_count;
+	}
+
+	Job
+	job_current()
+	{
+		if (auto worker = CURRENT_WORKER)
+			return worker->job;
+		return nullptr;
+	}
+
+	void
+	job_resume(Job self, Reg_Val result)
+	{
+		self->result = result;
+		if (self->park.exchange(PARK_RESUMED, std::memory_order_acq_rel) == PARK_PARKED)
+			scheduler_enqueue(self->scheduler, self);
+	}
+
+	void
+	job_free(Job self)
+	{
+		job_unref(self);
+	}
+}
\ No newline at end of file
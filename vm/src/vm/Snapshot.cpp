@@ -0,0 +1,125 @@
+#include "vm/Snapshot.h"
+
+#include <string.h>
+#include <stddef.h>
+
+namespace vm
+{
+	struct Snapshot_Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t reg_count;
+		uint32_t fiber_size;
+		uint32_t state;
+		uint32_t cmp;
+		uint64_t fiber;
+		uint64_t fibers_count;
+		uint64_t mem_size;
+	};
+
+	// checks the fiber's fields in the snapshot before they're loaded as enums
+	inline static bool
+	fiber_valid(const uint8_t* ptr, uint64_t fibers_count)
+	{
+		uint32_t state = 0, cmp = 0;
+		uint64_t join = 0;
+		::memcpy(&state, ptr + offsetof(Core::Fiber, state), sizeof(state));
+		::memcpy(&cmp, ptr + offsetof(Core::Fiber, cmp), sizeof(cmp));
+		::memcpy(&join, ptr + offsetof(Core::Fiber, join), sizeof(join));
+		if (state > Core::Fiber::STATE_DONE || cmp > Core::CMP_GREATER)
+			return false;
+		// the joined fiber is looked up when the scheduler checks if it's runnable
+		return state != Core::Fiber::STATE_JOIN || join < fibers_count;
+	}
+
+	// API
+	bool
+	core_snapshot(const Core& self, mn::Buf<uint8_t>& out)
+	{
+		if (self.state == Core::STATE_PENDING)
+			return false;
+
+		Snapshot_Header header{};
+		header.magic = SNAPSHOT_MAGIC;
+		header.version = SNAPSHOT_VERSION;
+		header.reg_count = Reg_COUNT;
+		header.fiber_size = sizeof(Core::Fiber);
+		header.state = uint32_t(self.state);
+		header.cmp = uint32_t(self.cmp);
+		header.fiber = self.fiber;
+		header.fibers_count = self.fibers.count;
+		header.mem_size = self.mem_size;
+
+		size_t regs_size = sizeof(self.r);
+		size_t fibers_size = self.fibers.count * sizeof(Core::Fiber);
+		mn::buf_resize(out, sizeof(header) + regs_size + fibers_size + self.mem_size);
+
+		auto ptr = out.ptr;
+		::memcpy(ptr, &header, sizeof(header));
+		ptr += sizeof(header);
+		::memcpy(ptr, self.r, regs_size);
+		ptr += regs_size;
+		if (fibers_size > 0)
+			::memcpy(ptr, self.fibers.ptr, fibers_size);
+		ptr += fibers_size;
+		if (self.mem_size > 0)
+			::memcpy(ptr, self.mem, self.mem_size);
+		return true;
+	}
+
+	bool
+	core_restore(Core& self, const mn::Buf<uint8_t>& snapshot)
+	{
+		Snapshot_Header header{};
+		if (snapshot.count < sizeof(header))
+			return false;
+		::memcpy(&header, snapshot.ptr, sizeof(header));
+
+		// pending cores aren't snapshotted
+		if (header.magic != SNAPSHOT_MAGIC ||
+			header.version != SNAPSHOT_VERSION ||
+			header.reg_count != Reg_COUNT ||
+			header.fiber_size != sizeof(Core::Fiber) ||
+			header.state >= Core::STATE_PENDING ||
+			header.cmp > Core::CMP_GREATER)
+		{
+			return false;
+		}
+
+		// the snapshot may come from another process so the counts are bounded by its size
+		// before they're used to compute any
+		size_t regs_size = sizeof(self.r);
+		if (header.mem_size > self.mem_size)
+			return false;
+		if (header.fibers_count > (snapshot.count - sizeof(header)) / sizeof(Core::Fiber))
+			return false;
+		size_t fibers_size = header.fibers_count * sizeof(Core::Fiber);
+		if (snapshot.count != sizeof(header) + regs_size + fibers_size + header.mem_size)
+			return false;
+		if (header.fibers_count > 0 && header.fiber >= header.fibers_count)
+			return false;
+
+		for (uint64_t i = 0; i < header.fibers_count; ++i)
+			if (fiber_valid(snapshot.ptr + sizeof(header) + regs_size + i * sizeof(Core::Fiber), header.fibers_count) == false)
+				return false;
+
+		auto ptr = snapshot.ptr + sizeof(header);
+		::memcpy(self.r, ptr, regs_size);
+		ptr += regs_size;
+
+		mn::buf_resize(self.fibers, header.fibers_count);
+		if (fibers_size > 0)
+			::memcpy(self.fibers.ptr, ptr, fibers_size);
+		ptr += fibers_size;
+
+		if (header.mem_size > 0)
+			::memcpy(self.mem, ptr, header.mem_size);
+
+		self.state = Core::STATE(header.state);
+		self.cmp = Core::CMP(header.cmp);
+		self.fiber = header.fiber;
+		self.io = Io_Req{};
+		return true;
+	}
+}
@@ -0,0 +1,82 @@
+#include "vm/Verify.h"
+#include "vm/Util.h"
+
+#include <mn/Defer.h>
+
+#include <string.h>
+
+namespace vm
+{
+	inline static bool
+	op_uses_ip(const uint8_t* ins, Op op)
+	{
+		if (auto index = op_reg_index(op))
+			if (ins[index] == Reg_IP)
+				return true;
+
+		if (auto index = op_reg_pair_index(op))
+			if ((ins[index] & 0xF) == Reg_IP || (ins[index] >> 4) == Reg_IP)
+				return true;
+		return false;
+	}
+
+	// API
+	Verify_Result
+	code_verify(const mn::Buf<uint8_t>& code)
+	{
+		// first pass: decode every instruction and mark where each one starts
+		auto starts = mn::buf_with_count<uint8_t>(code.count);
+		mn_defer(mn::buf_free(starts));
+		if (starts.count > 0)
+			::memset(starts.ptr, 0, starts.count);
+
+		uint64_t last = 0;
+		for (uint64_t ix = 0; ix < code.count; ix += op_size(Op(code[ix])))
+		{
+			auto err = ins_verify(code.ptr, code.count, ix);
+			if (err != VERIFY_OK)
+				return Verify_Result{err, ix};
+			if (op_uses_ip(code.ptr + ix, Op(code[ix])))
+				return Verify_Result{VERIFY_ERR_IP_OPERAND, ix};
+			starts[ix] = 1;
+			last = ix;
+		}
+
+		if (code.count == 0)
+			return Verify_Result{VERIFY_ERR_FALLTHROUGH, 0};
+		auto last_op = Op(code[last]);
+		if (last_op != Op_HALT && op_jump_long(last_op) != Op_JMP)
+			return Verify_Result{VERIFY_ERR_FALLTHROUGH, last};
+
+		// second pass: every target should be the start of an instruction
+		for (uint64_t ix = 0; ix < code.count; ix += op_size(Op(code[ix])))
+		{
+			auto op = Op(code[ix]);
+			if (op_has_target(op) == false)
+				continue;
+
+			uint64_t next = ix + op_size(op);
+			uint64_t offset_ix = next - op_target_size(op);
+			uint64_t target = next + pop_offset(code, offset_ix, op_target_size(op));
+			if (target >= code.count || starts[target] == 0)
+				return Verify_Result{VERIFY_ERR_TARGET, ix};
+		}
+		return Verify_Result{VERIFY_OK, 0};
+	}
+
+	const char*
+	verify_err_str(VERIFY_ERR err)
+	{
+		switch(err)
+		{
+		case VERIFY_OK: return "ok";
+		case VERIFY_ERR_TRUNCATED: return "instruction runs past the end of the code";
+		case VERIFY_ERR_OPCODE: return "illegal opcode";
+		case VERIFY_ERR_REGISTER: return "register operand is not a register";
+		case VERIFY_ERR_IP_OPERAND: return "instruction uses ip as an operand";
+		case VERIFY_ERR_TARGET: return "jump target is not the start of an instruction";
+		case VERIFY_ERR_FALLTHROUGH: return "code runs off its end";
+		default: return "unknown error";
+		}
+	}
+}
\ No newline at end of file